@@ -55,6 +55,9 @@ static inline void tb_lock_page1(tb_page_addr_t p0, tb_page_addr_t p1)
 
 static inline void tb_unlock_page1(tb_page_addr_t p0, tb_page_addr_t p1) { }
 static inline void tb_unlock_pages(TranslationBlock *tb) { }
+
+uint64_t smc_hash_buf(const void *buf, size_t len);
+uint64_t tb_smc_hash(const TranslationBlock *tb);
 #else
 void tb_lock_page0(tb_page_addr_t);
 void tb_lock_page1(tb_page_addr_t, tb_page_addr_t);
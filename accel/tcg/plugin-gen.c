@@ -119,18 +119,29 @@ static void gen_udata_cb(struct qemu_plugin_regular_cb *cb)
 
 static TCGv_ptr gen_plugin_u64_ptr(qemu_plugin_u64 entry)
 {
+    struct qemu_plugin_scoreboard *score = entry.score;
     TCGv_ptr ptr = tcg_temp_ebb_new_ptr();
-
-    GArray *arr = entry.score->data;
-    char *base_ptr = arr->data + entry.offset;
-    size_t entry_size = g_array_get_element_size(arr);
-
+    TCGv_ptr chunk = tcg_temp_ebb_new_ptr();
     TCGv_i32 cpu_index = gen_cpu_index();
-    tcg_gen_muli_i32(cpu_index, cpu_index, entry_size);
-    tcg_gen_ext_i32_ptr(ptr, cpu_index);
+    TCGv_i32 tmp = tcg_temp_ebb_new_i32();
+
+    /* chunk = score->chunks[cpu_index / PLUGIN_SCOREBOARD_CHUNK] */
+    tcg_gen_shri_i32(tmp, cpu_index, PLUGIN_SCOREBOARD_CHUNK_BITS);
+    tcg_gen_muli_i32(tmp, tmp, sizeof(char *));
+    tcg_gen_ext_i32_ptr(chunk, tmp);
+    tcg_gen_addi_ptr(chunk, chunk, (intptr_t) score->chunks);
+    tcg_gen_ld_ptr(chunk, chunk, 0);
+
+    /* ptr = chunk + cpu_index % PLUGIN_SCOREBOARD_CHUNK * size + offset */
+    tcg_gen_andi_i32(tmp, cpu_index, PLUGIN_SCOREBOARD_CHUNK - 1);
+    tcg_gen_muli_i32(tmp, tmp, score->element_size);
+    tcg_gen_ext_i32_ptr(ptr, tmp);
+    tcg_gen_add_ptr(ptr, ptr, chunk);
+    tcg_gen_addi_ptr(ptr, ptr, entry.offset);
+
+    tcg_temp_free_i32(tmp);
     tcg_temp_free_i32(cpu_index);
-    tcg_gen_addi_ptr(ptr, ptr, (intptr_t) base_ptr);
-
+    tcg_temp_free_ptr(chunk);
     return ptr;
 }
 
@@ -212,6 +223,43 @@ static void gen_mem_cb(struct qemu_plugin_regular_cb *cb,
     tcg_temp_free_i32(cpu_index);
 }
 
+static void gen_mem_buffer_cb(struct qemu_plugin_buffer_cb *cb,
+                              qemu_plugin_meminfo_t meminfo, TCGv_i64 addr)
+{
+    struct qemu_plugin_mem_buffer *buf = cb->buf;
+    TCGv_ptr entry = gen_plugin_u64_ptr(qemu_plugin_scoreboard_u64(buf->score));
+    TCGv_ptr rec = tcg_temp_ebb_new_ptr();
+    TCGv_i64 count = tcg_temp_ebb_new_i64();
+    TCGv_i64 offset = tcg_temp_ebb_new_i64();
+    size_t records = offsetof(struct qemu_plugin_mem_buffer_entry, records);
+
+    /*
+     * The buffer is flushed at the start of an instruction, not here:
+     * clamp the index so that an instruction making more accesses than
+     * the slack can only overwrite the last record.
+     */
+    tcg_gen_ld_i64(count, entry, 0);
+    tcg_gen_umin_i64(offset, count, tcg_constant_i64(buf->capacity - 1));
+    tcg_gen_muli_i64(offset, offset, sizeof(struct qemu_plugin_mem_record));
+    tcg_gen_trunc_i64_ptr(rec, offset);
+    tcg_gen_add_ptr(rec, rec, entry);
+
+    tcg_gen_st_i64(addr, rec,
+                   records + offsetof(struct qemu_plugin_mem_record, vaddr));
+    tcg_gen_st_i64(tcg_constant_i64(cb->pc), rec,
+                   records + offsetof(struct qemu_plugin_mem_record, pc));
+    tcg_gen_st_i32(tcg_constant_i32(meminfo), rec,
+                   records + offsetof(struct qemu_plugin_mem_record, info));
+
+    tcg_gen_addi_i64(count, count, 1);
+    tcg_gen_st_i64(count, entry, 0);
+
+    tcg_temp_free_i64(offset);
+    tcg_temp_free_i64(count);
+    tcg_temp_free_ptr(rec);
+    tcg_temp_free_ptr(entry);
+}
+
 static void inject_cb(struct qemu_plugin_dyn_cb *cb)
 
 {
@@ -228,6 +276,10 @@ static void inject_cb(struct qemu_plugin_dyn_cb *cb)
     case PLUGIN_CB_INLINE_STORE_U64:
         gen_inline_store_u64_cb(&cb->inline_insn);
         break;
+    case PLUGIN_CB_MEM_BUFFER:
+        /* A record for the execution of the instruction itself. */
+        gen_mem_buffer_cb(&cb->buffer, 0, tcg_constant_i64(cb->buffer.pc));
+        break;
     default:
         g_assert_not_reached();
     }
@@ -249,6 +301,11 @@ static void inject_mem_cb(struct qemu_plugin_dyn_cb *cb,
             inject_cb(cb);
         }
         break;
+    case PLUGIN_CB_MEM_BUFFER:
+        if (rw & cb->buffer.rw) {
+            gen_mem_buffer_cb(&cb->buffer, meminfo, addr);
+        }
+        break;
     default:
         g_assert_not_reached();
         break;
@@ -324,6 +324,10 @@ DEF_HELPER_FLAGS_4(gvec_leus64, TCG_CALL_NO_RWG, void, ptr, ptr, i64, i32)
 
 DEF_HELPER_FLAGS_5(gvec_bitsel, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, ptr, i32)
 
+#ifdef CONFIG_USER_ONLY
+DEF_HELPER_FLAGS_2(smc_check, TCG_CALL_NO_WG, void, env, ptr)
+#endif
+
 #ifdef QEMU_FIBERS
 
 DEF_HELPER_0(fiber_scheduler, void)
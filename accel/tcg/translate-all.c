@@ -44,6 +44,7 @@
 #endif
 
 #include "exec/cputlb.h"
+#include "exec/page-protection.h"
 #include "exec/translate-all.h"
 #include "exec/translator.h"
 #include "exec/tb-flush.h"
@@ -334,11 +335,15 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cflags = cflags;
     tb_set_page_addr0(tb, phys_pc);
     tb_set_page_addr1(tb, -1);
+#ifdef CONFIG_USER_ONLY
+    tb->smc_hash = smc_selfcheck && phys_pc != -1 &&
+                   (page_get_flags(phys_pc) & PAGE_SMC_CHECK);
+#endif
+    tcg_ctx->gen_tb = tb;
     if (phys_pc != -1) {
         tb_lock_page0(phys_pc);
     }
 
-    tcg_ctx->gen_tb = tb;
     tcg_ctx->addr_type = TARGET_LONG_BITS == 32 ? TCG_TYPE_I32 : TCG_TYPE_I64;
 #ifdef CONFIG_SOFTMMU
     tcg_ctx->page_bits = TARGET_PAGE_BITS;
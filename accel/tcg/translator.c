@@ -18,6 +18,7 @@
 #include "tcg/tcg-op-common.h"
 #include "internal-target.h"
 #include "disas/disas.h"
+#include "tb-jmp-cache.h"
 
 static void set_can_do_io(DisasContextBase *db, bool val)
 {
@@ -39,6 +40,26 @@ bool translator_io_start(DisasContextBase *db)
     return true;
 }
 
+#ifdef CONFIG_USER_ONLY
+/*
+ * A self-checking TB is translated from a private copy of its guest
+ * bytes, so that the hash recorded for it covers exactly the code that
+ * was translated even if another thread stores to the page meanwhile.
+ * The rest of the first page goes at the start of the buffer and the
+ * second page right after it.  Translation is serialized by mmap_lock.
+ */
+static uint8_t *smc_snapshot;
+
+static void *smc_snapshot_copy(size_t offset, const void *host, size_t len)
+{
+    if (!smc_snapshot) {
+        smc_snapshot = g_malloc(2 * TARGET_PAGE_SIZE);
+    }
+    memcpy(smc_snapshot + offset, host, len);
+    return smc_snapshot + offset;
+}
+#endif
+
 static TCGOp *gen_tb_start(DisasContextBase *db, uint32_t cflags)
 {
     TCGv_i32 count = NULL;
@@ -48,6 +69,12 @@ static TCGOp *gen_tb_start(DisasContextBase *db, uint32_t cflags)
     gen_helper_fiber_scheduler();
 #endif
 
+#ifdef CONFIG_USER_ONLY
+    if (db->tb->smc_hash) {
+        gen_helper_smc_check(tcg_env, tcg_constant_ptr(db->tb));
+    }
+#endif
+
     if ((cflags & CF_USE_ICOUNT) || !(cflags & CF_NOIRQ)) {
         count = tcg_temp_new_i32();
         tcg_gen_ld_i32(count, tcg_env,
@@ -117,6 +144,78 @@ bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
     return ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
 }
 
+#ifdef CONFIG_USER_ONLY
+/*
+ * Emit the equivalent of tb_lookup() for a destination whose cs_base
+ * and flags are known to match the current TB, branching to @miss if
+ * the jump cache does not hold a matching TB.
+ */
+static void gen_jmp_cache_probe(const TranslationBlock *tb, uint32_t cflags,
+                                TCGv_i64 dest, TCGLabel *miss)
+{
+    TCGv_i64 t64 = tcg_temp_new_i64();
+    TCGv_i32 t32 = tcg_temp_new_i32();
+    TCGv_ptr jc = tcg_temp_new_ptr();
+    TCGv_ptr next = tcg_temp_new_ptr();
+
+    /* Breakpoints are checked by helper_lookup_tb_ptr. */
+    tcg_gen_ld_ptr(next, tcg_env,
+                   offsetof(ArchCPU, parent_obj.breakpoints) -
+                   offsetof(ArchCPU, env));
+    tcg_gen_brcondi_ptr(TCG_COND_NE, next, 0, miss);
+
+    /* &cpu->tb_jmp_cache->array[tb_jmp_cache_hash_func(dest)] */
+    tcg_gen_shri_i64(t64, dest, TB_JMP_CACHE_BITS);
+    tcg_gen_xor_i64(t64, t64, dest);
+    tcg_gen_andi_i64(t64, t64, TB_JMP_CACHE_SIZE - 1);
+    tcg_gen_muli_i64(t64, t64, sizeof(((CPUJumpCache *)NULL)->array[0]));
+    tcg_gen_trunc_i64_ptr(next, t64);
+    tcg_gen_ld_ptr(jc, tcg_env,
+                   offsetof(ArchCPU, parent_obj.tb_jmp_cache) -
+                   offsetof(ArchCPU, env));
+    tcg_gen_add_ptr(jc, jc, next);
+
+    tcg_gen_ld_ptr(next, jc, offsetof(CPUJumpCache, array[0].tb));
+    tcg_gen_brcondi_ptr(TCG_COND_EQ, next, 0, miss);
+    tcg_gen_ld_i64(t64, jc, offsetof(CPUJumpCache, array[0].pc));
+    tcg_gen_brcond_i64(TCG_COND_NE, t64, dest, miss);
+
+    tcg_gen_ld_i64(t64, next, offsetof(TranslationBlock, cs_base));
+    tcg_gen_brcondi_i64(TCG_COND_NE, t64, tb->cs_base, miss);
+    tcg_gen_ld_i32(t32, next, offsetof(TranslationBlock, flags));
+    tcg_gen_brcondi_i32(TCG_COND_NE, t32, tb->flags, miss);
+    /* An invalidated TB has CF_INVALID set and fails this test. */
+    tcg_gen_ld_i32(t32, next, offsetof(TranslationBlock, cflags));
+    tcg_gen_brcondi_i32(TCG_COND_NE, t32, cflags, miss);
+
+    tcg_gen_ld_ptr(next, next, offsetof(TranslationBlock, tc.ptr));
+    tcg_gen_goto_ptr(next);
+}
+#endif
+
+void translator_lookup_and_goto_ptr(DisasContextBase *db, TCGv_i64 dest)
+{
+#ifdef CONFIG_USER_ONLY
+    uint32_t cflags = tb_cflags(db->tb);
+
+    /*
+     * The successor is looked up with curr_cflags(), which we can only
+     * use as a constant if this TB was created with the same.  Leave
+     * -d exec logging to the helper as well.
+     */
+    if (!(cflags & CF_NO_GOTO_PTR) &&
+        cflags == curr_cflags(tcg_ctx->cpu) &&
+        !qemu_loglevel_mask(CPU_LOG_TB_CPU | CPU_LOG_EXEC)) {
+        TCGLabel *miss = gen_new_label();
+
+        plugin_gen_disable_mem_helpers();
+        gen_jmp_cache_probe(db->tb, cflags, dest, miss);
+        gen_set_label(miss);
+    }
+#endif
+    tcg_gen_lookup_and_goto_ptr();
+}
+
 void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
                      vaddr pc, void *host_pc, const TranslatorOps *ops,
                      DisasContextBase *db)
@@ -140,6 +239,12 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     db->host_addr[1] = NULL;
     db->record_start = 0;
     db->record_len = 0;
+#ifdef CONFIG_USER_ONLY
+    if (tb->smc_hash) {
+        db->host_addr[0] = smc_snapshot_copy(0, host_pc,
+                                             -(pc | TARGET_PAGE_MASK));
+    }
+#endif
 
     ops->init_disas_context(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
@@ -221,6 +326,11 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     /* May be used by disas_log or plugin callbacks. */
     tb->size = db->pc_next - db->pc_first;
     tb->icount = db->num_insns;
+#ifdef CONFIG_USER_ONLY
+    if (tb->smc_hash) {
+        tb->smc_hash = smc_hash_buf(smc_snapshot, tb->size);
+    }
+#endif
 
     if (plugin_enabled) {
         plugin_gen_tb_end(cpu, db->num_insns);
@@ -324,6 +434,14 @@ static bool translator_ld(CPUArchState *env, DisasContextBase *db,
             tb_set_page_addr1(tb, new_page1);
             tb_lock_page1(page0, new_page1);
         }
+#ifdef CONFIG_USER_ONLY
+        if (tb->smc_hash) {
+            db->host_addr[1] = smc_snapshot_copy(-(db->pc_first |
+                                                   TARGET_PAGE_MASK),
+                                                 db->host_addr[1],
+                                                 TARGET_PAGE_SIZE);
+        }
+#endif
         host = db->host_addr[1];
     }
 
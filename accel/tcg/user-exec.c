@@ -148,12 +148,28 @@ bool handle_sigsegv_accerr_write(CPUState *cpu, sigset_t *old_set,
 
 typedef struct PageFlagsNode {
     struct rcu_head rcu;
-    IntervalTreeNode itree;
+    /* Searched as a plain interval tree, modified as a gap tree. */
+    union {
+        IntervalTreeNode itree;
+        IntervalGapNode gap;
+    };
     int flags;
 } PageFlagsNode;
 
 static IntervalTreeRoot pageflags_root;
 
+/*
+ * Bumped, under mmap_lock, whenever pageflags_root is modified, so
+ * that views derived from it can tell whether they are still current.
+ */
+static uint64_t pageflags_generation;
+
+uint64_t page_flags_generation(void)
+{
+    assert_memory_lock();
+    return pageflags_generation;
+}
+
 static PageFlagsNode *pageflags_find(target_ulong start, target_ulong last)
 {
     IntervalTreeNode *n;
@@ -245,7 +261,7 @@ static void pageflags_create(target_ulong start, target_ulong last, int flags)
     p->itree.start = start;
     p->itree.last = last;
     p->flags = flags;
-    interval_tree_insert(&p->itree, &pageflags_root);
+    interval_gap_insert(&p->gap, &pageflags_root);
 }
 
 /* A subroutine of page_set_flags: remove everything in [start,last]. */
@@ -253,6 +269,7 @@ static bool pageflags_unset(target_ulong start, target_ulong last)
 {
     bool inval_tb = false;
 
+    pageflags_generation++;
     while (true) {
         PageFlagsNode *p = pageflags_find(start, last);
         target_ulong p_last;
@@ -265,13 +282,13 @@ static bool pageflags_unset(target_ulong start, target_ulong last)
             inval_tb = true;
         }
 
-        interval_tree_remove(&p->itree, &pageflags_root);
+        interval_gap_remove(&p->gap, &pageflags_root);
         p_last = p->itree.last;
 
         if (p->itree.start < start) {
             /* Truncate the node from the end, or split out the middle. */
             p->itree.last = start - 1;
-            interval_tree_insert(&p->itree, &pageflags_root);
+            interval_gap_insert(&p->gap, &pageflags_root);
             if (last < p_last) {
                 pageflags_create(last + 1, p_last, p->flags);
                 break;
@@ -282,7 +299,7 @@ static bool pageflags_unset(target_ulong start, target_ulong last)
         } else {
             /* Truncate the node from the start. */
             p->itree.start = last + 1;
-            interval_tree_insert(&p->itree, &pageflags_root);
+            interval_gap_insert(&p->gap, &pageflags_root);
             break;
         }
     }
@@ -303,7 +320,7 @@ static void pageflags_create_merge(target_ulong start, target_ulong last,
         prev = pageflags_find(start - 1, start - 1);
         if (prev) {
             if (prev->flags == flags) {
-                interval_tree_remove(&prev->itree, &pageflags_root);
+                interval_gap_remove(&prev->gap, &pageflags_root);
             } else {
                 prev = NULL;
             }
@@ -313,7 +330,7 @@ static void pageflags_create_merge(target_ulong start, target_ulong last,
         next = pageflags_find(last + 1, last + 1);
         if (next) {
             if (next->flags == flags) {
-                interval_tree_remove(&next->itree, &pageflags_root);
+                interval_gap_remove(&next->gap, &pageflags_root);
             } else {
                 next = NULL;
             }
@@ -327,10 +344,10 @@ static void pageflags_create_merge(target_ulong start, target_ulong last,
         } else {
             prev->itree.last = last;
         }
-        interval_tree_insert(&prev->itree, &pageflags_root);
+        interval_gap_insert(&prev->gap, &pageflags_root);
     } else if (next) {
         next->itree.start = start;
-        interval_tree_insert(&next->itree, &pageflags_root);
+        interval_gap_insert(&next->gap, &pageflags_root);
     } else {
         pageflags_create(start, last, flags);
     }
@@ -354,6 +371,8 @@ static bool pageflags_set_clear(target_ulong start, target_ulong last,
     int p_flags, merge_flags;
     bool inval_tb = false;
 
+    pageflags_generation++;
+
  restart:
     p = pageflags_find(start, last);
     if (!p) {
@@ -387,7 +406,7 @@ static bool pageflags_set_clear(target_ulong start, target_ulong last,
         if (merge_flags) {
             p->flags = merge_flags;
         } else {
-            interval_tree_remove(&p->itree, &pageflags_root);
+            interval_gap_remove(&p->gap, &pageflags_root);
             g_free_rcu(p, rcu);
         }
         goto done;
@@ -399,9 +418,9 @@ static bool pageflags_set_clear(target_ulong start, target_ulong last,
      */
     if (set_flags != merge_flags) {
         if (p_start < start) {
-            interval_tree_remove(&p->itree, &pageflags_root);
+            interval_gap_remove(&p->gap, &pageflags_root);
             p->itree.last = start - 1;
-            interval_tree_insert(&p->itree, &pageflags_root);
+            interval_gap_insert(&p->gap, &pageflags_root);
 
             if (last < p_last) {
                 if (merge_flags) {
@@ -422,9 +441,9 @@ static bool pageflags_set_clear(target_ulong start, target_ulong last,
                 pageflags_create(start, p_start - 1, set_flags);
             }
             if (last < p_last) {
-                interval_tree_remove(&p->itree, &pageflags_root);
+                interval_gap_remove(&p->gap, &pageflags_root);
                 p->itree.start = last + 1;
-                interval_tree_insert(&p->itree, &pageflags_root);
+                interval_gap_insert(&p->gap, &pageflags_root);
                 if (merge_flags) {
                     pageflags_create(start, last, merge_flags);
                 }
@@ -432,7 +451,7 @@ static bool pageflags_set_clear(target_ulong start, target_ulong last,
                 if (merge_flags) {
                     p->flags = merge_flags;
                 } else {
-                    interval_tree_remove(&p->itree, &pageflags_root);
+                    interval_gap_remove(&p->gap, &pageflags_root);
                     g_free_rcu(p, rcu);
                 }
                 if (p_last < last) {
@@ -447,9 +466,9 @@ static bool pageflags_set_clear(target_ulong start, target_ulong last,
     /* If flags are not changing for this range, incorporate it. */
     if (set_flags == p_flags) {
         if (start < p_start) {
-            interval_tree_remove(&p->itree, &pageflags_root);
+            interval_gap_remove(&p->gap, &pageflags_root);
             p->itree.start = start;
-            interval_tree_insert(&p->itree, &pageflags_root);
+            interval_gap_insert(&p->gap, &pageflags_root);
         }
         if (p_last < last) {
             start = p_last + 1;
@@ -459,10 +478,10 @@ static bool pageflags_set_clear(target_ulong start, target_ulong last,
     }
 
     /* Maybe split out head and/or tail ranges with the original flags. */
-    interval_tree_remove(&p->itree, &pageflags_root);
+    interval_gap_remove(&p->gap, &pageflags_root);
     if (p_start < start) {
         p->itree.last = start - 1;
-        interval_tree_insert(&p->itree, &pageflags_root);
+        interval_gap_insert(&p->gap, &pageflags_root);
 
         if (p_last < last) {
             goto restart;
@@ -472,7 +491,7 @@ static bool pageflags_set_clear(target_ulong start, target_ulong last,
         }
     } else if (last < p_last) {
         p->itree.start = last + 1;
-        interval_tree_insert(&p->itree, &pageflags_root);
+        interval_gap_insert(&p->gap, &pageflags_root);
     } else {
         g_free_rcu(p, rcu);
         goto restart;
@@ -618,42 +637,80 @@ bool page_check_range_empty(target_ulong start, target_ulong last)
 target_ulong page_find_range_empty(target_ulong min, target_ulong max,
                                    target_ulong len, target_ulong align)
 {
-    target_ulong len_m1, align_m1;
-
     assert(min <= max);
     assert(max <= GUEST_ADDR_MAX);
     assert(len != 0);
     assert(is_power_of_2(align));
     assert_memory_lock();
 
-    len_m1 = len - 1;
-    align_m1 = align - 1;
+    return (target_ulong)interval_gap_find_first(&pageflags_root, min, max,
+                                                 len, align);
+}
 
-    /* Iteratively narrow the search region. */
-    while (1) {
-        PageFlagsNode *p;
+bool smc_selfcheck;
 
-        /* Align min and double-check there's enough space remaining. */
-        min = (min + align_m1) & ~align_m1;
-        if (min > max) {
-            return -1;
-        }
-        if (len_m1 > max - min) {
-            return -1;
-        }
+/*
+ * Count write faults per page, so that page_unprotect can tell a page
+ * that mixes code and data from one that was patched once.  This is
+ * direct mapped and lossy, which only delays the switch to PAGE_SMC_CHECK.
+ * Protected by mmap_lock.
+ */
+#define SMC_FAULT_SLOTS  64
+#define SMC_FAULT_LIMIT  4
 
-        p = pageflags_find(min, min + len_m1);
-        if (p == NULL) {
-            /* Found! */
-            return min;
-        }
-        if (max <= p->itree.last) {
-            /* Existing allocation fills the remainder of the search region. */
-            return -1;
-        }
-        /* Skip across existing allocation. */
-        min = p->itree.last + 1;
+static struct {
+    target_ulong page;
+    unsigned count;
+} smc_faults[SMC_FAULT_SLOTS];
+
+static bool page_smc_fault(target_ulong start)
+{
+    unsigned i = (start >> TARGET_PAGE_BITS) % SMC_FAULT_SLOTS;
+
+    if (smc_faults[i].page != start) {
+        smc_faults[i].page = start;
+        smc_faults[i].count = 0;
     }
+    return ++smc_faults[i].count >= SMC_FAULT_LIMIT;
+}
+
+uint64_t smc_hash_buf(const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    uint64_t h = len;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        h = rol64(h ^ ldq_he_p(p + i), 31) * 0x9e3779b97f4a7c15ull;
+    }
+    for (; i < len; i++) {
+        h = rol64(h ^ p[i], 31) * 0x9e3779b97f4a7c15ull;
+    }
+    /* Zero means "not self-checking". */
+    return h | 1;
+}
+
+uint64_t tb_smc_hash(const TranslationBlock *tb)
+{
+    return smc_hash_buf(g2h_untagged(tb_page_addr0(tb)), tb->size);
+}
+
+void HELPER(smc_check)(CPUArchState *env, void *ptr)
+{
+    TranslationBlock *tb = ptr;
+
+    if (likely(tb_smc_hash(tb) == tb->smc_hash)) {
+        return;
+    }
+
+    /*
+     * The guest code changed under us: drop the TB and restart at
+     * its first insn, which will be retranslated from the new code.
+     */
+    mmap_lock();
+    tb_phys_invalidate(tb, -1);
+    mmap_unlock();
+    cpu_loop_exit_restore(env_cpu(env), GETPC());
 }
 
 void page_protect(tb_page_addr_t address)
@@ -687,6 +744,11 @@ void page_protect(tb_page_addr_t address)
         }
     }
 
+    /* A self-checking TB does not need its pages protected. */
+    if ((prot & PAGE_SMC_CHECK) && tcg_ctx->gen_tb->smc_hash) {
+        return;
+    }
+
     if (prot & PAGE_WRITE) {
         pageflags_set_clear(start, last, 0, PAGE_WRITE);
         mprotect(g2h_untagged(start), last - start + 1,
@@ -743,7 +805,13 @@ int page_unprotect(target_ulong address, uintptr_t pc)
             start = address & TARGET_PAGE_MASK;
             len = TARGET_PAGE_SIZE;
             prot = p->flags | PAGE_WRITE;
-            pageflags_set_clear(start, start + len - 1, PAGE_WRITE, 0);
+            if (smc_selfcheck && page_smc_fault(start)) {
+                /* Stop protecting this page: new TBs will check themselves. */
+                pageflags_set_clear(start, start + len - 1,
+                                    PAGE_WRITE | PAGE_SMC_CHECK, 0);
+            } else {
+                pageflags_set_clear(start, start + len - 1, PAGE_WRITE, 0);
+            }
             current_tb_invalidated = tb_invalidate_phys_page_unwind(start, pc);
         } else {
             start = address & -host_page_size;
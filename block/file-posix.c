@@ -36,6 +36,7 @@
 #include "block/thread-pool.h"
 #include "qemu/iov.h"
 #include "block/raw-aio.h"
+#include "exec/memory.h" /* for ram_block_discard_disable() */
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qstring.h"
 
@@ -161,6 +162,8 @@ typedef struct BDRVRawState {
     bool use_linux_aio:1;
     bool has_laio_fdsync:1;
     bool use_linux_io_uring:1;
+    bool has_luring_fallocate:1;
+    bool use_luring_fixed_bufs:1;
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
     bool needs_alignment;
@@ -561,6 +564,12 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+        {
+            .name = "aio-fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "register guest RAM as io_uring fixed buffers "
+                    "(default: off)",
+        },
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -642,6 +651,14 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
 
+    s->use_luring_fixed_bufs = qemu_opt_get_bool(opts, "aio-fixed-buffers",
+                                                 false);
+    if (s->use_luring_fixed_bufs && !s->use_linux_io_uring) {
+        error_setg(errp, "aio-fixed-buffers requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+
     locking = qapi_enum_parse(&OnOffAuto_lookup,
                               qemu_opt_get(opts, "locking"),
                               ON_OFF_AUTO_AUTO, &local_err);
@@ -731,7 +748,11 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     }
 #endif /* !defined(CONFIG_LINUX_AIO) */
 
-#ifndef CONFIG_LINUX_IO_URING
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        s->has_luring_fallocate = luring_has_fallocate();
+    }
+#else
     if (s->use_linux_io_uring) {
         error_setg(errp, "aio=io_uring was specified, but is not supported "
                          "in this build.");
@@ -809,6 +830,15 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         /* When extending regular files, we get zeros from the OS */
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
+
+    if (s->use_luring_fixed_bufs) {
+        /* Fixed buffers are pinned, which conflicts with RAM discard */
+        ret = ram_block_discard_disable(true);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "ram_block_discard_disable() failed");
+            goto fail;
+        }
+    }
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
@@ -2615,6 +2645,10 @@ static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
+    if (s->use_luring_fixed_bufs) {
+        ram_block_discard_disable(false);
+    }
+
     if (s->fd >= 0) {
 #if defined(CONFIG_BLKZONED)
         g_free(bs->wps);
@@ -3544,6 +3578,82 @@ static int coroutine_fn raw_co_zone_append(BlockDriverState *bs,
 }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+static bool raw_check_linux_io_uring_fallocate(BDRVRawState *s)
+{
+    return s->has_luring_fallocate && raw_check_linux_io_uring(s);
+}
+
+/*
+ * Submit the fallocate() calls that handle_aiocb_write_zeroes_unmap() and
+ * handle_aiocb_write_zeroes() would make first for a regular file through
+ * io_uring, instead of a thread pool worker.  Returns -ENOTSUP if the
+ * caller should fall back to the thread pool for the rarer cases.
+ */
+static int coroutine_fn
+raw_co_write_zeroes_io_uring(BlockDriverState *bs, int64_t offset,
+                             int64_t bytes, BdrvRequestFlags flags)
+{
+    BDRVRawState *s G_GNUC_UNUSED = bs->opaque;
+    int ret G_GNUC_UNUSED;
+
+#ifdef CONFIG_FALLOCATE_PUNCH_HOLE
+    if (flags & BDRV_REQ_MAY_UNMAP) {
+        ret = luring_co_fallocate(bs, s->fd,
+                                  FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                  offset, bytes);
+        switch (translate_err(ret)) {
+        case -ENOTSUP:
+        case -EINVAL:
+        case -EBUSY:
+            break;
+        default:
+            return translate_err(ret);
+        }
+    }
+#endif
+
+#ifdef CONFIG_FALLOCATE_ZERO_RANGE
+    if (s->has_write_zeroes) {
+        ret = translate_err(luring_co_fallocate(bs, s->fd,
+                                                FALLOC_FL_ZERO_RANGE,
+                                                offset, bytes));
+        if (ret == -ENOTSUP) {
+            s->has_write_zeroes = false;
+        } else if (ret != -EINVAL) {
+            return ret;
+        }
+    }
+#endif
+
+    return -ENOTSUP;
+}
+#endif
+
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_luring_fixed_bufs) {
+        luring_register_buf(host, size);
+    }
+#endif
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_luring_fixed_bufs) {
+        luring_unregister_buf(host, size);
+    }
+#endif
+}
+
 static coroutine_fn int
 raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes,
                 bool blkdev)
@@ -3564,6 +3674,20 @@ raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes,
         acb.aio_type |= QEMU_AIO_BLKDEV;
     }
 
+#if defined(CONFIG_LINUX_IO_URING) && defined(CONFIG_FALLOCATE_PUNCH_HOLE)
+    if (!blkdev && s->has_discard && raw_check_linux_io_uring_fallocate(s)) {
+        ret = luring_co_fallocate(bs, s->fd,
+                                  FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                  offset, bytes);
+        ret = translate_err(ret);
+        if (ret == -ENOTSUP) {
+            s->has_discard = false;
+        }
+        raw_account_discard(s, bytes, ret);
+        return ret;
+    }
+#endif
+
     ret = raw_thread_pool_submit(handle_aiocb_discard, &acb);
     raw_account_discard(s, bytes, ret);
     return ret;
@@ -3639,6 +3763,17 @@ raw_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
         handler = handle_aiocb_write_zeroes;
     }
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (!blkdev && raw_check_linux_io_uring_fallocate(s)) {
+        int ret = raw_co_write_zeroes_io_uring(bs, offset, bytes, flags);
+        if (ret != -ENOTSUP) {
+            return ret;
+        }
+        /* Let the thread pool try the remaining fallbacks */
+        handler = handle_aiocb_write_zeroes;
+    }
+#endif
+
     return raw_thread_pool_submit(handler, &acb);
 }
 
@@ -3905,6 +4040,8 @@ BlockDriver bdrv_file = {
     .bdrv_co_pdiscard       = raw_co_pdiscard,
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
     .bdrv_refresh_limits = raw_refresh_limits,
 
     .bdrv_co_truncate                   = raw_co_truncate,
@@ -4269,6 +4406,8 @@ static BlockDriver bdrv_host_device = {
     .bdrv_co_pdiscard       = hdev_co_pdiscard,
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
     .bdrv_refresh_limits = raw_refresh_limits,
 
     .bdrv_co_truncate                   = raw_co_truncate,
@@ -10,12 +10,14 @@
  */
 #include "qemu/osdep.h"
 #include <liburing.h>
+#include <linux/falloc.h>
 #include "block/aio.h"
 #include "qemu/queue.h"
 #include "block/block.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
 #include "qemu/defer-call.h"
+#include "qemu/lockable.h"
 #include "qapi/error.h"
 #include "sysemu/block-backend.h"
 #include "trace.h"
@@ -26,6 +28,27 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Kernel limits for fixed buffers */
+#define MAX_FIXED_BUF_SIZE (1 * GiB)
+#define MAX_FIXED_BUFS (1 << 14)
+
+/*
+ * Memory registered with luring_register_buf().  Each ring registers its
+ * own copy of this as fixed buffers and updates it from a bottom half
+ * when luring_bufs_gen changes.
+ */
+typedef struct LuringBuf {
+    void *host;
+    size_t size;
+    unsigned int refcnt;
+} LuringBuf;
+
+static QemuMutex luring_bufs_lock;
+static GArray *luring_bufs; /* protected by luring_bufs_lock */
+static unsigned int luring_bufs_gen;
+static QLIST_HEAD(, LuringState) luring_rings =
+    QLIST_HEAD_INITIALIZER(luring_rings); /* protected by luring_bufs_lock */
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -34,6 +57,13 @@ typedef struct LuringAIOCB {
     bool is_read;
     QSIMPLEQ_ENTRY(LuringAIOCB) next;
 
+    /* Only used by fallocate requests, which have no qiov */
+    int fallocate_mode;
+    uint64_t fallocate_len;
+
+    /* Fixed buffer holding the single element of qiov, or -1 */
+    int buf_index;
+
     /*
      * Buffered reads may require resubmission, see
      * luring_resubmit_short_read().
@@ -58,6 +88,23 @@ struct LuringState {
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
+
+    /*
+     * The fixed buffers registered with the ring, split at
+     * MAX_FIXED_BUF_SIZE and sorted by address, as of fixed_bufs_gen.
+     */
+    struct iovec *fixed_bufs;
+    unsigned int nr_fixed_bufs;
+    unsigned int fixed_bufs_gen;
+
+    /* Requests that use fixed_bufs, which keep them from being replaced */
+    unsigned int fixed_bufs_users;
+
+    /* Replaces fixed_bufs after luring_bufs has changed */
+    QEMUBH *fixed_bufs_bh;
+
+    /* Attached rings, in luring_rings */
+    QLIST_ENTRY(LuringState) next;
 };
 
 /**
@@ -90,6 +137,14 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
     luringcb->total_read += nread;
     remaining = luringcb->qiov->size - luringcb->total_read;
 
+    if (luringcb->buf_index >= 0) {
+        luringcb->sqeq.off += nread;
+        luringcb->sqeq.addr += nread;
+        luringcb->sqeq.len = remaining;
+        luring_resubmit(s, luringcb);
+        return;
+    }
+
     /* Shorten qiov */
     resubmit_qiov = &luringcb->resubmit_qiov;
     if (resubmit_qiov->iov == NULL) {
@@ -167,10 +222,10 @@ static void luring_process_completions(LuringState *s)
 
         if (ret < 0) {
             /*
-             * Only writev/readv/fsync requests on regular files or host block
-             * devices are submitted. Therefore -EAGAIN is not expected but it's
-             * known to happen sometimes with Linux SCSI. Submit again and hope
-             * the request completes successfully.
+             * Only writev/readv/fsync/fallocate requests on regular files or
+             * host block devices are submitted. Therefore -EAGAIN is not
+             * expected but it's known to happen sometimes with Linux SCSI.
+             * Submit again and hope the request completes successfully.
              *
              * For more information, see:
              * https://lore.kernel.org/io-uring/20210727165811.284510-3-axboe@kernel.dk/T/#u
@@ -270,6 +325,118 @@ static int ioq_submit(LuringState *s)
     return ret;
 }
 
+static gint luring_fixed_buf_compare(gconstpointer a, gconstpointer b)
+{
+    const struct iovec *x = a, *y = b;
+
+    return x->iov_base < y->iov_base ? -1 : x->iov_base > y->iov_base;
+}
+
+/*
+ * Replace the ring's fixed buffers with the current contents of
+ * luring_bufs.  Must only be called while no request uses the fixed
+ * buffers, because they could refer to the old buffer indexes.
+ */
+static void luring_update_fixed_bufs(LuringState *s)
+{
+    g_autoptr(GArray) iovs = g_array_new(false, false, sizeof(struct iovec));
+    guint i;
+    int ret;
+
+    if (s->nr_fixed_bufs) {
+        io_uring_unregister_buffers(&s->ring);
+        g_clear_pointer(&s->fixed_bufs, g_free);
+        s->nr_fixed_bufs = 0;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&luring_bufs_lock) {
+        s->fixed_bufs_gen = luring_bufs_gen;
+        for (i = 0; luring_bufs && i < luring_bufs->len; i++) {
+            LuringBuf *buf = &g_array_index(luring_bufs, LuringBuf, i);
+            size_t done;
+
+            for (done = 0; done < buf->size; done += MAX_FIXED_BUF_SIZE) {
+                struct iovec iov = {
+                    .iov_base = buf->host + done,
+                    .iov_len = MIN(buf->size - done, MAX_FIXED_BUF_SIZE),
+                };
+                g_array_append_val(iovs, iov);
+            }
+        }
+    }
+
+    if (iovs->len == 0 || iovs->len > MAX_FIXED_BUFS) {
+        return;
+    }
+
+    /* Buffer indexes follow registration order, so sort first */
+    g_array_sort(iovs, luring_fixed_buf_compare);
+
+    /*
+     * This pins the memory and may fail, e.g. because of RLIMIT_MEMLOCK.
+     * Requests then simply keep using plain readv/writev.
+     */
+    ret = io_uring_register_buffers(&s->ring, (struct iovec *)iovs->data,
+                                    iovs->len);
+    trace_luring_register_buffers(s, iovs->len, ret);
+    if (ret < 0) {
+        return;
+    }
+
+    s->nr_fixed_bufs = iovs->len;
+    s->fixed_bufs = (struct iovec *)g_array_free(g_steal_pointer(&iovs),
+                                                 false);
+}
+
+static bool luring_fixed_bufs_stale(LuringState *s)
+{
+    return qatomic_read(&luring_bufs_gen) != s->fixed_bufs_gen;
+}
+
+/*
+ * Registering buffers pins them, which can take a while for large guests,
+ * so it is never done while submitting a request.  Once luring_bufs has
+ * changed, new requests use plain readv/writev until this bottom half has
+ * replaced the fixed buffers.
+ */
+static void luring_fixed_bufs_bh(void *opaque)
+{
+    LuringState *s = opaque;
+
+    if (luring_fixed_bufs_stale(s) && !s->fixed_bufs_users) {
+        luring_update_fixed_bufs(s);
+    }
+}
+
+static bool luring_fixed_bufs_ready(LuringState *s)
+{
+    return !luring_fixed_bufs_stale(s) && s->nr_fixed_bufs > 0;
+}
+
+/* Return the index of the fixed buffer that contains @iov, or -1 */
+static int luring_fixed_buf_index(LuringState *s, const struct iovec *iov)
+{
+    unsigned int lo = 0, hi = s->nr_fixed_bufs;
+
+    /* Find the last buffer that starts at or before iov->iov_base */
+    while (hi - lo > 1) {
+        unsigned int mid = lo + (hi - lo) / 2;
+
+        if (s->fixed_bufs[mid].iov_base <= iov->iov_base) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (iov->iov_base >= s->fixed_bufs[lo].iov_base &&
+        iov->iov_base + iov->iov_len <=
+        s->fixed_bufs[lo].iov_base + s->fixed_bufs[lo].iov_len) {
+        return lo;
+    }
+    return -1;
+}
+
 static void luring_process_completions_and_submit(LuringState *s)
 {
     luring_process_completions(s);
@@ -342,6 +509,12 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 
     switch (type) {
     case QEMU_AIO_WRITE:
+        if (luringcb->buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                      luringcb->qiov->iov[0].iov_len, offset,
+                                      luringcb->buf_index);
+            break;
+        }
         io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
                              luringcb->qiov->niov, offset);
         break;
@@ -350,12 +523,25 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                              luringcb->qiov->niov, offset);
         break;
     case QEMU_AIO_READ:
+        if (luringcb->buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                     luringcb->qiov->iov[0].iov_len, offset,
+                                     luringcb->buf_index);
+            break;
+        }
         io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
                             luringcb->qiov->niov, offset);
         break;
     case QEMU_AIO_FLUSH:
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
         break;
+#ifdef HAVE_IO_URING_FALLOCATE
+    case QEMU_AIO_WRITE_ZEROES:
+    case QEMU_AIO_DISCARD:
+        io_uring_prep_fallocate(sqes, fd, luringcb->fallocate_mode, offset,
+                                luringcb->fallocate_len);
+        break;
+#endif
     default:
         fprintf(stderr, "%s: invalid AIO request type, aborting 0x%x.\n",
                         __func__, type);
@@ -379,6 +565,28 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     return 0;
 }
 
+/* Submit @luringcb and wait for it to complete */
+static int coroutine_fn luring_co_do_submit(BlockDriverState *bs,
+                                            LuringState *s,
+                                            LuringAIOCB *luringcb, int fd,
+                                            uint64_t offset, uint64_t nbytes,
+                                            int type)
+{
+    int ret;
+
+    trace_luring_co_submit(bs, s, luringcb, fd, offset, nbytes, type);
+    ret = luring_do_submit(fd, luringcb, s, offset, type);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (luringcb->ret == -EINPROGRESS) {
+        qemu_coroutine_yield();
+    }
+    return luringcb->ret;
+}
+
 int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
                                   QEMUIOVector *qiov, int type)
 {
@@ -390,19 +598,63 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
         .ret        = -EINPROGRESS,
         .qiov       = qiov,
         .is_read    = (type == QEMU_AIO_READ),
+        .buf_index  = -1,
     };
-    trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
-                           type);
-    ret = luring_do_submit(fd, &luringcb, s, offset, type);
 
-    if (ret < 0) {
-        return ret;
+    if ((type == QEMU_AIO_READ || type == QEMU_AIO_WRITE) &&
+        qiov->niov == 1 && luring_fixed_bufs_ready(s)) {
+        luringcb.buf_index = luring_fixed_buf_index(s, &qiov->iov[0]);
     }
 
-    if (luringcb.ret == -EINPROGRESS) {
-        qemu_coroutine_yield();
+    if (luringcb.buf_index >= 0) {
+        trace_luring_co_submit_fixed(s, &luringcb, luringcb.buf_index);
+        s->fixed_bufs_users++;
     }
-    return luringcb.ret;
+
+    ret = luring_co_do_submit(bs, s, &luringcb, fd, offset,
+                              qiov ? qiov->size : 0, type);
+
+    if (luringcb.buf_index >= 0 && --s->fixed_bufs_users == 0 &&
+        luring_fixed_bufs_stale(s)) {
+        qemu_bh_schedule(s->fixed_bufs_bh);
+    }
+    return ret;
+}
+
+int coroutine_fn luring_co_fallocate(BlockDriverState *bs, int fd, int mode,
+                                     uint64_t offset, uint64_t len)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    LuringState *s = aio_get_linux_io_uring(ctx);
+    int type = (mode & FALLOC_FL_PUNCH_HOLE) ? QEMU_AIO_DISCARD
+                                             : QEMU_AIO_WRITE_ZEROES;
+    LuringAIOCB luringcb = {
+        .co             = qemu_coroutine_self(),
+        .ret            = -EINPROGRESS,
+        .fallocate_mode = mode,
+        .fallocate_len  = len,
+        .buf_index      = -1,
+    };
+
+    return luring_co_do_submit(bs, s, &luringcb, fd, offset, len, type);
+}
+
+bool luring_has_fallocate(void)
+{
+#ifdef HAVE_IO_URING_FALLOCATE
+    struct io_uring_probe *probe = io_uring_get_probe();
+    bool ret;
+
+    /* check if host kernel supports IORING_OP_FALLOCATE */
+    if (!probe) {
+        return false;
+    }
+    ret = io_uring_opcode_supported(probe, IORING_OP_FALLOCATE);
+    io_uring_free_probe(probe);
+    return ret;
+#else
+    return false;
+#endif
 }
 
 void luring_detach_aio_context(LuringState *s, AioContext *old_context)
@@ -410,6 +662,10 @@ void luring_detach_aio_context(LuringState *s, AioContext *old_context)
     aio_set_fd_handler(old_context, s->ring.ring_fd,
                        NULL, NULL, NULL, NULL, s);
     qemu_bh_delete(s->completion_bh);
+    WITH_QEMU_LOCK_GUARD(&luring_bufs_lock) {
+        QLIST_REMOVE(s, next);
+    }
+    qemu_bh_delete(s->fixed_bufs_bh);
     s->aio_context = NULL;
 }
 
@@ -417,9 +673,14 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
 {
     s->aio_context = new_context;
     s->completion_bh = aio_bh_new(new_context, qemu_luring_completion_bh, s);
+    s->fixed_bufs_bh = aio_bh_new(new_context, luring_fixed_bufs_bh, s);
     aio_set_fd_handler(s->aio_context, s->ring.ring_fd,
                        qemu_luring_completion_cb, NULL,
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
+    WITH_QEMU_LOCK_GUARD(&luring_bufs_lock) {
+        QLIST_INSERT_HEAD(&luring_rings, s, next);
+    }
+    qemu_bh_schedule(s->fixed_bufs_bh);
 }
 
 LuringState *luring_init(Error **errp)
@@ -445,6 +706,89 @@ LuringState *luring_init(Error **errp)
 void luring_cleanup(LuringState *s)
 {
     io_uring_queue_exit(&s->ring);
+    g_free(s->fixed_bufs);
     trace_luring_cleanup_state(s);
     g_free(s);
 }
+
+static void __attribute__((__constructor__)) luring_bufs_init(void)
+{
+    qemu_mutex_init(&luring_bufs_lock);
+}
+
+/*
+ * Let every ring pick up the new contents of luring_bufs.  The ring of the
+ * calling thread is updated right away, so that the caller's next request
+ * can already use the buffer it has just registered.
+ */
+static void luring_bufs_changed(void)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    LuringState *s, *local = NULL;
+
+    WITH_QEMU_LOCK_GUARD(&luring_bufs_lock) {
+        QLIST_FOREACH(s, &luring_rings, next) {
+            if (s->aio_context == ctx) {
+                local = s;
+            } else {
+                qemu_bh_schedule(s->fixed_bufs_bh);
+            }
+        }
+    }
+
+    if (local) {
+        luring_fixed_bufs_bh(local);
+    }
+}
+
+void luring_register_buf(void *host, size_t size)
+{
+    LuringBuf *buf, new_buf = {
+        .host = host,
+        .size = size,
+        .refcnt = 1,
+    };
+    guint i;
+
+    WITH_QEMU_LOCK_GUARD(&luring_bufs_lock) {
+        if (!luring_bufs) {
+            luring_bufs = g_array_new(false, false, sizeof(LuringBuf));
+        }
+        for (i = 0; i < luring_bufs->len; i++) {
+            buf = &g_array_index(luring_bufs, LuringBuf, i);
+            if (buf->host == host && buf->size == size) {
+                buf->refcnt++;
+                return;
+            }
+        }
+
+        g_array_append_val(luring_bufs, new_buf);
+        qatomic_inc(&luring_bufs_gen);
+    }
+    luring_bufs_changed();
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+    LuringBuf *buf;
+    bool removed = false;
+    guint i;
+
+    WITH_QEMU_LOCK_GUARD(&luring_bufs_lock) {
+        for (i = 0; luring_bufs && i < luring_bufs->len; i++) {
+            buf = &g_array_index(luring_bufs, LuringBuf, i);
+            if (buf->host == host && buf->size == size) {
+                if (--buf->refcnt > 0) {
+                    return;
+                }
+                g_array_remove_index_fast(luring_bufs, i);
+                qatomic_inc(&luring_bufs_gen);
+                removed = true;
+                break;
+            }
+        }
+    }
+    if (removed) {
+        luring_bufs_changed();
+    }
+}
@@ -33,6 +33,7 @@ typedef struct Qcow2CachedTable {
     uint64_t lru_counter;
     int      ref;
     bool     dirty;
+    QTAILQ_ENTRY(Qcow2CachedTable) lru_entry;   /* only while ref == 0 */
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
@@ -44,8 +45,31 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+
+    /* Maps the offset of every cached table to its entry */
+    GHashTable             *index;
+
+    /* Unreferenced entries; unused ones first, then least recently used */
+    QTAILQ_HEAD(, Qcow2CachedTable) lru;
+
+    /* Tables being read without s->lock, see qcow2_cache_read_unlocked() */
+    GHashTable             *pending;
+    int                     nr_pending;
+
+    /* Coroutines waiting for a pending table */
+    CoQueue                 waiters;
+
+    /* Incremented whenever a table is written back */
+    uint64_t                write_gen;
 };
 
+/*
+ * Pending tables stay referenced until they are published, so enough entries
+ * are kept free for lock holders, which never use more than this many tables
+ * of a cache at the same time and cannot wait for one.
+ */
+#define QCOW2_CACHE_LOCKED_TABLES 2
+
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
 {
     return (uint8_t *) c->table_array + (size_t) table * c->table_size;
@@ -59,6 +83,86 @@ static inline int qcow2_cache_get_table_idx(Qcow2Cache *c, void *table)
     return idx;
 }
 
+static void qcow2_cache_set_offset(Qcow2Cache *c, Qcow2CachedTable *t,
+                                   int64_t offset)
+{
+    if (t->offset) {
+        g_hash_table_remove(c->index, &t->offset);
+    }
+    t->offset = offset;
+    if (offset) {
+        g_hash_table_insert(c->index, &t->offset, t);
+    }
+}
+
+/* Whether one more table may be read without s->lock */
+static bool qcow2_cache_can_add_pending(Qcow2Cache *c)
+{
+    return c->nr_pending + 1 + QCOW2_CACHE_LOCKED_TABLES <= c->size;
+}
+
+/* Start reading the table at @offset into the referenced entry @t */
+static void qcow2_cache_add_pending(Qcow2Cache *c, Qcow2CachedTable *t,
+                                    int64_t offset)
+{
+    qcow2_cache_set_offset(c, t, 0);
+    t->offset = offset;
+    g_hash_table_insert(c->pending, &t->offset, t);
+    c->nr_pending++;
+}
+
+/*
+ * Finish reading @t and wake up those waiting for it.  If @valid, the table
+ * is published unless it was cached meanwhile.  Returns whether it was; if
+ * not, @t does not hold a table anymore.
+ */
+static bool coroutine_fn
+qcow2_cache_finish_pending(Qcow2Cache *c, Qcow2CachedTable *t, bool valid)
+{
+    g_hash_table_remove(c->pending, &t->offset);
+    c->nr_pending--;
+    qemu_co_queue_restart_all(&c->waiters);
+
+    if (!valid || g_hash_table_contains(c->index, &t->offset)) {
+        t->offset = 0;
+        return false;
+    }
+    g_hash_table_insert(c->index, &t->offset, t);
+    return true;
+}
+
+/* Make an unreferenced entry the first one to be reused */
+static void qcow2_cache_entry_forget(Qcow2Cache *c, Qcow2CachedTable *t)
+{
+    assert(t->ref == 0);
+    qcow2_cache_set_offset(c, t, 0);
+    t->lru_counter = 0;
+    QTAILQ_REMOVE(&c->lru, t, lru_entry);
+    QTAILQ_INSERT_HEAD(&c->lru, t, lru_entry);
+}
+
+static void qcow2_cache_entry_ref(Qcow2Cache *c, Qcow2CachedTable *t)
+{
+    if (t->ref++ == 0) {
+        QTAILQ_REMOVE(&c->lru, t, lru_entry);
+    }
+}
+
+static void qcow2_cache_entry_unref(Qcow2Cache *c, Qcow2CachedTable *t)
+{
+    t->ref--;
+    assert(t->ref >= 0);
+
+    if (t->ref == 0) {
+        t->lru_counter = ++c->lru_counter;
+        if (t->offset) {
+            QTAILQ_INSERT_TAIL(&c->lru, t, lru_entry);
+        } else {
+            QTAILQ_INSERT_HEAD(&c->lru, t, lru_entry);
+        }
+    }
+}
+
 static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
 {
     if (c == s->refcount_block_cache) {
@@ -106,8 +210,7 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
-            c->entries[i].lru_counter = 0;
+            qcow2_cache_entry_forget(c, &c->entries[i]);
             i++;
             to_clean++;
         }
@@ -125,6 +228,7 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
+    int i;
 
     assert(num_tables > 0);
     assert(is_power_of_2(table_size));
@@ -142,8 +246,16 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
         qemu_vfree(c->table_array);
         g_free(c->entries);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    c->index = g_hash_table_new(g_int64_hash, g_int64_equal);
+    c->pending = g_hash_table_new(g_int64_hash, g_int64_equal);
+    QTAILQ_INIT(&c->lru);
+    for (i = 0; i < num_tables; i++) {
+        QTAILQ_INSERT_TAIL(&c->lru, &c->entries[i], lru_entry);
     }
+    qemu_co_queue_init(&c->waiters);
 
     return c;
 }
@@ -156,6 +268,8 @@ int qcow2_cache_destroy(Qcow2Cache *c)
         assert(c->entries[i].ref == 0);
     }
 
+    g_hash_table_destroy(c->index);
+    g_hash_table_destroy(c->pending);
     qemu_vfree(c->table_array);
     g_free(c->entries);
     g_free(c);
@@ -233,6 +347,7 @@ qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
     }
 
     c->entries[i].dirty = false;
+    c->write_gen++;
 
     return 0;
 }
@@ -312,6 +427,7 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
         c->entries[i].offset = 0;
         c->entries[i].lru_counter = 0;
     }
+    g_hash_table_remove_all(c->index);
 
     qcow2_cache_table_release(c, 0, c->size);
 
@@ -320,16 +436,53 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
     return 0;
 }
 
-static int GRAPH_RDLOCK
+/*
+ * Read the table at @offset into the referenced entry @t with s->lock dropped,
+ * so that other requests can go on meanwhile.  Until the table is published in
+ * the index, only qcow2_cache_get_unlocking() callers see it; they wait for it
+ * instead of reading it again.  Lock holders that need the table meanwhile read
+ * it themselves.  If they did, or if any table was written back while the lock
+ * was dropped, the copy read here may be outdated and is thrown away.
+ *
+ * Returns 0 if @t holds the table, -EAGAIN if the lookup must be repeated or
+ * -errno.  @t is released on failure.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_cache_read_unlocked(BlockDriverState *bs, Qcow2Cache *c,
+                          Qcow2CachedTable *t, uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t write_gen = c->write_gen;
+    int ret;
+
+    qcow2_cache_add_pending(c, t, offset);
+
+    qemu_co_mutex_unlock(&s->lock);
+    if (c == s->l2_table_cache) {
+        BLKDBG_CO_EVENT(bs->file, BLKDBG_L2_LOAD);
+    }
+    ret = bdrv_co_pread(bs->file, offset, c->table_size,
+                        qcow2_cache_get_table_addr(c, t - c->entries), 0);
+    qemu_co_mutex_lock(&s->lock);
+
+    if (!qcow2_cache_finish_pending(c, t, ret >= 0 &&
+                                    write_gen == c->write_gen)) {
+        qcow2_cache_entry_unref(c, t);
+        return ret < 0 ? ret : -EAGAIN;
+    }
+    return 0;
+}
+
+static int coroutine_mixed_fn GRAPH_RDLOCK
 qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
-                   void **table, bool read_from_disk)
+                   void **table, bool read_from_disk, bool may_unlock)
 {
     BDRVQcow2State *s = bs->opaque;
+    Qcow2CachedTable *t;
+    int64_t key = offset;
+    bool unlock = may_unlock && qemu_in_coroutine();
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     assert(offset != 0);
 
@@ -343,41 +496,55 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
         return -EIO;
     }
 
+    if (unlock) {
+        qemu_co_mutex_assert_locked(&s->lock);
+    }
+
+retry:
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
-        }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+    t = g_hash_table_lookup(c->index, &key);
+    if (t) {
+        qcow2_cache_entry_ref(c, t);
+        goto found;
+    }
 
-    if (min_lru_index == -1) {
-        /* This can't happen in current synchronous code, but leave the check
-         * here as a reminder for whoever starts using AIO with the cache */
-        abort();
+    if (unlock && g_hash_table_contains(c->pending, &key)) {
+        /* Somebody else is reading it, wait and share the result */
+        qemu_co_queue_wait(&c->waiters, &s->lock);
+        goto retry;
     }
 
     /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
+    t = QTAILQ_FIRST(&c->lru);
+    if (!t) {
+        /* Lock holders never use all tables, see QCOW2_CACHE_LOCKED_TABLES */
+        abort();
+    }
+    i = t - c->entries;
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
+    qcow2_cache_entry_ref(c, t);
     ret = qcow2_cache_entry_flush(bs, c, i);
     if (ret < 0) {
+        qcow2_cache_entry_unref(c, t);
         return ret;
     }
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+
+    if (read_from_disk && unlock && qcow2_cache_can_add_pending(c)) {
+        ret = qcow2_cache_read_unlocked(bs, c, t, offset);
+        if (ret == -EAGAIN) {
+            goto retry;
+        } else if (ret < 0) {
+            return ret;
+        }
+        goto found;
+    }
+
+    qcow2_cache_set_offset(c, t, offset);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -386,15 +553,15 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
         ret = bdrv_pread(bs->file, offset, c->table_size,
                          qcow2_cache_get_table_addr(c, i), 0);
         if (ret < 0) {
+            qcow2_cache_set_offset(c, t, 0);
+            qcow2_cache_entry_unref(c, t);
             return ret;
         }
     }
 
-    c->entries[i].offset = offset;
-
     /* And return the right table */
 found:
-    c->entries[i].ref++;
+    i = t - c->entries;
     *table = qcow2_cache_get_table_addr(c, i);
 
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
@@ -406,27 +573,116 @@ found:
 int qcow2_cache_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     void **table)
 {
-    return qcow2_cache_do_get(bs, c, offset, table, true);
+    return qcow2_cache_do_get(bs, c, offset, table, true, false);
+}
+
+/*
+ * Like qcow2_cache_get(), but a coroutine caller that holds s->lock may have
+ * it dropped while the table is read or while another request reads it.  The
+ * caller must check again whatever it looked up under the lock before.
+ */
+int qcow2_cache_get_unlocking(BlockDriverState *bs, Qcow2Cache *c,
+                              uint64_t offset, void **table)
+{
+    return qcow2_cache_do_get(bs, c, offset, table, true, true);
 }
 
 int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     void **table)
 {
-    return qcow2_cache_do_get(bs, c, offset, table, false);
+    return qcow2_cache_do_get(bs, c, offset, table, false, false);
 }
 
-void qcow2_cache_put(Qcow2Cache *c, void **table)
+/* Return the number of entries that do not hold a table */
+int qcow2_cache_unused_entries(Qcow2Cache *c)
 {
-    int i = qcow2_cache_get_table_idx(c, *table);
+    Qcow2CachedTable *t;
+    int n = 0;
 
-    c->entries[i].ref--;
-    *table = NULL;
+    QTAILQ_FOREACH(t, &c->lru, lru_entry) {
+        if (t->offset) {
+            break;
+        }
+        n++;
+    }
+    return n;
+}
 
-    if (c->entries[i].ref == 0) {
-        c->entries[i].lru_counter = ++c->lru_counter;
+/*
+ * Read up to @n adjacent tables starting at @offset with a single request.
+ * Only entries that do not hold a table are used, so nothing is evicted;
+ * the run ends early at a table that is already cached or being read.
+ *
+ * Called with s->lock held, which is dropped during the read like in
+ * qcow2_cache_read_unlocked(), so several runs can be read at the same time
+ * and requests can use the cache meanwhile.
+ *
+ * Returns the number of tables read or -errno.
+ */
+int coroutine_fn
+qcow2_cache_prefetch(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
+                     int n)
+{
+    BDRVQcow2State *s = bs->opaque;
+    g_autofree Qcow2CachedTable **tables = g_new(Qcow2CachedTable *, n);
+    uint64_t write_gen = c->write_gen;
+    QEMUIOVector qiov;
+    int i, published, ret;
+
+    for (i = 0; i < n; i++) {
+        Qcow2CachedTable *t = QTAILQ_FIRST(&c->lru);
+        int64_t key = offset + (uint64_t) i * c->table_size;
+
+        if (!t || t->offset || !qcow2_cache_can_add_pending(c) ||
+            g_hash_table_contains(c->index, &key) ||
+            g_hash_table_contains(c->pending, &key)) {
+            break;
+        }
+        qcow2_cache_entry_ref(c, t);
+        qcow2_cache_add_pending(c, t, key);
+        tables[i] = t;
+    }
+    n = i;
+    if (n == 0) {
+        return 0;
     }
 
-    assert(c->entries[i].ref >= 0);
+    trace_qcow2_cache_prefetch(qemu_coroutine_self(), c == s->l2_table_cache,
+                               offset, n);
+
+    qemu_iovec_init(&qiov, n);
+    for (i = 0; i < n; i++) {
+        qemu_iovec_add(&qiov,
+                       qcow2_cache_get_table_addr(c, tables[i] - c->entries),
+                       c->table_size);
+    }
+
+    qemu_co_mutex_unlock(&s->lock);
+    if (c == s->l2_table_cache) {
+        BLKDBG_CO_EVENT(bs->file, BLKDBG_L2_LOAD);
+    }
+    ret = bdrv_co_preadv(bs->file, offset, qiov.size, &qiov, 0);
+    qemu_co_mutex_lock(&s->lock);
+    qemu_iovec_destroy(&qiov);
+
+    published = 0;
+    for (i = 0; i < n; i++) {
+        if (qcow2_cache_finish_pending(c, tables[i], ret >= 0 &&
+                                       write_gen == c->write_gen)) {
+            published++;
+        }
+        qcow2_cache_entry_unref(c, tables[i]);
+    }
+
+    return ret < 0 ? ret : published;
+}
+
+void qcow2_cache_put(Qcow2Cache *c, void **table)
+{
+    int i = qcow2_cache_get_table_idx(c, *table);
+
+    qcow2_cache_entry_unref(c, &c->entries[i]);
+    *table = NULL;
 }
 
 void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
@@ -438,24 +694,20 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
-    int i;
+    int64_t key = offset;
+    Qcow2CachedTable *t = g_hash_table_lookup(c->index, &key);
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
+    if (!t) {
+        return NULL;
     }
-    return NULL;
+    return qcow2_cache_get_table_addr(c, t - c->entries);
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
 {
     int i = qcow2_cache_get_table_idx(c, table);
 
-    assert(c->entries[i].ref == 0);
-
-    c->entries[i].offset = 0;
-    c->entries[i].lru_counter = 0;
+    qcow2_cache_entry_forget(c, &c->entries[i]);
     c->entries[i].dirty = false;
 
     qcow2_cache_table_release(c, i, 1);
@@ -25,6 +25,7 @@
 #include "qemu/osdep.h"
 #include <zlib.h>
 
+#include "block/aio_task.h"
 #include "block/block-io.h"
 #include "qapi/error.h"
 #include "qcow2.h"
@@ -201,6 +202,7 @@ int qcow2_grow_l1_table(BlockDriverState *bs, uint64_t min_size,
  *          table to load.
  * @l2_offset: Offset to the L2 table in the image file.
  * @l2_slice: Location to store the pointer to the L2 slice.
+ * @may_unlock: Whether s->lock may be dropped, see qcow2_cache_get_unlocking()
  *
  * Loads a L2 slice into memory (L2 slices are the parts of L2 tables
  * that are loaded by the qcow2 cache). If the slice is in the cache,
@@ -209,12 +211,17 @@ int qcow2_grow_l1_table(BlockDriverState *bs, uint64_t min_size,
  */
 static int GRAPH_RDLOCK
 l2_load(BlockDriverState *bs, uint64_t offset,
-        uint64_t l2_offset, uint64_t **l2_slice)
+        uint64_t l2_offset, uint64_t **l2_slice, bool may_unlock)
 {
     BDRVQcow2State *s = bs->opaque;
     int start_of_slice = l2_entry_size(s) *
         (offset_to_l2_index(s, offset) - offset_to_l2_slice_index(s, offset));
 
+    if (may_unlock) {
+        return qcow2_cache_get_unlocking(bs, s->l2_table_cache,
+                                         l2_offset + start_of_slice,
+                                         (void **)l2_slice);
+    }
     return qcow2_cache_get(bs, s->l2_table_cache, l2_offset + start_of_slice,
                            (void **)l2_slice);
 }
@@ -535,6 +542,39 @@ do_perform_cow_read(BlockDriverState *bs, uint64_t src_cluster_offset,
     return 0;
 }
 
+typedef struct Qcow2CowReadTask {
+    AioTask task;
+    BlockDriverState *bs;
+    uint64_t src_cluster_offset;
+    unsigned offset_in_cluster;
+    QEMUIOVector qiov;
+} Qcow2CowReadTask;
+
+/*
+ * This function can count as GRAPH_RDLOCK because perform_cow() holds the
+ * graph lock and waits for the task to complete.
+ */
+static int coroutine_fn GRAPH_RDLOCK cow_read_task_entry(AioTask *task)
+{
+    Qcow2CowReadTask *t = container_of(task, Qcow2CowReadTask, task);
+
+    return do_perform_cow_read(t->bs, t->src_cluster_offset,
+                               t->offset_in_cluster, &t->qiov);
+}
+
+/*
+ * Return true if the COW region @r of @m is known to read as zeroes, e.g.
+ * because the backing file has no data there, so it need not be read.
+ */
+static bool coroutine_fn GRAPH_RDLOCK
+cow_region_is_zero(BlockDriverState *bs, QCowL2Meta *m, Qcow2COWRegion *r)
+{
+    if (r->nb_bytes == 0) {
+        return false;
+    }
+    return bdrv_co_is_zero_fast(bs, m->offset + r->offset, r->nb_bytes) == 1;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 do_perform_cow_write(BlockDriverState *bs, uint64_t cluster_offset,
                      unsigned offset_in_cluster, QEMUIOVector *qiov)
@@ -612,6 +652,7 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
 
     *host_offset = 0;
 
+again:
     /* seek to the l2 offset in the l1 table */
 
     l1_index = offset_to_l1_index(s, offset);
@@ -635,11 +676,18 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
 
     /* load the l2 slice in memory */
 
-    ret = l2_load(bs, offset, l2_offset, &l2_slice);
+    ret = l2_load(bs, offset, l2_offset, &l2_slice, true);
     if (ret < 0) {
         return ret;
     }
 
+    /* The L2 table may have been replaced while s->lock was dropped */
+    if (l1_index >= s->l1_size ||
+        (s->l1_table[l1_index] & L1E_OFFSET_MASK) != l2_offset) {
+        qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+        goto again;
+    }
+
     /* find the cluster offset for the given disk offset */
 
     l2_index = offset_to_l2_slice_index(s, offset);
@@ -800,7 +848,7 @@ get_cluster_table(BlockDriverState *bs, uint64_t offset,
     }
 
     /* load the l2 slice in memory */
-    ret = l2_load(bs, offset, l2_offset, &l2_slice);
+    ret = l2_load(bs, offset, l2_offset, &l2_slice, false);
     if (ret < 0) {
         return ret;
     }
@@ -892,7 +940,7 @@ perform_cow(BlockDriverState *bs, QCowL2Meta *m)
     Qcow2COWRegion *end = &m->cow_end;
     unsigned buffer_size;
     unsigned data_bytes = end->offset - (start->offset + start->nb_bytes);
-    bool merge_reads;
+    bool merge_reads, start_zero, end_zero;
     uint8_t *start_buffer, *end_buffer;
     QEMUIOVector qiov;
     int ret;
@@ -905,10 +953,16 @@ perform_cow(BlockDriverState *bs, QCowL2Meta *m)
         return 0;
     }
 
+    qemu_co_mutex_unlock(&s->lock);
+
+    start_zero = cow_region_is_zero(bs, m, start);
+    end_zero = cow_region_is_zero(bs, m, end);
+
     /* If we have to read both the start and end COW regions and the
      * middle region is not too large then perform just one read
      * operation */
-    merge_reads = start->nb_bytes && end->nb_bytes && data_bytes <= 16384;
+    merge_reads = start->nb_bytes && end->nb_bytes && data_bytes <= 16384 &&
+                  !start_zero && !end_zero;
     if (merge_reads) {
         buffer_size = start->nb_bytes + data_bytes + end->nb_bytes;
     } else {
@@ -922,22 +976,22 @@ perform_cow(BlockDriverState *bs, QCowL2Meta *m)
         buffer_size = QEMU_ALIGN_UP(start->nb_bytes, align) + end->nb_bytes;
     }
 
+    qemu_iovec_init(&qiov, 2 + (m->data_qiov ?
+                                qemu_iovec_subvec_niov(m->data_qiov,
+                                                       m->data_qiov_offset,
+                                                       data_bytes)
+                                : 0));
+
     /* Reserve a buffer large enough to store all the data that we're
      * going to read */
     start_buffer = qemu_try_blockalign(bs, buffer_size);
     if (start_buffer == NULL) {
-        return -ENOMEM;
+        ret = -ENOMEM;
+        goto fail;
     }
     /* The part of the buffer where the end region is located */
     end_buffer = start_buffer + buffer_size - end->nb_bytes;
 
-    qemu_iovec_init(&qiov, 2 + (m->data_qiov ?
-                                qemu_iovec_subvec_niov(m->data_qiov,
-                                                       m->data_qiov_offset,
-                                                       data_bytes)
-                                : 0));
-
-    qemu_co_mutex_unlock(&s->lock);
     /* First we read the existing data from both COW regions. We
      * either read the whole region in one go, or the start and end
      * regions separately. */
@@ -945,15 +999,45 @@ perform_cow(BlockDriverState *bs, QCowL2Meta *m)
         qemu_iovec_add(&qiov, start_buffer, buffer_size);
         ret = do_perform_cow_read(bs, m->offset, start->offset, &qiov);
     } else {
-        qemu_iovec_add(&qiov, start_buffer, start->nb_bytes);
-        ret = do_perform_cow_read(bs, m->offset, start->offset, &qiov);
-        if (ret < 0) {
-            goto fail;
+        AioTaskPool *aio = NULL;
+
+        if (start_zero) {
+            memset(start_buffer, 0, start->nb_bytes);
+            ret = 0;
+        } else if (start->nb_bytes && end->nb_bytes && !end_zero) {
+            /* Read the start region while we read the end region below */
+            Qcow2CowReadTask *t = g_new(Qcow2CowReadTask, 1);
+
+            *t = (Qcow2CowReadTask) {
+                .task.func = cow_read_task_entry,
+                .bs = bs,
+                .src_cluster_offset = m->offset,
+                .offset_in_cluster = start->offset,
+            };
+            qemu_iovec_init_buf(&t->qiov, start_buffer, start->nb_bytes);
+            aio = aio_task_pool_new(1);
+            aio_task_pool_start_task(aio, &t->task);
+            ret = 0;
+        } else {
+            qemu_iovec_add(&qiov, start_buffer, start->nb_bytes);
+            ret = do_perform_cow_read(bs, m->offset, start->offset, &qiov);
         }
 
-        qemu_iovec_reset(&qiov);
-        qemu_iovec_add(&qiov, end_buffer, end->nb_bytes);
-        ret = do_perform_cow_read(bs, m->offset, end->offset, &qiov);
+        if (ret == 0 && end_zero) {
+            memset(end_buffer, 0, end->nb_bytes);
+        } else if (ret == 0) {
+            qemu_iovec_reset(&qiov);
+            qemu_iovec_add(&qiov, end_buffer, end->nb_bytes);
+            ret = do_perform_cow_read(bs, m->offset, end->offset, &qiov);
+        }
+
+        if (aio) {
+            aio_task_pool_wait_all(aio);
+            if (ret == 0) {
+                ret = aio_task_pool_status(aio);
+            }
+            aio_task_pool_free(aio);
+        }
     }
     if (ret < 0) {
         goto fail;
@@ -23,6 +23,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "block/aio_task.h"
 #include "block/block-io.h"
 #include "qapi/error.h"
 #include "qcow2.h"
@@ -1590,6 +1591,13 @@ enum {
     CHECK_FRAG_INFO = 0x2,      /* update BlockFragInfo counters */
 };
 
+/*
+ * check_refcounts_l1() reads the L2 tables of up to this many bytes worth
+ * of L1 entries ahead, with at most QCOW2_CHECK_L2_READS reads in flight.
+ */
+#define QCOW2_CHECK_L2_BATCH_BYTES (16 * MiB)
+#define QCOW2_CHECK_L2_READS 16
+
 /*
  * Fix L2 entry by making it QCOW2_CLUSTER_ZERO_PLAIN (or making all its present
  * subclusters QCOW2_SUBCLUSTER_ZERO_PLAIN).
@@ -1663,24 +1671,15 @@ static int coroutine_fn GRAPH_RDLOCK
 check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                    void **refcount_table,
                    int64_t *refcount_table_size, int64_t l2_offset,
-                   int flags, BdrvCheckMode fix, bool active)
+                   uint64_t *l2_table, int flags, BdrvCheckMode fix,
+                   bool active)
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t l2_entry, l2_bitmap;
     uint64_t next_contiguous_offset = 0;
     int i, ret;
-    size_t l2_size_bytes = s->l2_size * l2_entry_size(s);
-    g_autofree uint64_t *l2_table = g_malloc(l2_size_bytes);
     bool metadata_overlap;
 
-    /* Read L2 table from disk */
-    ret = bdrv_co_pread(bs->file, l2_offset, l2_size_bytes, l2_table, 0);
-    if (ret < 0) {
-        fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
-        res->check_errors++;
-        return ret;
-    }
-
     /* Do the actual checks */
     for (i = 0; i < s->l2_size; i++) {
         uint64_t coffset;
@@ -1851,6 +1850,66 @@ check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
     return 0;
 }
 
+typedef struct CheckL2ReadTask {
+    AioTask task;
+
+    BlockDriverState *bs;
+    uint64_t l2_offset;
+    uint64_t *l2_table;
+    int *ret;
+} CheckL2ReadTask;
+
+/*
+ * This function can count as GRAPH_RDLOCK because check_read_l2_tables()
+ * holds the graph lock and waits for this coroutine to terminate.
+ */
+static int coroutine_fn GRAPH_RDLOCK check_read_l2_table_entry(AioTask *task)
+{
+    CheckL2ReadTask *t = container_of(task, CheckL2ReadTask, task);
+    BDRVQcow2State *s = t->bs->opaque;
+
+    *t->ret = bdrv_co_pread(t->bs->file, t->l2_offset,
+                            s->l2_size * l2_entry_size(s), t->l2_table, 0);
+    return 0;
+}
+
+/*
+ * Reads the L2 tables referenced by the @n entries of @l1_table into
+ * consecutive tables of @l2_tables, keeping several reads in flight.  The
+ * result of each read is stored in @ret.
+ */
+static void coroutine_fn GRAPH_RDLOCK
+check_read_l2_tables(BlockDriverState *bs, const uint64_t *l1_table, int n,
+                     uint64_t *l2_tables, int *ret)
+{
+    BDRVQcow2State *s = bs->opaque;
+    size_t l2_size_bytes = s->l2_size * l2_entry_size(s);
+    AioTaskPool *aio = aio_task_pool_new(QCOW2_CHECK_L2_READS);
+    int i;
+
+    for (i = 0; i < n; i++) {
+        CheckL2ReadTask *t;
+
+        ret[i] = 0;
+        if (!l1_table[i]) {
+            continue;
+        }
+
+        t = g_new(CheckL2ReadTask, 1);
+        *t = (CheckL2ReadTask) {
+            .task.func = check_read_l2_table_entry,
+            .bs = bs,
+            .l2_offset = l1_table[i] & L1E_OFFSET_MASK,
+            .l2_table = l2_tables + i * l2_size_bytes / sizeof(uint64_t),
+            .ret = &ret[i],
+        };
+        aio_task_pool_start_task(aio, &t->task);
+    }
+
+    aio_task_pool_wait_all(aio);
+    aio_task_pool_free(aio);
+}
+
 /*
  * Increases the refcount for the L1 table, its L2 tables and all referenced
  * clusters in the given refcount table. While doing so, performs some checks
@@ -1867,9 +1926,12 @@ check_refcounts_l1(BlockDriverState *bs, BdrvCheckResult *res,
 {
     BDRVQcow2State *s = bs->opaque;
     size_t l1_size_bytes = l1_size * L1E_SIZE;
+    size_t l2_size_bytes = s->l2_size * l2_entry_size(s);
     g_autofree uint64_t *l1_table = NULL;
+    g_autofree uint64_t *l2_tables = NULL;
+    g_autofree int *l2_ret = NULL;
     uint64_t l2_offset;
-    int i, ret;
+    int i, j, batch, ret;
 
     if (!l1_size) {
         return 0;
@@ -1900,41 +1962,70 @@ check_refcounts_l1(BlockDriverState *bs, BdrvCheckResult *res,
         be64_to_cpus(&l1_table[i]);
     }
 
+    /*
+     * Reading the L2 tables one at a time leaves the device idle while each
+     * one is checked, so read a batch of them concurrently and then check
+     * them in L1 order.
+     */
+    batch = MIN(MAX(QCOW2_CHECK_L2_BATCH_BYTES / l2_size_bytes, 1), l1_size);
+    l2_tables = g_try_malloc(batch * l2_size_bytes);
+    l2_ret = g_try_new(int, batch);
+    if (l2_tables == NULL || l2_ret == NULL) {
+        res->check_errors++;
+        return -ENOMEM;
+    }
+
     /* Do the actual checks */
-    for (i = 0; i < l1_size; i++) {
-        if (!l1_table[i]) {
-            continue;
-        }
+    for (i = 0; i < l1_size; i += batch) {
+        int n = MIN(batch, l1_size - i);
 
-        if (l1_table[i] & L1E_RESERVED_MASK) {
-            fprintf(stderr, "ERROR found L1 entry with reserved bits set: "
-                    "%" PRIx64 "\n", l1_table[i]);
-            res->corruptions++;
-        }
+        check_read_l2_tables(bs, l1_table + i, n, l2_tables, l2_ret);
 
-        l2_offset = l1_table[i] & L1E_OFFSET_MASK;
+        for (j = 0; j < n; j++) {
+            uint64_t l1_entry = l1_table[i + j];
 
-        /* Mark L2 table as used */
-        ret = qcow2_inc_refcounts_imrt(bs, res,
-                                       refcount_table, refcount_table_size,
-                                       l2_offset, s->cluster_size);
-        if (ret < 0) {
-            return ret;
-        }
+            if (!l1_entry) {
+                continue;
+            }
 
-        /* L2 tables are cluster aligned */
-        if (offset_into_cluster(s, l2_offset)) {
-            fprintf(stderr, "ERROR l2_offset=%" PRIx64 ": Table is not "
-                "cluster aligned; L1 entry corrupted\n", l2_offset);
-            res->corruptions++;
-        }
+            if (l1_entry & L1E_RESERVED_MASK) {
+                fprintf(stderr, "ERROR found L1 entry with reserved bits set: "
+                        "%" PRIx64 "\n", l1_entry);
+                res->corruptions++;
+            }
 
-        /* Process and check L2 entries */
-        ret = check_refcounts_l2(bs, res, refcount_table,
-                                 refcount_table_size, l2_offset, flags,
-                                 fix, active);
-        if (ret < 0) {
-            return ret;
+            l2_offset = l1_entry & L1E_OFFSET_MASK;
+
+            /* Mark L2 table as used */
+            ret = qcow2_inc_refcounts_imrt(bs, res,
+                                           refcount_table, refcount_table_size,
+                                           l2_offset, s->cluster_size);
+            if (ret < 0) {
+                return ret;
+            }
+
+            /* L2 tables are cluster aligned */
+            if (offset_into_cluster(s, l2_offset)) {
+                fprintf(stderr, "ERROR l2_offset=%" PRIx64 ": Table is not "
+                    "cluster aligned; L1 entry corrupted\n", l2_offset);
+                res->corruptions++;
+            }
+
+            if (l2_ret[j] < 0) {
+                fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
+                res->check_errors++;
+                return l2_ret[j];
+            }
+
+            /* Process and check L2 entries */
+            ret = check_refcounts_l2(bs, res, refcount_table,
+                                     refcount_table_size, l2_offset,
+                                     l2_tables +
+                                     j * l2_size_bytes / sizeof(uint64_t),
+                                     flags, fix, active);
+            if (ret < 0) {
+                return ret;
+            }
         }
     }
 
@@ -38,6 +38,19 @@
 #include "block/thread-pool.h"
 #include "crypto.h"
 
+static int qcow2_max_threads(void)
+{
+    static int max_threads;
+    int n = qatomic_read(&max_threads);
+
+    if (!n) {
+        n = MIN(MAX(g_get_num_processors(), QCOW2_MIN_THREADS),
+                THREAD_POOL_MAX_THREADS_DEFAULT);
+        qatomic_set(&max_threads, n);
+    }
+    return n;
+}
+
 static int coroutine_fn
 qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
 {
@@ -45,7 +58,7 @@ qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
     BDRVQcow2State *s = bs->opaque;
 
     qemu_co_mutex_lock(&s->lock);
-    while (s->nb_threads >= QCOW2_MAX_THREADS) {
+    while (s->nb_threads >= qcow2_max_threads()) {
         qemu_co_queue_wait(&s->thread_task_queue, &s->lock);
     }
     s->nb_threads++;
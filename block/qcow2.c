@@ -701,6 +701,7 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_CACHE_PREFETCH,
     NULL
 };
 
@@ -817,6 +818,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_CACHE_PREFETCH,
+            .type = QEMU_OPT_BOOL,
+            .help = "Load L2 tables and refcount blocks into the caches "
+                    "in the background after open",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -878,6 +885,193 @@ static void qcow2_attach_aio_context(BlockDriverState *bs,
     cache_clean_timer_init(bs, new_context);
 }
 
+/* Largest read issued when loading tables into the caches in the background */
+#define QCOW2_PREFETCH_MAX_BYTES (1 * MiB)
+
+static int qcow2_compare_offsets(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+typedef struct Qcow2PrefetchTask {
+    AioTask task;
+
+    BlockDriverState *bs;
+    Qcow2Cache *cache;
+    uint64_t offset;
+    int n;
+} Qcow2PrefetchTask;
+
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_cache_prefetch_task_entry(AioTask *task)
+{
+    Qcow2PrefetchTask *t = container_of(task, Qcow2PrefetchTask, task);
+    BDRVQcow2State *s = t->bs->opaque;
+    int ret;
+
+    qemu_co_mutex_lock(&s->lock);
+    ret = qcow2_cache_prefetch(t->bs, t->cache, t->offset, t->n);
+    qemu_co_mutex_unlock(&s->lock);
+
+    return ret < 0 ? ret : 0;
+}
+
+/*
+ * Load the tables that the clusters listed in @table point to into the
+ * unused entries of @c, in the order of @table.  The selected tables are
+ * read in offset order, merging adjacent ones into larger requests, with
+ * up to QCOW2_MAX_WORKERS requests in flight.
+ *
+ * Called with s->lock held.  The lock is not held while the tables are
+ * read, so that guest I/O can go ahead.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_cache_prefetch_tables(BlockDriverState *bs, Qcow2Cache *c,
+                            const uint64_t *table, uint64_t table_entries,
+                            uint64_t offset_mask, unsigned table_size)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int tables_per_cluster = s->cluster_size / table_size;
+    int max_run = MAX(QCOW2_PREFETCH_MAX_BYTES / table_size, 1);
+    g_autofree uint64_t *offsets = NULL;
+    AioTaskPool *aio;
+    int budget, n = 0, run, i, j;
+    uint64_t k;
+    int ret;
+
+    budget = qcow2_cache_unused_entries(c);
+    if (budget == 0) {
+        return 0;
+    }
+
+    offsets = g_new(uint64_t, budget);
+    for (k = 0; k < table_entries && n < budget; k++) {
+        uint64_t cluster = table[k] & offset_mask;
+
+        /* Leave unaligned offsets to the regular code to report */
+        if (!cluster || offset_into_cluster(s, cluster)) {
+            continue;
+        }
+        for (j = 0; j < tables_per_cluster && n < budget; j++) {
+            uint64_t offset = cluster + (uint64_t) j * table_size;
+
+            if (!qcow2_cache_is_table_offset(c, offset)) {
+                offsets[n++] = offset;
+            }
+        }
+    }
+    qsort(offsets, n, sizeof(offsets[0]), qcow2_compare_offsets);
+
+    qemu_co_mutex_unlock(&s->lock);
+
+    aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+    for (i = 0; i < n && aio_task_pool_status(aio) == 0; i += run) {
+        Qcow2PrefetchTask *task;
+
+        if (qatomic_read(&s->cache_prefetch_cancel)) {
+            break;
+        }
+
+        for (run = 1; run < max_run && i + run < n; run++) {
+            if (offsets[i + run] != offsets[i] + (uint64_t) run * table_size) {
+                break;
+            }
+        }
+
+        task = g_new(Qcow2PrefetchTask, 1);
+        *task = (Qcow2PrefetchTask) {
+            .task.func = qcow2_cache_prefetch_task_entry,
+            .bs = bs,
+            .cache = c,
+            .offset = offsets[i],
+            .n = run,
+        };
+        aio_task_pool_start_task(aio, &task->task);
+    }
+    aio_task_pool_wait_all(aio);
+    ret = aio_task_pool_status(aio);
+    aio_task_pool_free(aio);
+
+    qemu_co_mutex_lock(&s->lock);
+
+    if (ret == 0 && i < n) {
+        ret = -ECANCELED;
+    }
+    return ret;
+}
+
+static void coroutine_fn qcow2_cache_prefetch_entry(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    GRAPH_RDLOCK_GUARD();
+
+    qemu_co_mutex_lock(&s->lock);
+    ret = qcow2_cache_prefetch_tables(bs, s->l2_table_cache, s->l1_table,
+                                      s->l1_size, L1E_OFFSET_MASK,
+                                      s->l2_slice_size * l2_entry_size(s));
+    if (ret == 0 && (s->flags & BDRV_O_RDWR)) {
+        /* Refcount blocks are only needed to allocate clusters */
+        ret = qcow2_cache_prefetch_tables(bs, s->refcount_block_cache,
+                                          s->refcount_table,
+                                          s->refcount_table_size,
+                                          REFT_OFFSET_MASK, s->cluster_size);
+    }
+    qemu_co_mutex_unlock(&s->lock);
+
+    trace_qcow2_cache_prefetch_done(bs, ret);
+
+    /* Read errors are left to the regular code to report */
+    if (ret != -ECANCELED) {
+        s->cache_prefetch_done = true;
+    }
+    s->cache_prefetch_running = false;
+    bdrv_dec_in_flight(bs);
+}
+
+/*
+ * If enabled, fill the L2 table and refcount block caches in the
+ * background, so that the first accesses after open do not have to wait
+ * for a small metadata read each.  L2 tables are loaded in guest offset
+ * order, which favours the start of the disk where boot loaders and
+ * file system metadata usually live.  Only unused cache entries are
+ * filled.  Draining the node interrupts the loading and
+ * qcow2_drain_end() resumes it.
+ */
+static void qcow2_cache_prefetch_start(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Coroutine *co;
+
+    if (!s->cache_prefetch || s->cache_prefetch_done ||
+        s->cache_prefetch_running || bs->quiesce_counter ||
+        (bdrv_get_flags(bs) & BDRV_O_INACTIVE)) {
+        return;
+    }
+
+    s->cache_prefetch_running = true;
+    qatomic_set(&s->cache_prefetch_cancel, false);
+    co = qemu_coroutine_create(qcow2_cache_prefetch_entry, bs);
+    bdrv_inc_in_flight(bs);
+    aio_co_schedule(bdrv_get_aio_context(bs), co);
+}
+
+static void qcow2_drain_begin(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    qatomic_set(&s->cache_prefetch_cancel, true);
+}
+
+static void qcow2_drain_end(BlockDriverState *bs)
+{
+    qcow2_cache_prefetch_start(bs);
+}
+
 static bool read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
                              uint64_t *l2_cache_size,
                              uint64_t *l2_cache_entry_size,
@@ -979,6 +1173,7 @@ typedef struct Qcow2ReopenState {
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
     uint64_t cache_clean_interval;
+    bool cache_prefetch;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -1079,6 +1274,9 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    r->cache_prefetch = qemu_opt_get_bool(opts, QCOW2_OPT_CACHE_PREFETCH,
+                                          false);
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1245,6 +1443,10 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    /* The new caches are empty, qcow2_drain_end() fills them again */
+    s->cache_prefetch = r->cache_prefetch;
+    s->cache_prefetch_done = false;
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1889,6 +2091,8 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 
     qemu_co_queue_init(&s->thread_task_queue);
 
+    qcow2_cache_prefetch_start(bs);
+
     return ret;
 
  fail:
@@ -2762,6 +2966,11 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
     int ret, result = 0;
     Error *local_err = NULL;
 
+    /* Stop loading tables, the caches are destroyed after inactivation */
+    qatomic_set(&s->cache_prefetch_cancel, true);
+    BDRV_POLL_WHILE(bs, s->cache_prefetch_running);
+    s->cache_prefetch_done = true;
+
     qcow2_store_persistent_dirty_bitmaps(bs, true, &local_err);
     if (local_err != NULL) {
         result = -EINVAL;
@@ -6198,6 +6407,8 @@ BlockDriver bdrv_qcow2 = {
 
     .bdrv_detach_aio_context            = qcow2_detach_aio_context,
     .bdrv_attach_aio_context            = qcow2_attach_aio_context,
+    .bdrv_drain_begin                   = qcow2_drain_begin,
+    .bdrv_drain_end                     = qcow2_drain_end,
 
     .bdrv_supports_persistent_dirty_bitmap =
             qcow2_supports_persistent_dirty_bitmap,
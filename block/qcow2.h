@@ -150,6 +150,7 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_CACHE_PREFETCH "cache-prefetch"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -322,7 +323,12 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
-#define QCOW2_MAX_THREADS 4
+/*
+ * Compression and encryption tasks in flight per image: one per host CPU,
+ * but at least QCOW2_MIN_THREADS and at most what the thread pool runs
+ * by default.
+ */
+#define QCOW2_MIN_THREADS 4
 
 typedef struct BDRVQcow2State {
     int cluster_bits;
@@ -348,6 +354,12 @@ typedef struct BDRVQcow2State {
     QEMUTimer *cache_clean_timer;
     unsigned cache_clean_interval;
 
+    /* Background loading of the caches, see qcow2_cache_prefetch_start() */
+    bool cache_prefetch;
+    bool cache_prefetch_running;
+    bool cache_prefetch_cancel;
+    bool cache_prefetch_done;
+
     QLIST_HEAD(, QCowL2Meta) cluster_allocs;
 
     uint64_t *refcount_table;
@@ -1014,10 +1026,19 @@ int GRAPH_RDLOCK
 qcow2_cache_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
                 void **table);
 
+int GRAPH_RDLOCK
+qcow2_cache_get_unlocking(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
+                          void **table);
+
 int GRAPH_RDLOCK
 qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
                       void **table);
 
+int qcow2_cache_unused_entries(Qcow2Cache *c);
+int coroutine_fn GRAPH_RDLOCK
+qcow2_cache_prefetch(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
+                     int n);
+
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
@@ -25,6 +25,15 @@ static GRand *rng;
 static int limit;
 static bool sys;
 
+/*
+ * In user mode the simulated caches are indexed by virtual address,
+ * so instruction fetches and data accesses can be batched in a trace
+ * buffer and replayed in order, rather than making a callback for
+ * each of them.
+ */
+#define BUFFER_RECORDS 4096
+static struct qemu_plugin_mem_buffer *buffer;
+
 enum EvictionPolicy {
     LRU,
     FIFO,
@@ -385,13 +394,29 @@ static bool access_cache(Cache *cache, uint64_t addr)
     return false;
 }
 
+/*
+ * Simulate an access to @cache, which must be locked, charging a
+ * miss to @insn_misses. Return true on a hit.
+ */
+static bool account_access(Cache *cache, uint64_t addr, uint64_t *insn_misses)
+{
+    bool hit = access_cache(cache, addr);
+
+    if (!hit) {
+        __atomic_fetch_add(insn_misses, 1, __ATOMIC_SEQ_CST);
+        cache->misses++;
+    }
+    cache->accesses++;
+    return hit;
+}
+
 static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
                             uint64_t vaddr, void *userdata)
 {
     uint64_t effective_addr;
     struct qemu_plugin_hwaddr *hwaddr;
     int cache_idx;
-    InsnData *insn;
+    InsnData *insn = userdata;
     bool hit_in_l1;
 
     hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
@@ -403,13 +428,8 @@ static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
     cache_idx = vcpu_index % cores;
 
     g_mutex_lock(&l1_dcache_locks[cache_idx]);
-    hit_in_l1 = access_cache(l1_dcaches[cache_idx], effective_addr);
-    if (!hit_in_l1) {
-        insn = userdata;
-        __atomic_fetch_add(&insn->l1_dmisses, 1, __ATOMIC_SEQ_CST);
-        l1_dcaches[cache_idx]->misses++;
-    }
-    l1_dcaches[cache_idx]->accesses++;
+    hit_in_l1 = account_access(l1_dcaches[cache_idx], effective_addr,
+                               &insn->l1_dmisses);
     g_mutex_unlock(&l1_dcache_locks[cache_idx]);
 
     if (hit_in_l1 || !use_l2) {
@@ -418,33 +438,23 @@ static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
     }
 
     g_mutex_lock(&l2_ucache_locks[cache_idx]);
-    if (!access_cache(l2_ucaches[cache_idx], effective_addr)) {
-        insn = userdata;
-        __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
-        l2_ucaches[cache_idx]->misses++;
-    }
-    l2_ucaches[cache_idx]->accesses++;
+    account_access(l2_ucaches[cache_idx], effective_addr, &insn->l2_misses);
     g_mutex_unlock(&l2_ucache_locks[cache_idx]);
 }
 
 static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
 {
     uint64_t insn_addr;
-    InsnData *insn;
+    InsnData *insn = userdata;
     int cache_idx;
     bool hit_in_l1;
 
-    insn_addr = ((InsnData *) userdata)->addr;
+    insn_addr = insn->addr;
 
     cache_idx = vcpu_index % cores;
     g_mutex_lock(&l1_icache_locks[cache_idx]);
-    hit_in_l1 = access_cache(l1_icaches[cache_idx], insn_addr);
-    if (!hit_in_l1) {
-        insn = userdata;
-        __atomic_fetch_add(&insn->l1_imisses, 1, __ATOMIC_SEQ_CST);
-        l1_icaches[cache_idx]->misses++;
-    }
-    l1_icaches[cache_idx]->accesses++;
+    hit_in_l1 = account_access(l1_icaches[cache_idx], insn_addr,
+                               &insn->l1_imisses);
     g_mutex_unlock(&l1_icache_locks[cache_idx]);
 
     if (hit_in_l1 || !use_l2) {
@@ -453,15 +463,55 @@ static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
     }
 
     g_mutex_lock(&l2_ucache_locks[cache_idx]);
-    if (!access_cache(l2_ucaches[cache_idx], insn_addr)) {
-        insn = userdata;
-        __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
-        l2_ucaches[cache_idx]->misses++;
-    }
-    l2_ucaches[cache_idx]->accesses++;
+    account_access(l2_ucaches[cache_idx], insn_addr, &insn->l2_misses);
     g_mutex_unlock(&l2_ucache_locks[cache_idx]);
 }
 
+/* Replay a batch of instruction fetches and data accesses, in order. */
+static void vcpu_buffer(unsigned int vcpu_index,
+                        const struct qemu_plugin_mem_record *records,
+                        size_t n, void *userdata)
+{
+    int cache_idx = vcpu_index % cores;
+    InsnData *insn = NULL;
+    size_t i;
+
+    g_mutex_lock(&l1_icache_locks[cache_idx]);
+    g_mutex_lock(&l1_dcache_locks[cache_idx]);
+    if (use_l2) {
+        g_mutex_lock(&l2_ucache_locks[cache_idx]);
+    }
+
+    for (i = 0; i < n; i++) {
+        const struct qemu_plugin_mem_record *rec = &records[i];
+        bool hit_in_l1;
+
+        if (!insn || insn->addr != rec->pc) {
+            g_mutex_lock(&hashtable_lock);
+            insn = g_hash_table_lookup(miss_ht, GUINT_TO_POINTER(rec->pc));
+            g_mutex_unlock(&hashtable_lock);
+        }
+
+        if (rec->info == 0) {
+            hit_in_l1 = account_access(l1_icaches[cache_idx], rec->vaddr,
+                                       &insn->l1_imisses);
+        } else {
+            hit_in_l1 = account_access(l1_dcaches[cache_idx], rec->vaddr,
+                                       &insn->l1_dmisses);
+        }
+        if (!hit_in_l1 && use_l2) {
+            account_access(l2_ucaches[cache_idx], rec->vaddr,
+                           &insn->l2_misses);
+        }
+    }
+
+    if (use_l2) {
+        g_mutex_unlock(&l2_ucache_locks[cache_idx]);
+    }
+    g_mutex_unlock(&l1_dcache_locks[cache_idx]);
+    g_mutex_unlock(&l1_icache_locks[cache_idx]);
+}
+
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 {
     size_t n_insns;
@@ -496,6 +546,12 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
         }
         g_mutex_unlock(&hashtable_lock);
 
+        if (buffer) {
+            qemu_plugin_register_vcpu_insn_exec_buffer(insn, buffer);
+            qemu_plugin_register_vcpu_mem_buffer(insn, rw, buffer);
+            continue;
+        }
+
         qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
                                          QEMU_PLUGIN_CB_NO_REGS,
                                          rw, data);
@@ -717,6 +773,10 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
     }
 
     g_hash_table_destroy(miss_ht);
+
+    if (buffer) {
+        qemu_plugin_mem_buffer_free(buffer);
+    }
 }
 
 static void policy_init(void)
@@ -850,6 +910,10 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
     l1_icache_locks = g_new0(GMutex, cores);
     l2_ucache_locks = use_l2 ? g_new0(GMutex, cores) : NULL;
 
+    if (!sys) {
+        buffer = qemu_plugin_mem_buffer_new(BUFFER_RECORDS, vcpu_buffer, NULL);
+    }
+
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
 
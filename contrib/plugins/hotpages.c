@@ -48,6 +48,13 @@ typedef struct {
 static GMutex lock;
 static GHashTable *pages;
 
+/*
+ * Without physical addresses to look up, accesses are batched in a
+ * trace buffer instead of making a callback for each of them.
+ */
+#define BUFFER_RECORDS 4096
+static struct qemu_plugin_mem_buffer *buffer;
+
 static gint cmp_access_count(gconstpointer a, gconstpointer b)
 {
     PageCounters *ea = (PageCounters *) a;
@@ -98,6 +105,10 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
     }
 
     qemu_plugin_outs(report->str);
+
+    if (buffer) {
+        qemu_plugin_mem_buffer_free(buffer);
+    }
 }
 
 static void plugin_init(void)
@@ -106,12 +117,33 @@ static void plugin_init(void)
     pages = g_hash_table_new(NULL, g_direct_equal);
 }
 
+/* Called with lock held */
+static void count_access(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
+                         uint64_t page)
+{
+    PageCounters *count;
+
+    count = (PageCounters *) g_hash_table_lookup(pages, GUINT_TO_POINTER(page));
+
+    if (!count) {
+        count = g_new0(PageCounters, 1);
+        count->page_address = page;
+        g_hash_table_insert(pages, GUINT_TO_POINTER(page), (gpointer) count);
+    }
+    if (qemu_plugin_mem_is_store(meminfo)) {
+        count->writes++;
+        count->cpu_write |= (1 << cpu_index);
+    } else {
+        count->reads++;
+        count->cpu_read |= (1 << cpu_index);
+    }
+}
+
 static void vcpu_haddr(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
                        uint64_t vaddr, void *udata)
 {
     struct qemu_plugin_hwaddr *hwaddr = qemu_plugin_get_hwaddr(meminfo, vaddr);
     uint64_t page;
-    PageCounters *count;
 
     /* We only get a hwaddr for system emulation */
     if (track_io) {
@@ -130,21 +162,21 @@ static void vcpu_haddr(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
     page &= ~page_mask;
 
     g_mutex_lock(&lock);
-    count = (PageCounters *) g_hash_table_lookup(pages, GUINT_TO_POINTER(page));
+    count_access(cpu_index, meminfo, page);
+    g_mutex_unlock(&lock);
+}
 
-    if (!count) {
-        count = g_new0(PageCounters, 1);
-        count->page_address = page;
-        g_hash_table_insert(pages, GUINT_TO_POINTER(page), (gpointer) count);
-    }
-    if (qemu_plugin_mem_is_store(meminfo)) {
-        count->writes++;
-        count->cpu_write |= (1 << cpu_index);
-    } else {
-        count->reads++;
-        count->cpu_read |= (1 << cpu_index);
-    }
+static void vcpu_buffer(unsigned int cpu_index,
+                        const struct qemu_plugin_mem_record *records,
+                        size_t n, void *udata)
+{
+    size_t i;
 
+    g_mutex_lock(&lock);
+    for (i = 0; i < n; i++) {
+        count_access(cpu_index, records[i].info,
+                     records[i].vaddr & ~page_mask);
+    }
     g_mutex_unlock(&lock);
 }
 
@@ -155,9 +187,13 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 
     for (i = 0; i < n; i++) {
         struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
-        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_haddr,
-                                         QEMU_PLUGIN_CB_NO_REGS,
-                                         rw, NULL);
+        if (buffer) {
+            qemu_plugin_register_vcpu_mem_buffer(insn, rw, buffer);
+        } else {
+            qemu_plugin_register_vcpu_mem_cb(insn, vcpu_haddr,
+                                             QEMU_PLUGIN_CB_NO_REGS,
+                                             rw, NULL);
+        }
     }
 }
 
@@ -197,6 +233,10 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
 
     plugin_init();
 
+    if (!info->system_emulation && !track_io) {
+        buffer = qemu_plugin_mem_buffer_new(BUFFER_RECORDS, vcpu_buffer, NULL);
+    }
+
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
     return 0;
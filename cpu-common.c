@@ -23,6 +23,7 @@
 #include "hw/core/cpu.h"
 #include "sysemu/cpus.h"
 #include "qemu/lockable.h"
+#include "qemu/bitmap.h"
 #include "trace/trace-root.h"
 
 QemuMutex qemu_cpu_list_lock;
@@ -58,17 +59,29 @@ void cpu_list_unlock(void)
 }
 
 
+/*
+ * Return the lowest index not used by any cpu.  Indexes of cpus that
+ * went away are reused, so that guests which keep creating and
+ * exiting threads do not grow the per-cpu state indexed by them.
+ */
 int cpu_get_free_index(void)
 {
+    g_autofree unsigned long *used = NULL;
     CPUState *some_cpu;
-    int max_cpu_index = 0;
+    int nr_cpus = 0;
+
+    CPU_FOREACH(some_cpu) {
+        nr_cpus++;
+    }
 
+    /* With nr_cpus cpus, one of the first nr_cpus + 1 indexes is free. */
+    used = bitmap_new(nr_cpus + 1);
     CPU_FOREACH(some_cpu) {
-        if (some_cpu->cpu_index >= max_cpu_index) {
-            max_cpu_index = some_cpu->cpu_index + 1;
+        if (some_cpu->cpu_index <= nr_cpus) {
+            set_bit(some_cpu->cpu_index, used);
         }
     }
-    return max_cpu_index;
+    return find_first_zero_bit(used, nr_cpus + 1);
 }
 
 CPUTailQ cpus_queue = QTAILQ_HEAD_INITIALIZER(cpus_queue);
@@ -2581,6 +2581,276 @@ floatx80 floatx80_div(floatx80 a, floatx80 b, float_status *status)
     return floatx80_round_pack_canonical(pr, status);
 }
 
+/*
+ * Packed operations
+ *
+ * Apply the same operation to @n lanes, as guest SIMD helpers do. The
+ * hardfloat conditions are checked on the bit patterns so that the
+ * whole loop, host operation included, can be vectorized by the compiler.
+ * Lanes that need softfloat (an input that is not zero or normal, or a
+ * result that is tiny or infinite) are then redone in software, which
+ * also raises the flags; the other lanes raise none, since hardfloat is
+ * only used when inexact is already set.
+ *
+ * @d may be the same array as @a or @b, but must not partially overlap
+ * them.
+ */
+
+#define FLOAT32_PACKED_BLOCK 4
+#define FLOAT64_PACKED_BLOCK 2
+
+/*
+ * QEMU_HARDFLOAT_{F32,F64}_PACKED choose whether the packed fast path is
+ * used. It only pays off if the compiler vectorizes it; for the f64
+ * checks that needs 64-bit vector compares, which x86 only has from
+ * SSE4.2 (x86_version=2). Elsewhere the scalar hardfloat path is faster.
+ */
+#if defined(__aarch64__) || defined(__x86_64__)
+# define QEMU_HARDFLOAT_F32_PACKED 1
+#else
+# define QEMU_HARDFLOAT_F32_PACKED 0
+#endif
+#if defined(__aarch64__) || (defined(__x86_64__) && defined(__SSE4_2__))
+# define QEMU_HARDFLOAT_F64_PACKED 1
+#else
+# define QEMU_HARDFLOAT_F64_PACKED 0
+#endif
+
+typedef bool (*f32_packed_check_fn)(uint32_t a, uint32_t b);
+typedef bool (*f64_packed_check_fn)(uint64_t a, uint64_t b);
+
+/*
+ * The checks work on the bit patterns and avoid && and ||, which
+ * would turn into branches and prevent vectorization.
+ */
+static inline bool f32_packed_is_normal(uint32_t a)
+{
+    return (a & 0x7fffffff) - 0x00800000 < 0x7f000000;
+}
+
+static inline bool f64_packed_is_normal(uint64_t a)
+{
+    return (a & INT64_MAX) - 0x0010000000000000ull < 0x7fe0000000000000ull;
+}
+
+static inline bool f32_packed_is_zon2(uint32_t a, uint32_t b)
+{
+    return (f32_packed_is_normal(a) | ((a << 1) == 0)) &
+           (f32_packed_is_normal(b) | ((b << 1) == 0));
+}
+
+static inline bool f64_packed_is_zon2(uint64_t a, uint64_t b)
+{
+    return (f64_packed_is_normal(a) | ((a << 1) == 0)) &
+           (f64_packed_is_normal(b) | ((b << 1) == 0));
+}
+
+static inline bool f32_packed_addsubmul_post(uint32_t a, uint32_t b)
+{
+    return ((a | b) << 1) != 0;
+}
+
+static inline bool f64_packed_addsubmul_post(uint64_t a, uint64_t b)
+{
+    return ((a | b) << 1) != 0;
+}
+
+static inline bool f32_packed_div_pre(uint32_t a, uint32_t b)
+{
+    return (f32_packed_is_normal(a) | ((a << 1) == 0)) &
+           f32_packed_is_normal(b);
+}
+
+static inline bool f64_packed_div_pre(uint64_t a, uint64_t b)
+{
+    return (f64_packed_is_normal(a) | ((a << 1) == 0)) &
+           f64_packed_is_normal(b);
+}
+
+static inline bool f32_packed_div_post(uint32_t a, uint32_t b)
+{
+    return (a << 1) != 0;
+}
+
+static inline bool f64_packed_div_post(uint64_t a, uint64_t b)
+{
+    return (a << 1) != 0;
+}
+
+static inline void
+float32_gen2_packed(float32 *d, const float32 *a, const float32 *b,
+                    size_t n, float_status *s,
+                    hard_f32_op2_fn hard, soft_f32_op2_fn soft,
+                    soft_f32_op2_fn scalar,
+                    f32_packed_check_fn pre, f32_packed_check_fn post)
+{
+    size_t i, j;
+
+    if (!QEMU_HARDFLOAT_F32_PACKED ||
+        unlikely(!can_use_fpu(s) || s->flush_inputs_to_zero)) {
+        for (i = 0; i < n; i++) {
+            d[i] = scalar(a[i], b[i], s);
+        }
+        return;
+    }
+
+    for (i = 0; i + FLOAT32_PACKED_BLOCK <= n; i += FLOAT32_PACKED_BLOCK) {
+        union_float32 r[FLOAT32_PACKED_BLOCK];
+        uint32_t lane_slow[FLOAT32_PACKED_BLOCK];
+        uint32_t slow = 0;
+
+        for (j = 0; j < FLOAT32_PACKED_BLOCK; j++) {
+            union_float32 ua = { .s = a[i + j] };
+            union_float32 ub = { .s = b[i + j] };
+            uint32_t xa = float32_val(ua.s);
+            uint32_t xb = float32_val(ub.s);
+            uint32_t xr;
+
+            r[j].h = hard(ua.h, ub.h);
+            xr = float32_val(r[j].s) & 0x7fffffff;
+            lane_slow[j] = !pre(xa, xb) | (xr >= 0x7f800000) |
+                           ((xr <= 0x00800000) & post(xa, xb));
+            slow |= lane_slow[j];
+        }
+        if (unlikely(slow)) {
+            for (j = 0; j < FLOAT32_PACKED_BLOCK; j++) {
+                if (lane_slow[j]) {
+                    r[j].s = soft(a[i + j], b[i + j], s);
+                }
+            }
+        }
+        for (j = 0; j < FLOAT32_PACKED_BLOCK; j++) {
+            d[i + j] = r[j].s;
+        }
+    }
+    for (; i < n; i++) {
+        d[i] = scalar(a[i], b[i], s);
+    }
+}
+
+static inline void
+float64_gen2_packed(float64 *d, const float64 *a, const float64 *b,
+                    size_t n, float_status *s,
+                    hard_f64_op2_fn hard, soft_f64_op2_fn soft,
+                    soft_f64_op2_fn scalar,
+                    f64_packed_check_fn pre, f64_packed_check_fn post)
+{
+    size_t i, j;
+
+    if (!QEMU_HARDFLOAT_F64_PACKED ||
+        unlikely(!can_use_fpu(s) || s->flush_inputs_to_zero)) {
+        for (i = 0; i < n; i++) {
+            d[i] = scalar(a[i], b[i], s);
+        }
+        return;
+    }
+
+    for (i = 0; i + FLOAT64_PACKED_BLOCK <= n; i += FLOAT64_PACKED_BLOCK) {
+        union_float64 r[FLOAT64_PACKED_BLOCK];
+        uint64_t lane_slow[FLOAT64_PACKED_BLOCK];
+        uint64_t slow = 0;
+
+        for (j = 0; j < FLOAT64_PACKED_BLOCK; j++) {
+            union_float64 ua = { .s = a[i + j] };
+            union_float64 ub = { .s = b[i + j] };
+            uint64_t xa = float64_val(ua.s);
+            uint64_t xb = float64_val(ub.s);
+            uint64_t xr;
+
+            r[j].h = hard(ua.h, ub.h);
+            xr = float64_val(r[j].s) & INT64_MAX;
+            lane_slow[j] = !pre(xa, xb) | (xr >= 0x7ff0000000000000ull) |
+                           ((xr <= 0x0010000000000000ull) & post(xa, xb));
+            slow |= lane_slow[j];
+        }
+        if (unlikely(slow)) {
+            for (j = 0; j < FLOAT64_PACKED_BLOCK; j++) {
+                if (lane_slow[j]) {
+                    r[j].s = soft(a[i + j], b[i + j], s);
+                }
+            }
+        }
+        for (j = 0; j < FLOAT64_PACKED_BLOCK; j++) {
+            d[i + j] = r[j].s;
+        }
+    }
+    for (; i < n; i++) {
+        d[i] = scalar(a[i], b[i], s);
+    }
+}
+
+void QEMU_FLATTEN
+float32_add_packed(float32 *d, const float32 *a, const float32 *b,
+                   size_t n, float_status *s)
+{
+    float32_gen2_packed(d, a, b, n, s, hard_f32_add, soft_f32_add,
+                        float32_add,
+                        f32_packed_is_zon2, f32_packed_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float32_sub_packed(float32 *d, const float32 *a, const float32 *b,
+                   size_t n, float_status *s)
+{
+    float32_gen2_packed(d, a, b, n, s, hard_f32_sub, soft_f32_sub,
+                        float32_sub,
+                        f32_packed_is_zon2, f32_packed_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float32_mul_packed(float32 *d, const float32 *a, const float32 *b,
+                   size_t n, float_status *s)
+{
+    float32_gen2_packed(d, a, b, n, s, hard_f32_mul, soft_f32_mul,
+                        float32_mul,
+                        f32_packed_is_zon2, f32_packed_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float32_div_packed(float32 *d, const float32 *a, const float32 *b,
+                   size_t n, float_status *s)
+{
+    float32_gen2_packed(d, a, b, n, s, hard_f32_div, soft_f32_div,
+                        float32_div,
+                        f32_packed_div_pre, f32_packed_div_post);
+}
+
+void QEMU_FLATTEN
+float64_add_packed(float64 *d, const float64 *a, const float64 *b,
+                   size_t n, float_status *s)
+{
+    float64_gen2_packed(d, a, b, n, s, hard_f64_add, soft_f64_add,
+                        float64_add,
+                        f64_packed_is_zon2, f64_packed_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_sub_packed(float64 *d, const float64 *a, const float64 *b,
+                   size_t n, float_status *s)
+{
+    float64_gen2_packed(d, a, b, n, s, hard_f64_sub, soft_f64_sub,
+                        float64_sub,
+                        f64_packed_is_zon2, f64_packed_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_mul_packed(float64 *d, const float64 *a, const float64 *b,
+                   size_t n, float_status *s)
+{
+    float64_gen2_packed(d, a, b, n, s, hard_f64_mul, soft_f64_mul,
+                        float64_mul,
+                        f64_packed_is_zon2, f64_packed_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_div_packed(float64 *d, const float64 *a, const float64 *b,
+                   size_t n, float_status *s)
+{
+    float64_gen2_packed(d, a, b, n, s, hard_f64_div, soft_f64_div,
+                        float64_div,
+                        f64_packed_div_pre, f64_packed_div_post);
+}
+
 /*
  * Remainder
  */
@@ -499,6 +499,8 @@ NBDClientConnection *nbd_client_connection_new(const SocketAddress *saddr,
                                                QCryptoTLSCreds *tlscreds,
                                                const char *tlshostname);
 void nbd_client_connection_release(NBDClientConnection *conn);
+bool nbd_client_connection_ready(NBDClientConnection *conn);
+void nbd_client_connection_start(NBDClientConnection *conn);
 
 QIOChannel *coroutine_fn
 nbd_co_establish_connection(NBDClientConnection *conn, NBDExportInfo *info,
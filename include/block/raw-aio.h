@@ -72,6 +72,20 @@ void luring_cleanup(LuringState *s);
 /* luring_co_submit: submit I/O requests in the thread's current AioContext. */
 int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
                                   QEMUIOVector *qiov, int type);
+/*
+ * luring_co_fallocate: submit fallocate(2) in the thread's current
+ * AioContext.  Only call this if luring_has_fallocate() returns true.
+ */
+int coroutine_fn luring_co_fallocate(BlockDriverState *bs, int fd, int mode,
+                                     uint64_t offset, uint64_t len);
+bool luring_has_fallocate(void);
+/*
+ * luring_register_buf: make the memory at @host available as a fixed
+ * buffer to all rings.  Calls nest and must be balanced by
+ * luring_unregister_buf() with the same arguments.
+ */
+void luring_register_buf(void *host, size_t size);
+void luring_unregister_buf(void *host, size_t size);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 #endif
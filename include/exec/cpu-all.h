@@ -165,6 +165,14 @@ typedef int (*walk_memory_regions_fn)(void *, target_ulong,
                                       target_ulong, unsigned long);
 int walk_memory_regions(void *, walk_memory_regions_fn);
 
+/**
+ * page_flags_generation:
+ *
+ * Return a counter that changes whenever the page flags of any guest
+ * page may have changed.  The mmap_lock must be held.
+ */
+uint64_t page_flags_generation(void);
+
 int page_get_flags(target_ulong address);
 void page_set_flags(target_ulong start, target_ulong last, int flags);
 void page_reset_target_data(target_ulong start, target_ulong last);
@@ -37,5 +37,10 @@
  * in both guest and host.
  */
 #define PAGE_PASSTHROUGH 0x0800
+/*
+ * For linux-user, the page has taken repeated self-modifying code faults
+ * and is left writable; TBs on it verify their guest code on entry.
+ */
+#define PAGE_SMC_CHECK 0x1000
 
 #endif
@@ -26,6 +26,12 @@
 void tb_check_watchpoint(CPUState *cpu, uintptr_t retaddr);
 
 #ifdef CONFIG_USER_ONLY
+/*
+ * If true, pages that keep taking write faults because they mix code
+ * and data are switched from write protection to self-checking TBs.
+ */
+extern bool smc_selfcheck;
+
 void page_protect(tb_page_addr_t page_addr);
 int page_unprotect(target_ulong address, uintptr_t pc);
 #endif
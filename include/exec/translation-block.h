@@ -101,6 +101,11 @@ struct TranslationBlock {
      */
 #ifdef CONFIG_USER_ONLY
     IntervalTreeNode itree;
+    /*
+     * Non-zero if the TB checks a hash of its guest code on entry,
+     * instead of relying on write protection of its first page.
+     */
+    uint64_t smc_hash;
 #else
     uintptr_t page_next[2];
     tb_page_addr_t page_addr[2];
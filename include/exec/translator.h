@@ -174,6 +174,20 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
  */
 bool translator_use_goto_tb(DisasContextBase *db, vaddr dest);
 
+/**
+ * translator_lookup_and_goto_ptr
+ * @db: Disassembly context
+ * @dest: guest virtual address of the destination, as it would be
+ *        returned by cpu_get_tb_cpu_state()
+ *
+ * Like tcg_gen_lookup_and_goto_ptr(), but the caller guarantees that
+ * the branch does not change cs_base or flags of the TB state.  This
+ * allows the per-CPU jump cache to be probed inline in user mode, so
+ * that the helper is only called on a miss.
+ */
+void translator_lookup_and_goto_ptr(DisasContextBase *db,
+                                    struct TCGv_i64_d *dest);
+
 /**
  * translator_io_start
  * @db: Disassembly context
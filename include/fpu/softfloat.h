@@ -595,6 +595,15 @@ float32 float32_add(float32, float32, float_status *status);
 float32 float32_sub(float32, float32, float_status *status);
 float32 float32_mul(float32, float32, float_status *status);
 float32 float32_div(float32, float32, float_status *status);
+/* d[i] = a[i] op b[i] for n lanes; d may be the same array as a or b. */
+void float32_add_packed(float32 *, const float32 *, const float32 *,
+                        size_t, float_status *status);
+void float32_sub_packed(float32 *, const float32 *, const float32 *,
+                        size_t, float_status *status);
+void float32_mul_packed(float32 *, const float32 *, const float32 *,
+                        size_t, float_status *status);
+void float32_div_packed(float32 *, const float32 *, const float32 *,
+                        size_t, float_status *status);
 float32 float32_rem(float32, float32, float_status *status);
 float32 float32_muladd(float32, float32, float32, int, float_status *status);
 float32 float32_sqrt(float32, float_status *status);
@@ -790,6 +799,14 @@ float64 float64_add(float64, float64, float_status *status);
 float64 float64_sub(float64, float64, float_status *status);
 float64 float64_mul(float64, float64, float_status *status);
 float64 float64_div(float64, float64, float_status *status);
+void float64_add_packed(float64 *, const float64 *, const float64 *,
+                        size_t, float_status *status);
+void float64_sub_packed(float64 *, const float64 *, const float64 *,
+                        size_t, float_status *status);
+void float64_mul_packed(float64 *, const float64 *, const float64 *,
+                        size_t, float_status *status);
+void float64_div_packed(float64 *, const float64 *, const float64 *,
+                        size_t, float_status *status);
 float64 float64_rem(float64, float64, float_status *status);
 float64 float64_muladd(float64, float64, float64, int, float_status *status);
 float64 float64_sqrt(float64, float_status *status);
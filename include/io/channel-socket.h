@@ -49,6 +49,9 @@ struct QIOChannelSocket {
     socklen_t remoteAddrLen;
     ssize_t zero_copy_queued;
     ssize_t zero_copy_sent;
+    /* zero_copy_sent at the last flush, and whether any since avoided a copy */
+    ssize_t zero_copy_flushed;
+    bool zero_copy_used;
 };
 
 
@@ -262,4 +265,26 @@ qio_channel_socket_accept(QIOChannelSocket *ioc,
                           Error **errp);
 
 
+/**
+ * qio_channel_socket_zero_copy_poll:
+ * @ioc: the socket channel object
+ * @copied: set if every write was copied anyway
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Collect the completion notifications of writes queued with
+ * QIO_CHANNEL_WRITE_FLAG_ZERO_COPY that are available, without waiting
+ * for more.  They are also collected whenever a read would block, since
+ * pending notifications make the socket readable.
+ *
+ * Once all of them have completed, this function sets @copied like
+ * qio_channel_flush() reports it, for the writes that completed since
+ * the last flush or poll that returned 1.
+ *
+ * Returns: 1 if all writes have completed, 0 if some are still in
+ * flight, or -1 on error
+ */
+int qio_channel_socket_zero_copy_poll(QIOChannelSocket *ioc, bool *copied,
+                                      Error **errp);
+
+
 #endif /* QIO_CHANNEL_SOCKET_H */
@@ -96,4 +96,52 @@ IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
 IntervalTreeNode *interval_tree_iter_next(IntervalTreeNode *node,
                                           uint64_t start, uint64_t last);
 
+/*
+ * Gap trees are interval trees whose intervals never overlap, which are
+ * further augmented with the size of the largest hole between two
+ * intervals of each subtree.  This allows finding free space in O(log n).
+ * A gap tree may be searched with interval_tree_iter_{first,next}, but
+ * must only be modified with interval_gap_{insert,remove}.
+ */
+typedef struct IntervalGapNode {
+    IntervalTreeNode itree;
+
+    uint64_t subtree_first;  /* Lowest start in subtree */
+    uint64_t subtree_gap;    /* Largest hole between intervals in subtree */
+} IntervalGapNode;
+
+/**
+ * interval_gap_insert
+ * @node: node to insert,
+ * @root: root of the tree.
+ *
+ * Insert @node into @root, and rebalance.  The interval of @node
+ * must not overlap any interval already in the tree.
+ */
+void interval_gap_insert(IntervalGapNode *node, IntervalTreeRoot *root);
+
+/**
+ * interval_gap_remove
+ * @node: node to remove,
+ * @root: root of the tree.
+ *
+ * Remove @node from @root, and rebalance.
+ */
+void interval_gap_remove(IntervalGapNode *node, IntervalTreeRoot *root);
+
+/**
+ * interval_gap_find_first:
+ * @root: root of the tree,
+ * @min, @max: the inclusive range to search,
+ * @len: the length of the hole,
+ * @align: the alignment of the hole, a power of 2.
+ *
+ * Locate the lowest address in [@min, @max] aligned to @align such that
+ * [address, address + @len - 1] is within [@min, @max] and does not
+ * overlap any interval in the tree.  Returns -1 if there is none.
+ */
+uint64_t interval_gap_find_first(IntervalTreeRoot *root,
+                                 uint64_t min, uint64_t max,
+                                 uint64_t len, uint64_t align);
+
 #endif /* QEMU_INTERVAL_TREE_H */
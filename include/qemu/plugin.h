@@ -72,6 +72,7 @@ enum plugin_dyn_cb_type {
     PLUGIN_CB_MEM_REGULAR,
     PLUGIN_CB_INLINE_ADD_U64,
     PLUGIN_CB_INLINE_STORE_U64,
+    PLUGIN_CB_MEM_BUFFER,
 };
 
 struct qemu_plugin_regular_cb {
@@ -96,6 +97,12 @@ struct qemu_plugin_conditional_cb {
     uint64_t imm;
 };
 
+struct qemu_plugin_buffer_cb {
+    struct qemu_plugin_mem_buffer *buf;
+    uint64_t pc;
+    enum qemu_plugin_mem_rw rw;
+};
+
 /*
  * A dynamic callback has an insertion point that is determined at run-time.
  * Usually the insertion point is somewhere in the code cache; think for
@@ -107,6 +114,7 @@ struct qemu_plugin_dyn_cb {
         struct qemu_plugin_regular_cb regular;
         struct qemu_plugin_conditional_cb cond;
         struct qemu_plugin_inline_cb inline_insn;
+        struct qemu_plugin_buffer_cb buffer;
     };
 };
 
@@ -122,12 +130,56 @@ struct qemu_plugin_insn {
     bool mem_helper;
 };
 
-/* A scoreboard is an array of values, indexed by vcpu_index */
+/*
+ * A scoreboard is an array of values, indexed by vcpu_index. It is
+ * allocated in chunks of PLUGIN_SCOREBOARD_CHUNK entries, so that
+ * entries never move: a new vCPU only needs a new chunk, not a copy
+ * of the whole array and a flush of the code that addresses it.
+ * Only growing the table of chunks itself, which doubles in size
+ * each time, needs that.
+ */
+#define PLUGIN_SCOREBOARD_CHUNK_BITS 4
+#define PLUGIN_SCOREBOARD_CHUNK (1 << PLUGIN_SCOREBOARD_CHUNK_BITS)
+
 struct qemu_plugin_scoreboard {
-    GArray *data;
+    char **chunks;
+    size_t element_size;
     QLIST_ENTRY(qemu_plugin_scoreboard) entry;
 };
 
+static inline void *
+plugin_scoreboard_entry(struct qemu_plugin_scoreboard *score,
+                        unsigned int vcpu_index)
+{
+    char *chunk = score->chunks[vcpu_index >> PLUGIN_SCOREBOARD_CHUNK_BITS];
+
+    return chunk + (vcpu_index & (PLUGIN_SCOREBOARD_CHUNK - 1)) *
+                   score->element_size;
+}
+
+/* Per-vCPU entry of the scoreboard backing a memory trace buffer */
+struct qemu_plugin_mem_buffer_entry {
+    uint64_t count;
+    struct qemu_plugin_mem_record records[];
+};
+
+/*
+ * A memory trace buffer. Translated code appends to the entry of the
+ * current vCPU and bumps @count; a conditional callback at the start
+ * of each traced instruction hands the records to the plugin once
+ * @n_records of them are buffered. The entries have room for
+ * @capacity records, leaving slack for the accesses of the
+ * instruction that crosses the threshold.
+ */
+struct qemu_plugin_mem_buffer {
+    struct qemu_plugin_scoreboard *score;
+    size_t n_records;
+    size_t capacity;
+    qemu_plugin_vcpu_mem_buffer_cb_t cb;
+    void *userdata;
+    QLIST_ENTRY(qemu_plugin_mem_buffer) entry;
+};
+
 /* Internal context for this TranslationBlock */
 struct qemu_plugin_tb {
     GPtrArray *insns;
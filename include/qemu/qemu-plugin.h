@@ -661,6 +661,99 @@ void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
     qemu_plugin_u64 entry,
     uint64_t imm);
 
+/**
+ * struct qemu_plugin_mem_buffer - Opaque handle for a memory trace buffer
+ */
+struct qemu_plugin_mem_buffer;
+
+/**
+ * struct qemu_plugin_mem_record - one entry of a memory trace buffer
+ * @vaddr: the virtual address of the access
+ * @pc: the virtual address of the instruction making the access
+ * @info: an opaque handle for further queries about the access, or 0
+ *        for the execution of the instruction at @pc itself
+ *
+ * @info can be queried with qemu_plugin_mem_size_shift() and friends,
+ * but not with qemu_plugin_get_hwaddr(): by the time the buffer is
+ * handed to the plugin, the translation used for the access is gone.
+ */
+struct qemu_plugin_mem_record {
+    uint64_t vaddr;
+    uint64_t pc;
+    qemu_plugin_meminfo_t info;
+};
+
+/**
+ * typedef qemu_plugin_vcpu_mem_buffer_cb_t - trace buffer callback type
+ * @vcpu_index: the vCPU that filled the buffer
+ * @records: the records, oldest first
+ * @n: number of records
+ * @userdata: any user data attached to the buffer
+ */
+typedef void (*qemu_plugin_vcpu_mem_buffer_cb_t)(
+    unsigned int vcpu_index,
+    const struct qemu_plugin_mem_record *records,
+    size_t n,
+    void *userdata);
+
+/**
+ * qemu_plugin_mem_buffer_new() - alloc a new memory trace buffer
+ * @n_records: number of records buffered per vCPU
+ * @cb: callback of type qemu_plugin_vcpu_mem_buffer_cb_t
+ * @userdata: opaque pointer for userdata
+ *
+ * Returns a per-vCPU buffer that translated code appends records to
+ * without leaving the code cache. @cb is called on the vCPU thread
+ * once about @n_records records have been buffered, on system calls,
+ * when the vCPU goes idle or exits, and for all vCPUs before the
+ * atexit callbacks. The buffer must be freed using
+ * qemu_plugin_mem_buffer_free.
+ *
+ * This is much cheaper than qemu_plugin_register_vcpu_mem_cb() for
+ * plugins that only need the addresses of the accesses.
+ */
+QEMU_PLUGIN_API
+struct qemu_plugin_mem_buffer *
+qemu_plugin_mem_buffer_new(size_t n_records,
+                           qemu_plugin_vcpu_mem_buffer_cb_t cb,
+                           void *userdata);
+
+/**
+ * qemu_plugin_mem_buffer_free() - free a memory trace buffer
+ * @buf: buffer to free
+ *
+ * Records still in the buffer are discarded.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buf);
+
+/**
+ * qemu_plugin_register_vcpu_mem_buffer() - trace memory accesses to a buffer
+ * @insn: handle for instruction to instrument
+ * @rw: trace reads, writes or both
+ * @buf: buffer to append the records to
+ *
+ * Append a record to @buf for every memory access generated by the
+ * instruction.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_mem_buffer(struct qemu_plugin_insn *insn,
+                                          enum qemu_plugin_mem_rw rw,
+                                          struct qemu_plugin_mem_buffer *buf);
+
+/**
+ * qemu_plugin_register_vcpu_insn_exec_buffer() - trace insn execution
+ * @insn: handle for instruction to instrument
+ * @buf: buffer to append the records to
+ *
+ * Append a record with an @info of 0 to @buf every time the instruction
+ * is executed, before the records of its memory accesses.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_insn_exec_buffer(
+    struct qemu_plugin_insn *insn,
+    struct qemu_plugin_mem_buffer *buf);
+
 /**
  * qemu_plugin_request_time_control() - request the ability to control time
  *
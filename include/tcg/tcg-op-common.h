@@ -74,6 +74,16 @@ void tcg_gen_goto_tb(unsigned idx);
  */
 void tcg_gen_lookup_and_goto_ptr(void);
 
+/**
+ * tcg_gen_goto_ptr() - jump to translated code
+ * @ptr: host address of the code, either tb->tc.ptr of a valid TB or
+ *       tcg_code_gen_epilogue
+ *
+ * This is the low-level half of tcg_gen_lookup_and_goto_ptr(); the
+ * caller is responsible for calling plugin_gen_disable_mem_helpers().
+ */
+void tcg_gen_goto_ptr(TCGv_ptr ptr);
+
 void tcg_gen_plugin_cb(unsigned from);
 void tcg_gen_plugin_mem_cb(TCGv_i64 addr, unsigned meminfo);
 
@@ -52,11 +52,18 @@ typedef enum argtype {
 #define THUNK_TARGET 0
 #define THUNK_HOST   1
 
+typedef struct ThunkOp ThunkOp;
+
 typedef struct {
     /* standard struct handling */
     const argtype *field_types;
     int nb_fields;
     int *field_offsets[2];
+    /* field_types flattened into straight-line copies, NULL if unsupported */
+    ThunkOp *ops[2];
+    int nb_ops[2];
+    /* host and target layouts are the same */
+    bool identity;
     /* special handling */
     void (*convert[2])(void *dst, const void *src);
     void (*print)(void *arg);
@@ -79,6 +86,7 @@ void thunk_register_struct_direct(int id, const char *name,
 const argtype *thunk_convert(void *dst, const void *src,
                              const argtype *type_ptr, int to_host);
 const argtype *thunk_print(void *arg, const argtype *type_ptr);
+bool thunk_type_is_identity(const argtype *type_ptr);
 
 extern StructEntry *struct_entries;
 
@@ -65,6 +65,8 @@ qio_channel_socket_new(void)
     sioc->fd = -1;
     sioc->zero_copy_queued = 0;
     sioc->zero_copy_sent = 0;
+    sioc->zero_copy_flushed = 0;
+    sioc->zero_copy_used = false;
 
     ioc = QIO_CHANNEL(sioc);
     qio_channel_set_feature(ioc, QIO_CHANNEL_FEATURE_SHUTDOWN);
@@ -145,6 +147,19 @@ qio_channel_socket_new_fd(int fd,
 }
 
 
+static void qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    int ret, v = 1;
+    ret = setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
+    if (ret == 0) {
+        /* Zero copy available on host */
+        qio_channel_set_feature(QIO_CHANNEL(ioc),
+                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+    }
+#endif
+}
+
 int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
                                     SocketAddress *addr,
                                     Error **errp)
@@ -164,15 +179,7 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
-#ifdef QEMU_MSG_ZEROCOPY
-    int ret, v = 1;
-    ret = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
-    if (ret == 0) {
-        /* Zero copy available on host */
-        qio_channel_set_feature(QIO_CHANNEL(ioc),
-                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
-    }
-#endif
+    qio_channel_socket_enable_zero_copy(ioc);
 
     qio_channel_set_feature(QIO_CHANNEL(ioc),
                             QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
@@ -410,6 +417,8 @@ qio_channel_socket_accept(QIOChannelSocket *ioc,
     }
 #endif /* WIN32 */
 
+    qio_channel_socket_enable_zero_copy(cioc);
+
     qio_channel_set_feature(QIO_CHANNEL(cioc),
                             QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
 
@@ -498,6 +507,95 @@ static void qio_channel_socket_copy_fds(struct msghdr *msg,
 }
 
 
+#ifdef QEMU_MSG_ZEROCOPY
+/*
+ * Collect zero-copy completion notifications until every queued write has
+ * completed or, unless @wait, until no more notifications are available.
+ */
+static int qio_channel_socket_reap_zero_copy(QIOChannelSocket *sioc,
+                                             bool wait, Error **errp)
+{
+    struct msghdr msg = {};
+    struct sock_extended_err *serr;
+    struct cmsghdr *cm;
+    char control[CMSG_SPACE(sizeof(*serr))];
+    int received;
+
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    memset(control, 0, sizeof(control));
+
+    while (sioc->zero_copy_sent < sioc->zero_copy_queued) {
+        received = recvmsg(sioc->fd, &msg, MSG_ERRQUEUE);
+        if (received < 0) {
+            switch (errno) {
+            case EAGAIN:
+                if (!wait) {
+                    return 0;
+                }
+                /* Nothing on errqueue, wait until something is available */
+                qio_channel_wait(QIO_CHANNEL(sioc), G_IO_ERR);
+                continue;
+            case EINTR:
+                continue;
+            default:
+                error_setg_errno(errp, errno,
+                                 "Unable to read errqueue");
+                return -1;
+            }
+        }
+
+        cm = CMSG_FIRSTHDR(&msg);
+        if (cm->cmsg_level != SOL_IP   && cm->cmsg_type != IP_RECVERR &&
+            cm->cmsg_level != SOL_IPV6 && cm->cmsg_type != IPV6_RECVERR) {
+            error_setg_errno(errp, EPROTOTYPE,
+                             "Wrong cmsg in errqueue");
+            return -1;
+        }
+
+        serr = (void *) CMSG_DATA(cm);
+        if (serr->ee_errno != SO_EE_ORIGIN_NONE) {
+            error_setg_errno(errp, serr->ee_errno,
+                             "Error on socket");
+            return -1;
+        }
+        if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+            error_setg_errno(errp, serr->ee_origin,
+                             "Error not from zero copy");
+            return -1;
+        }
+        if (serr->ee_data < serr->ee_info) {
+            error_setg_errno(errp, serr->ee_origin,
+                             "Wrong notification bounds");
+            return -1;
+        }
+
+        /* No errors, count successfully finished sendmsg()*/
+        sioc->zero_copy_sent += serr->ee_data - serr->ee_info + 1;
+
+        if (serr->ee_code != SO_EE_CODE_ZEROCOPY_COPIED) {
+            sioc->zero_copy_used = true;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Return 1 if every sendmsg() completed since the last call failed to use
+ * zero copy, 0 if any succeeded or none completed.
+ */
+static int qio_channel_socket_zero_copy_done(QIOChannelSocket *sioc)
+{
+    int ret = sioc->zero_copy_sent != sioc->zero_copy_flushed &&
+              !sioc->zero_copy_used;
+
+    sioc->zero_copy_flushed = sioc->zero_copy_sent;
+    sioc->zero_copy_used = false;
+    return ret;
+}
+#endif /* QEMU_MSG_ZEROCOPY */
+
 static ssize_t qio_channel_socket_readv(QIOChannel *ioc,
                                         const struct iovec *iov,
                                         size_t niov,
@@ -533,6 +631,16 @@ static ssize_t qio_channel_socket_readv(QIOChannel *ioc,
     ret = recvmsg(sioc->fd, &msg, sflags);
     if (ret < 0) {
         if (errno == EAGAIN) {
+#ifdef QEMU_MSG_ZEROCOPY
+            /*
+             * Pending zero-copy notifications flag an error condition on
+             * the socket, which wakes up readers.  Collect them, or the
+             * caller would be woken up again right away.
+             */
+            if (qio_channel_socket_reap_zero_copy(sioc, false, errp) < 0) {
+                return -1;
+            }
+#endif
             return QIO_CHANNEL_ERR_BLOCK;
         }
         if (errno == EINTR) {
@@ -729,75 +837,33 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
                                     Error **errp)
 {
     QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
-    struct msghdr msg = {};
-    struct sock_extended_err *serr;
-    struct cmsghdr *cm;
-    char control[CMSG_SPACE(sizeof(*serr))];
-    int received;
-    int ret;
 
-    if (sioc->zero_copy_queued == sioc->zero_copy_sent) {
-        return 0;
+    if (qio_channel_socket_reap_zero_copy(sioc, true, errp) < 0) {
+        return -1;
     }
+    return qio_channel_socket_zero_copy_done(sioc);
+}
 
-    msg.msg_control = control;
-    msg.msg_controllen = sizeof(control);
-    memset(control, 0, sizeof(control));
-
-    ret = 1;
-
-    while (sioc->zero_copy_sent < sioc->zero_copy_queued) {
-        received = recvmsg(sioc->fd, &msg, MSG_ERRQUEUE);
-        if (received < 0) {
-            switch (errno) {
-            case EAGAIN:
-                /* Nothing on errqueue, wait until something is available */
-                qio_channel_wait(ioc, G_IO_ERR);
-                continue;
-            case EINTR:
-                continue;
-            default:
-                error_setg_errno(errp, errno,
-                                 "Unable to read errqueue");
-                return -1;
-            }
-        }
-
-        cm = CMSG_FIRSTHDR(&msg);
-        if (cm->cmsg_level != SOL_IP   && cm->cmsg_type != IP_RECVERR &&
-            cm->cmsg_level != SOL_IPV6 && cm->cmsg_type != IPV6_RECVERR) {
-            error_setg_errno(errp, EPROTOTYPE,
-                             "Wrong cmsg in errqueue");
-            return -1;
-        }
-
-        serr = (void *) CMSG_DATA(cm);
-        if (serr->ee_errno != SO_EE_ORIGIN_NONE) {
-            error_setg_errno(errp, serr->ee_errno,
-                             "Error on socket");
-            return -1;
-        }
-        if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
-            error_setg_errno(errp, serr->ee_origin,
-                             "Error not from zero copy");
-            return -1;
-        }
-        if (serr->ee_data < serr->ee_info) {
-            error_setg_errno(errp, serr->ee_origin,
-                             "Wrong notification bounds");
-            return -1;
-        }
-
-        /* No errors, count successfully finished sendmsg()*/
-        sioc->zero_copy_sent += serr->ee_data - serr->ee_info + 1;
-
-        /* If any sendmsg() succeeded using zero copy, return 0 at the end */
-        if (serr->ee_code != SO_EE_CODE_ZEROCOPY_COPIED) {
-            ret = 0;
-        }
+int qio_channel_socket_zero_copy_poll(QIOChannelSocket *ioc, bool *copied,
+                                      Error **errp)
+{
+    if (qio_channel_socket_reap_zero_copy(ioc, false, errp) < 0) {
+        return -1;
+    }
+    if (ioc->zero_copy_sent < ioc->zero_copy_queued) {
+        return 0;
     }
+    *copied = qio_channel_socket_zero_copy_done(ioc) == 1;
+    return 1;
+}
 
-    return ret;
+#else /* QEMU_MSG_ZEROCOPY */
+
+int qio_channel_socket_zero_copy_poll(QIOChannelSocket *ioc, bool *copied,
+                                      Error **errp)
+{
+    *copied = false;
+    return 1;
 }
 
 #endif /* QEMU_MSG_ZEROCOPY */
@@ -55,6 +55,9 @@
 #include "loader.h"
 #include "user-mmap.h"
 #include "tcg/perf.h"
+#include "exec/translate-all.h"
+#include "profile.h"
+#include "zygote.h"
 #include "exec/page-vary.h"
 
 #ifdef CONFIG_SEMIHOSTING
@@ -78,6 +81,8 @@ static bool opt_one_insn_per_tb;
 static const char *argv0;
 static const char *gdbstub;
 static envlist_t *envlist;
+/* The options given, except those that only shape argv[0] and environ */
+static GString *run_options;
 static const char *cpu_model;
 static const char *cpu_type;
 static const char *seed_optarg;
@@ -324,9 +329,28 @@ static void handle_arg_argv0(const char *arg)
     argv0 = strdup(arg);
 }
 
+static bool stack_size_set;
+
+/*
+ * Read the stack limit from the kernel.  If it's "unlimited",
+ * then we can do little else besides use the default.
+ */
+static void stack_size_from_rlimit(void)
+{
+    struct rlimit lim;
+
+    if (getrlimit(RLIMIT_STACK, &lim) == 0
+        && lim.rlim_cur != RLIM_INFINITY
+        && lim.rlim_cur == (target_long)lim.rlim_cur
+        && lim.rlim_cur > guest_stack_size) {
+        guest_stack_size = lim.rlim_cur;
+    }
+}
+
 static void handle_arg_stack_size(const char *arg)
 {
     char *p;
+    stack_size_set = true;
     guest_stack_size = strtoul(arg, &p, 0);
     if (guest_stack_size == 0) {
         usage(EXIT_FAILURE);
@@ -425,6 +449,11 @@ static void handle_arg_one_insn_per_tb(const char *arg)
     opt_one_insn_per_tb = true;
 }
 
+static void handle_arg_smc_check(const char *arg)
+{
+    smc_selfcheck = true;
+}
+
 static void handle_arg_strace(const char *arg)
 {
     enable_strace = true;
@@ -459,6 +488,16 @@ static void handle_arg_jitdump(const char *arg)
     perf_enable_jitdump();
 }
 
+static void handle_arg_profile(const char *arg)
+{
+    profile_enable(arg);
+}
+
+static void handle_arg_zygote(const char *arg)
+{
+    zygote_enable(arg);
+}
+
 static QemuPluginList plugins = QTAILQ_HEAD_INITIALIZER(plugins);
 
 #ifdef CONFIG_PLUGIN
@@ -514,6 +553,8 @@ static const struct qemu_argument arg_table[] = {
     {"one-insn-per-tb",
                    "QEMU_ONE_INSN_PER_TB",  false, handle_arg_one_insn_per_tb,
      "",           "run with one guest instruction per emulated TB"},
+    {"smc-check",  "QEMU_SMC_CHECK",   false, handle_arg_smc_check,
+     "",           "check code on pages mixing code and data, not protect it"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_seed,
@@ -534,9 +575,33 @@ static const struct qemu_argument arg_table[] = {
      "",           "Generate a /tmp/perf-${pid}.map file for perf"},
     {"jitdump",    "QEMU_JITDUMP",     false, handle_arg_jitdump,
      "",           "Generate a jit-${pid}.dump file for perf"},
+    {"profile",    "QEMU_PROFILE",     true,  handle_arg_profile,
+     "file",       "sample guest execution and write a folded profile to 'file'"},
+    {"zygote",     "QEMU_ZYGOTE",      true,  handle_arg_zygote,
+     "path",       "run programs through the fork server on socket 'path'"},
     {NULL, NULL, false, NULL, NULL, NULL}
 };
 
+static void handle_option(const struct qemu_argument *arginfo,
+                          const char *arg)
+{
+    /*
+     * A fork server client applies these itself before handing over the
+     * guest's argv and environment, the others must match the server's.
+     */
+    if (arginfo->handle_opt != handle_arg_zygote &&
+        arginfo->handle_opt != handle_arg_argv0 &&
+        arginfo->handle_opt != handle_arg_set_env &&
+        arginfo->handle_opt != handle_arg_unset_env) {
+        g_string_append_len(run_options, arginfo->argv,
+                            strlen(arginfo->argv) + 1);
+        if (arg) {
+            g_string_append_len(run_options, arg, strlen(arg) + 1);
+        }
+    }
+    arginfo->handle_opt(arg);
+}
+
 static void usage(int exitcode)
 {
     const struct qemu_argument *arginfo;
@@ -615,6 +680,7 @@ static int parse_args(int argc, char **argv)
     int optind;
     const struct qemu_argument *arginfo;
 
+    run_options = g_string_new(NULL);
     for (arginfo = arg_table; arginfo->handle_opt != NULL; arginfo++) {
         if (arginfo->env == NULL) {
             continue;
@@ -622,7 +688,7 @@ static int parse_args(int argc, char **argv)
 
         r = getenv(arginfo->env);
         if (r != NULL) {
-            arginfo->handle_opt(r);
+            handle_option(arginfo, r);
         }
     }
 
@@ -653,10 +719,10 @@ static int parse_args(int argc, char **argv)
                             "qemu: missing argument for option '%s'\n", r);
                         exit(EXIT_FAILURE);
                     }
-                    arginfo->handle_opt(argv[optind]);
+                    handle_option(arginfo, argv[optind]);
                     optind++;
                 } else {
-                    arginfo->handle_opt(NULL);
+                    handle_option(arginfo, NULL);
                 }
                 break;
             }
@@ -670,6 +736,10 @@ static int parse_args(int argc, char **argv)
     }
 
     if (optind >= argc) {
+        if (zygote_enabled()) {
+            /* Start a fork server; the programs come later. */
+            return optind;
+        }
         (void) fprintf(stderr, "qemu: no user program specified\n");
         exit(EXIT_FAILURE);
     }
@@ -697,6 +767,7 @@ int main(int argc, char **argv, char **envp)
     int host_page_size;
     unsigned long max_reserved_va;
     bool preserve_argv0;
+    bool cpu_from_elf = false;
 
     error_init(argv[0]);
     module_call_init(MODULE_INIT_TRACE);
@@ -718,17 +789,7 @@ int main(int argc, char **argv, char **envp)
         (void) envlist_setenv(envlist, *wrk);
     }
 
-    /* Read the stack limit from the kernel.  If it's "unlimited",
-       then we can do little else besides use the default.  */
-    {
-        struct rlimit lim;
-        if (getrlimit(RLIMIT_STACK, &lim) == 0
-            && lim.rlim_cur != RLIM_INFINITY
-            && lim.rlim_cur == (target_long)lim.rlim_cur
-            && lim.rlim_cur > guest_stack_size) {
-            guest_stack_size = lim.rlim_cur;
-        }
-    }
+    stack_size_from_rlimit();
 
     cpu_model = NULL;
 
@@ -765,7 +826,10 @@ int main(int argc, char **argv, char **envp)
      */
     errno = 0;
     execfd = qemu_getauxval(AT_EXECFD);
-    if (errno != 0) {
+    if (!exec_path) {
+        /* A fork server: each request brings its own executable. */
+        execfd = -1;
+    } else if (errno != 0) {
         execfd = open(exec_path, O_RDONLY);
         if (execfd < 0) {
             printf("Error while loading %s: %s\n", exec_path, strerror(errno));
@@ -774,7 +838,7 @@ int main(int argc, char **argv, char **envp)
     }
 
     /* Resolve executable file name to full path name */
-    if (realpath(exec_path, real_exec_path)) {
+    if (exec_path && realpath(exec_path, real_exec_path)) {
         exec_path = real_exec_path;
     }
 
@@ -792,8 +856,34 @@ int main(int argc, char **argv, char **envp)
         optind++;
     }
 
+    /*
+     * Prepare copy of argv vector for target.
+     */
+    target_argc = argc - optind;
+    target_argv = g_new0(char *, target_argc + 1);
+
+    /*
+     * If argv0 is specified (using '-0' switch) we replace
+     * argv[0] pointer with the given one.
+     */
+    i = 0;
+    if (argv0 != NULL) {
+        target_argv[i++] = strdup(argv0);
+    }
+    for (; i < target_argc; i++) {
+        target_argv[i] = strdup(argv[optind + i]);
+    }
+    target_argv[target_argc] = NULL;
+
+    if (zygote_enabled() && exec_path) {
+        g_auto(GStrv) zygote_envp = envlist_to_environ(envlist, NULL);
+
+        zygote_run(exec_path, execfd, target_argv, zygote_envp, run_options);
+    }
+
     if (cpu_model == NULL) {
         cpu_model = cpu_get_model(get_elf_eflags(execfd));
+        cpu_from_elf = true;
     }
     cpu_type = parse_cpu_option(cpu_model);
 
@@ -889,6 +979,35 @@ int main(int argc, char **argv, char **envp)
 
 #pragma GCC diagnostic pop
 
+    if (zygote_enabled() && !exec_path) {
+        ZygoteRequest req;
+
+        /* Everything above is shared by the programs the server runs. */
+        zygote_serve(cpu_from_elf ? cpu_model : NULL, run_options, &req);
+
+        exec_path = req.exec_path;
+        execfd = req.execfd;
+        target_argv = req.argv;
+        target_argc = g_strv_length(req.argv);
+
+        envlist_free(envlist);
+        envlist = envlist_create();
+        for (wrk = req.envp; *wrk != NULL; wrk++) {
+            continue;
+        }
+        while (wrk != req.envp) {
+            wrk--;
+            (void) envlist_setenv(envlist, *wrk);
+        }
+        g_strfreev(req.envp);
+
+        /* The resource limits are the client's now. */
+        if (!stack_size_set) {
+            guest_stack_size = TARGET_DEFAULT_STACK_SIZE;
+            stack_size_from_rlimit();
+        }
+    }
+
     {
         Error *err = NULL;
         if (seed_optarg != NULL) {
@@ -935,25 +1054,6 @@ int main(int argc, char **argv, char **envp)
                       mmap_min_addr);
     }
 
-    /*
-     * Prepare copy of argv vector for target.
-     */
-    target_argc = argc - optind;
-    target_argv = g_new0(char *, target_argc + 1);
-
-    /*
-     * If argv0 is specified (using '-0' switch) we replace
-     * argv[0] pointer with the given one.
-     */
-    i = 0;
-    if (argv0 != NULL) {
-        target_argv[i++] = strdup(argv0);
-    }
-    for (; i < target_argc; i++) {
-        target_argv[i] = strdup(argv[optind + i]);
-    }
-    target_argv[target_argc] = NULL;
-
 #ifdef QEMU_FIBERS
     fiber_init(env);
 #endif
@@ -1020,6 +1120,7 @@ int main(int argc, char **argv, char **envp)
        generating the prologue until now so that the prologue can take
        the real value of GUEST_BASE into account.  */
     tcg_prologue_init();
+    profile_start();
 
     target_cpu_copy_regs(env, regs);
 
@@ -453,7 +453,18 @@ abi_ulong mmap_find_vma(abi_ulong start, abi_ulong size, abi_ulong align)
         return mmap_find_vma_reserved(start, size, align);
     }
 
-    addr = start;
+    /*
+     * Begin probing at the first range that the guest has left free.
+     * The host may have mappings of its own there, which the kernel
+     * will tell us about below, but this skips the guest's own.
+     */
+    addr = -1;
+    if (size != 0 && start <= GUEST_ADDR_MAX) {
+        addr = page_find_range_empty(start, GUEST_ADDR_MAX, size, align);
+    }
+    if (addr == (abi_ulong)-1) {
+        addr = start;
+    }
     wrapped = repeat = 0;
     prev = 0;
 
@@ -0,0 +1,311 @@
+/*
+ * Built-in sampling profiler for linux-user
+ *
+ * Each guest thread has a CPU-time interval timer of its own that
+ * delivers SIGPROF to it.  Each sample maps the interrupted host pc
+ * back to the guest pc (through the unwind data of the TB it falls
+ * into) and bumps a counter keyed by guest thread and guest pc.
+ * Samples that land outside of translated code are charged to
+ * "[qemu]", those that land in the prologue or in code not owned by a
+ * TB to "[tcg]".
+ *
+ * At exit the counters are resolved against the guest symbol table
+ * and written in the folded format understood by flamegraph.pl:
+ *
+ *     tid-1234;main 42
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/thread.h"
+#include "disas/disas.h"
+#include "exec/exec-all.h"
+#include "tcg/tcg.h"
+#include "qemu.h"
+#include "user-internals.h"
+#include "signal-common.h"
+#include "profile.h"
+
+/* Sampling frequency; prime so that we do not beat with guest loops. */
+#define PROFILE_HZ          997
+
+#define PROFILE_TABLE_BITS  16
+#define PROFILE_TABLE_SIZE  (1u << PROFILE_TABLE_BITS)
+
+/* Pseudo guest pcs for samples that are not in translated code. */
+#define PROFILE_PC_QEMU     UINT64_MAX
+#define PROFILE_PC_TCG      (UINT64_MAX - 1)
+
+typedef struct ProfileEntry {
+    uint64_t pc;
+    uint32_t tid;
+    uint32_t count;
+} ProfileEntry;
+
+#ifndef HAVE_SIGEV_NOTIFY_THREAD_ID
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+static struct {
+    char *path;
+    pid_t pid;
+    bool active;
+    /*
+     * The handler runs with all signals blocked, so a thread never
+     * re-enters the lock; other threads only hold it for one sample.
+     */
+    QemuSpin lock;
+    ProfileEntry *table;
+    uint64_t lost;
+} profile;
+
+/*
+ * Guest threads that run as fibers share the host thread, and so its
+ * timer; it is deleted when the last of them exits.
+ */
+static __thread timer_t profile_thread_timer;
+static __thread bool profile_thread_armed;
+static __thread unsigned int profile_thread_users;
+
+void profile_enable(const char *path)
+{
+    g_free(profile.path);
+    profile.path = g_strdup(path);
+}
+
+bool profile_active(void)
+{
+    return qatomic_read(&profile.active);
+}
+
+static bool profile_arm_thread_timer(void)
+{
+    struct sigevent sev = { };
+    struct itimerspec its = { };
+
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_notify_thread_id = qemu_get_thread_id();
+    sev.sigev_value.sival_ptr = &profile;
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev,
+                     &profile_thread_timer) < 0) {
+        return false;
+    }
+    profile_thread_armed = true;
+    profile_thread_users = 1;
+
+    its.it_interval.tv_nsec = NANOSECONDS_PER_SECOND / PROFILE_HZ;
+    its.it_value = its.it_interval;
+    timer_settime(profile_thread_timer, 0, &its, NULL);
+    return true;
+}
+
+void profile_start(void)
+{
+    if (!profile.path) {
+        return;
+    }
+
+    qemu_spin_init(&profile.lock);
+    profile.table = g_new0(ProfileEntry, PROFILE_TABLE_SIZE);
+    profile.pid = getpid();
+
+    /* Route SIGPROF to us before the first tick. */
+    qatomic_set(&profile.active, true);
+    if (signal_route_sigprof() < 0) {
+        warn_report("Could not install SIGPROF handler: %s, "
+                    "proceeding without profile", strerror(errno));
+        qatomic_set(&profile.active, false);
+        return;
+    }
+
+    if (!profile_arm_thread_timer()) {
+        warn_report("Could not create profiler timer: %s, "
+                    "proceeding without profile", strerror(errno));
+        qatomic_set(&profile.active, false);
+    }
+}
+
+static void profile_disarm_thread_timer(void)
+{
+    if (profile_thread_armed) {
+        timer_delete(profile_thread_timer);
+        profile_thread_armed = false;
+    }
+    profile_thread_users = 0;
+}
+
+void profile_thread_start(void)
+{
+    if (!profile_active()) {
+        return;
+    }
+    if (profile_thread_armed) {
+        profile_thread_users++;
+    } else if (!profile_arm_thread_timer()) {
+        warn_report("Could not create profiler timer: %s, "
+                    "thread %d is not sampled",
+                    strerror(errno), qemu_get_thread_id());
+    }
+}
+
+void profile_thread_exit(void)
+{
+    if (profile_thread_armed && --profile_thread_users == 0) {
+        profile_disarm_thread_timer();
+    }
+}
+
+static uint64_t profile_guest_pc(CPUState *cpu, uintptr_t host_pc)
+{
+    uint64_t data[TARGET_INSN_START_WORDS];
+
+    if (!in_code_gen_buffer((const void *)(host_pc - tcg_splitwx_diff))) {
+        return PROFILE_PC_QEMU;
+    }
+    /*
+     * The unwinder expects a return address, which points just past
+     * the insn of interest; the signal pc points at its first byte.
+     */
+    if (!cpu_unwind_state_data(cpu, host_pc + GETPC_ADJ, data)) {
+        return PROFILE_PC_TCG;
+    }
+    if (tcg_cflags_has(cpu, CF_PCREL)) {
+        /* Only the page offset is recorded; the page is that of env. */
+        return (cpu->cc->get_pc(cpu) & TARGET_PAGE_MASK) |
+               (data[0] & ~TARGET_PAGE_MASK);
+    }
+    return data[0];
+}
+
+static void profile_record(uint32_t tid, uint64_t pc)
+{
+    uint32_t h = (uint32_t)((pc ^ (pc >> 32)) * 0x9e3779b1u) ^ tid;
+    uint32_t i;
+
+    qemu_spin_lock(&profile.lock);
+    for (i = 0; i < PROFILE_TABLE_SIZE; i++) {
+        ProfileEntry *e = &profile.table[(h + i) & (PROFILE_TABLE_SIZE - 1)];
+
+        if (e->count == 0) {
+            e->pc = pc;
+            e->tid = tid;
+            e->count = 1;
+            break;
+        }
+        if (e->pc == pc && e->tid == tid) {
+            e->count++;
+            break;
+        }
+    }
+    if (i == PROFILE_TABLE_SIZE) {
+        profile.lost++;
+    }
+    qemu_spin_unlock(&profile.lock);
+}
+
+bool profile_handle_signal(siginfo_t *info, uintptr_t host_pc)
+{
+    CPUState *cpu = thread_cpu;
+
+    if (info->si_code != SI_TIMER || info->si_value.sival_ptr != &profile) {
+        return false;
+    }
+    if (!profile_active()) {
+        /* A tick that raced with profile_exit(). */
+        return true;
+    }
+    if (!cpu) {
+        profile_record(0, PROFILE_PC_QEMU);
+    } else {
+        profile_record(get_task_state(cpu)->ts_tid,
+                       profile_guest_pc(cpu, host_pc));
+    }
+    return true;
+}
+
+static char *profile_frame_name(uint64_t pc)
+{
+    const char *sym;
+
+    switch (pc) {
+    case PROFILE_PC_QEMU:
+        return g_strdup("[qemu]");
+    case PROFILE_PC_TCG:
+        return g_strdup("[tcg]");
+    }
+    sym = lookup_symbol(pc);
+    if (sym[0] == '\0') {
+        return g_strdup_printf("0x%" PRIx64, pc);
+    }
+    return g_strdup(sym);
+}
+
+void profile_exit(void)
+{
+    GHashTable *folded;
+    GHashTableIter iter;
+    gpointer key, value;
+    FILE *f;
+
+    if (!profile_active()) {
+        return;
+    }
+    /* Ticks of the other threads' timers are ignored from now on. */
+    profile_disarm_thread_timer();
+    qatomic_set(&profile.active, false);
+
+    /* A forked child inherits the table but not the timers. */
+    if (getpid() != profile.pid) {
+        return;
+    }
+
+    f = fopen(profile.path, "w");
+    if (!f) {
+        warn_report("Could not open %s: %s, discarding profile",
+                    profile.path, strerror(errno));
+        return;
+    }
+
+    /* Several pcs resolve to the same symbol: fold them together. */
+    folded = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    qemu_spin_lock(&profile.lock);
+    for (uint32_t i = 0; i < PROFILE_TABLE_SIZE; i++) {
+        ProfileEntry *e = &profile.table[i];
+        g_autofree char *frame = NULL;
+        char *line;
+
+        if (e->count == 0) {
+            continue;
+        }
+        frame = profile_frame_name(e->pc);
+        line = g_strdup_printf("tid-%u;%s", e->tid, frame);
+        value = g_hash_table_lookup(folded, line);
+        g_hash_table_insert(folded, line,
+                            GSIZE_TO_POINTER(GPOINTER_TO_SIZE(value) +
+                                             e->count));
+    }
+    qemu_spin_unlock(&profile.lock);
+
+    g_hash_table_iter_init(&iter, folded);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        fprintf(f, "%s %zu\n", (char *)key, GPOINTER_TO_SIZE(value));
+    }
+    if (profile.lost) {
+        fprintf(f, "[lost] %" PRIu64 "\n", profile.lost);
+    }
+    g_hash_table_destroy(folded);
+    fclose(f);
+}
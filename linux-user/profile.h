@@ -0,0 +1,82 @@
+/*
+ * Built-in sampling profiler for linux-user
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LINUX_USER_PROFILE_H
+#define LINUX_USER_PROFILE_H
+
+/**
+ * profile_enable:
+ * @path: file to write the folded profile to at exit
+ *
+ * Request sampling of the guest; the timer is armed by profile_start().
+ */
+void profile_enable(const char *path);
+
+/**
+ * profile_active:
+ *
+ * Return true if the profiler timer is armed.  While it is, SIGPROF
+ * must stay routed to host_signal_handler whatever the guest asks for.
+ */
+bool profile_active(void);
+
+/**
+ * profile_start:
+ *
+ * Arm the sampling timer of the main thread, if profile_enable() has
+ * been called.
+ * Must run after signal_init() has installed host_signal_handler.
+ */
+void profile_start(void);
+
+/**
+ * profile_thread_start:
+ *
+ * Arm the sampling timer of a new guest thread, which counts the CPU
+ * time of the calling host thread only.  A guest thread that runs as a
+ * fiber on a host thread that is already sampled shares its timer.
+ */
+void profile_thread_start(void);
+
+/**
+ * profile_thread_exit:
+ *
+ * Disarm the sampling timer of the calling thread before it exits,
+ * unless other fibers on the same host thread still use it.
+ */
+void profile_thread_exit(void);
+
+/**
+ * profile_handle_signal:
+ * @info: siginfo of the host signal
+ * @host_pc: host program counter at the time of the signal
+ *
+ * Called from the host signal handler for SIGPROF.  If the signal was
+ * raised by the profiler timer, record a sample and return true;
+ * otherwise return false and let the signal be delivered to the guest.
+ * Async-signal-safe: does not allocate.
+ */
+bool profile_handle_signal(siginfo_t *info, uintptr_t host_pc);
+
+/**
+ * profile_exit:
+ *
+ * Stop sampling and write the collected profile.
+ */
+void profile_exit(void);
+
+#endif /* LINUX_USER_PROFILE_H */
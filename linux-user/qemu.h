@@ -96,6 +96,17 @@ struct emulated_sigtable {
     target_siginfo_t info;
 };
 
+/*
+ * Bump allocator for the transient buffers used to marshal syscall
+ * arguments; see scratch_alloc().
+ */
+typedef struct ScratchArena {
+    char *base;         /* allocated on first use */
+    size_t used;
+    size_t top;         /* offset of the most recent block, or 0 */
+    GSList *large;      /* heap blocks too big for the arena */
+} ScratchArena;
+
 struct TaskState {
     pid_t ts_tid;     /* tid (or pid) of this task */
 #ifdef TARGET_ARM
@@ -159,6 +170,8 @@ struct TaskState {
 
     /* Start time of task after system boot in clock ticks */
     uint64_t start_boottime;
+
+    ScratchArena scratch;
 };
 
 abi_long do_brk(abi_ulong new_brk);
@@ -323,6 +336,14 @@ int copy_to_user(abi_ulong gaddr, void *hptr, ssize_t len);
    host area will have the same contents as the guest.  */
 void *lock_user(int type, abi_ulong guest_addr, ssize_t len, bool copy);
 
+/*
+ * Like lock_user(), for buffers that stay locked after the syscall
+ * returns, such as the data of a submitted USB URB.  lock_user() may
+ * hand out a scratch buffer, which does not live that long.
+ */
+void *lock_user_persistent(int type, abi_ulong guest_addr, ssize_t len,
+                           bool copy);
+
 /* Unlock an area of guest memory.  The first LEN bytes must be
    flushed back to guest memory. host_ptr = NULL is explicitly
    allowed and does nothing. */
@@ -336,6 +357,24 @@ static inline void unlock_user(void *host_ptr, abi_ulong guest_addr,
 void unlock_user(void *host_ptr, abi_ulong guest_addr, ssize_t len);
 #endif
 
+/*
+ * Host buffers for marshalling syscall arguments.  They are carved out
+ * of a per-thread arena, and everything allocated while handling a
+ * syscall is released when it returns; requests too large for the
+ * arena are served from the heap and released at the same point.
+ * scratch_free() releases a buffer early, which only reclaims arena
+ * space if it is the most recent one.
+ *
+ * scratch_alloc() aborts on failure like g_malloc(); scratch_try_alloc()
+ * returns NULL instead.
+ */
+void *scratch_alloc(size_t size);
+void *scratch_try_alloc(size_t size);
+void *scratch_try_alloc0(size_t size);
+void scratch_free(void *ptr);
+void scratch_reset(TaskState *ts);
+void scratch_destroy(TaskState *ts);
+
 /* Return the length of a string in target memory or -TARGET_EFAULT if
    access error. */
 ssize_t target_strlen(abi_ulong gaddr);
@@ -57,6 +57,11 @@ void setup_rt_frame(int sig, struct target_sigaction *ka,
 
 void process_pending_signals(CPUArchState *cpu_env);
 void signal_init(void);
+/*
+ * Route host SIGPROF to host_signal_handler irrespective of the guest
+ * disposition, so that the profiler can intercept its timer ticks.
+ */
+int signal_route_sigprof(void);
 void queue_signal(CPUArchState *env, int sig, int si_type,
                   target_siginfo_t *info);
 void host_to_target_siginfo(target_siginfo_t *tinfo, const siginfo_t *info);
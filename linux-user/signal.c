@@ -31,6 +31,7 @@
 #include "loader.h"
 #include "trace.h"
 #include "signal-common.h"
+#include "profile.h"
 #include "host-signal.h"
 #include "user/safe-syscall.h"
 #include "tcg/tcg.h"
@@ -980,6 +981,11 @@ static void host_signal_handler(int host_sig, siginfo_t *info, void *puc)
     bool sync_sig = false;
     void *sigmask;
 
+    if (host_sig == SIGPROF &&
+        profile_handle_signal(info, host_signal_pc(uc))) {
+        return;
+    }
+
     /*
      * Non-spoofed SIGSEGV and SIGBUS are synchronous, and need special
      * handling wrt signal blocking and unwinding.  Non-spoofed SIGILL,
@@ -1177,12 +1183,31 @@ int do_sigaction(int sig, const struct target_sigaction *act,
                     act1.sa_flags |= SA_RESTART;
                 }
             }
+            if (host_sig == SIGPROF && profile_active()) {
+                /* The profiler timer shares the signal; see profile.c. */
+                act1.sa_sigaction = host_signal_handler;
+                act1.sa_flags |= SA_RESTART;
+            }
             ret = sigaction(host_sig, &act1, NULL);
         }
     }
     return ret;
 }
 
+int signal_route_sigprof(void)
+{
+    struct sigaction act;
+
+    /*
+     * Profiler ticks are consumed by host_signal_handler without
+     * reaching the guest, so they must never interrupt a syscall.
+     */
+    sigfillset(&act.sa_mask);
+    act.sa_flags = SA_SIGINFO | SA_RESTART;
+    act.sa_sigaction = host_signal_handler;
+    return sigaction(SIGPROF, &act, NULL);
+}
+
 static void handle_pending_signal(CPUArchState *cpu_env, int sig,
                                   struct emulated_sigtable *k)
 {
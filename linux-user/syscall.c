@@ -132,6 +132,7 @@
 
 #include "qemu.h"
 #include "user-internals.h"
+#include "profile.h"
 #include "strace.h"
 #include "signal-common.h"
 #include "loader.h"
@@ -1517,7 +1518,11 @@ static abi_long do_ppoll(abi_long arg1, abi_long arg2, abi_long arg3,
             return -TARGET_EFAULT;
         }
 
-        pfd = alloca(sizeof(struct pollfd) * nfds);
+        pfd = scratch_try_alloc(sizeof(struct pollfd) * nfds);
+        if (!pfd) {
+            unlock_user(target_pfd, arg1, 0);
+            return -TARGET_ENOMEM;
+        }
         for (i = 0; i < nfds; i++) {
             pfd[i].fd = tswap32(target_pfd[i].fd);
             pfd[i].events = tswap16(target_pfd[i].events);
@@ -2360,7 +2365,7 @@ static abi_long do_setsockopt(int sockfd, int level, int optname,
                 }
 
                 fprog.len = tswap16(tfprog->len);
-                filter = g_try_new(struct sock_filter, fprog.len);
+                filter = scratch_try_alloc(fprog.len * sizeof(*filter));
                 if (filter == NULL) {
                     unlock_user_struct(tfilter, tfprog->filter, 1);
                     unlock_user_struct(tfprog, optval_addr, 1);
@@ -2376,7 +2381,7 @@ static abi_long do_setsockopt(int sockfd, int level, int optname,
 
                 ret = get_errno(setsockopt(sockfd, SOL_SOCKET,
                                 SO_ATTACH_FILTER, &fprog, sizeof(fprog)));
-                g_free(filter);
+                scratch_free(filter);
 
                 unlock_user_struct(tfilter, tfprog->filter, 1);
                 unlock_user_struct(tfprog, optval_addr, 1);
@@ -2977,6 +2982,68 @@ static void target_to_host_low_high(abi_ulong tlow,
     *hhigh = (off >> HOST_LONG_BITS / 2) >> HOST_LONG_BITS / 2;
 }
 
+/*
+ * When guest and host share an ABI, some target structures are laid out
+ * exactly like the host ones.  This is known at compile time, and such
+ * structures can be handed to the host in place instead of converted.
+ */
+#define SAME_FIELD(T, H, F) \
+    (offsetof(T, F) == offsetof(H, F) && \
+     sizeof_field(T, F) == sizeof_field(H, F))
+
+#define SAME_LAYOUT2(T, H, F1, F2) \
+    (HOST_BIG_ENDIAN == TARGET_BIG_ENDIAN && sizeof(T) == sizeof(H) && \
+     SAME_FIELD(T, H, F1) && SAME_FIELD(T, H, F2))
+
+#define IOVEC_SAME_LAYOUT \
+    SAME_LAYOUT2(struct target_iovec, struct iovec, iov_base, iov_len)
+
+/*
+ * Use the guest iovec array as the host one, if every buffer in it is
+ * valid guest memory that the host sees at the same address.  This is
+ * the common case with a zero guest_base.  Return NULL when the caller
+ * must fall back to converting the array, including for all errors.
+ */
+static struct iovec *lock_iovec_in_place(int type, abi_ulong target_addr,
+                                         abi_ulong count)
+{
+#ifndef CONFIG_DEBUG_REMAP
+    abi_ulong total_len = 0, max_len = 0x7fffffff & TARGET_PAGE_MASK;
+    struct iovec *vec;
+    int i;
+
+    if (!IOVEC_SAME_LAYOUT) {
+        return NULL;
+    }
+    vec = lock_user(VERIFY_READ, target_addr, count * sizeof(*vec), 1);
+    if (!vec) {
+        return NULL;
+    }
+    for (i = 0; i < count; i++) {
+        abi_long len = vec[i].iov_len;
+
+        if (len == 0) {
+            continue;
+        }
+        if (len < 0 || len > max_len - total_len ||
+            lock_user(type, (uintptr_t)vec[i].iov_base, len, 0)
+            != vec[i].iov_base) {
+            return NULL;
+        }
+        total_len += len;
+    }
+    return vec;
+#else
+    return NULL;
+#endif
+}
+
+static bool iovec_is_in_place(struct iovec *vec, abi_ulong target_addr)
+{
+    return IOVEC_SAME_LAYOUT &&
+           vec == g2h_untagged(cpu_untagged_addr(thread_cpu, target_addr));
+}
+
 static struct iovec *lock_iovec(int type, abi_ulong target_addr,
                                 abi_ulong count, int copy)
 {
@@ -2996,7 +3063,12 @@ static struct iovec *lock_iovec(int type, abi_ulong target_addr,
         return NULL;
     }
 
-    vec = g_try_new0(struct iovec, count);
+    vec = lock_iovec_in_place(type, target_addr, count);
+    if (vec) {
+        return vec;
+    }
+
+    vec = scratch_try_alloc0(count * sizeof(struct iovec));
     if (vec == NULL) {
         errno = ENOMEM;
         return NULL;
@@ -3060,7 +3132,7 @@ static struct iovec *lock_iovec(int type, abi_ulong target_addr,
     }
     unlock_user(target_vec, target_addr, 0);
  fail2:
-    g_free(vec);
+    scratch_free(vec);
     errno = err;
     return NULL;
 }
@@ -3071,6 +3143,11 @@ static void unlock_iovec(struct iovec *vec, abi_ulong target_addr,
     struct target_iovec *target_vec;
     int i;
 
+    if (iovec_is_in_place(vec, target_addr)) {
+        /* Nothing was copied, and lock_user is a no-op. */
+        return;
+    }
+
     target_vec = lock_user(VERIFY_READ, target_addr,
                            count * sizeof(struct target_iovec), 1);
     if (target_vec) {
@@ -3085,7 +3162,7 @@ static void unlock_iovec(struct iovec *vec, abi_ulong target_addr,
         unlock_user(target_vec, target_addr, 0);
     }
 
-    g_free(vec);
+    scratch_free(vec);
 }
 
 static inline int target_to_host_sock_type(int *type)
@@ -3202,7 +3279,10 @@ static abi_long do_bind(int sockfd, abi_ulong target_addr,
         return -TARGET_EINVAL;
     }
 
-    addr = alloca(addrlen+1);
+    addr = scratch_try_alloc(addrlen + 1);
+    if (!addr) {
+        return -TARGET_ENOMEM;
+    }
 
     ret = target_to_host_sockaddr(sockfd, addr, target_addr, addrlen);
     if (ret)
@@ -3222,7 +3302,10 @@ static abi_long do_connect(int sockfd, abi_ulong target_addr,
         return -TARGET_EINVAL;
     }
 
-    addr = alloca(addrlen+1);
+    addr = scratch_try_alloc(addrlen + 1);
+    if (!addr) {
+        return -TARGET_ENOMEM;
+    }
 
     ret = target_to_host_sockaddr(sockfd, addr, target_addr, addrlen);
     if (ret) return ret;
@@ -3242,10 +3325,15 @@ static abi_long do_sendrecvmsg_locked(int fd, struct target_msghdr *msgp,
     abi_ulong count;
     struct iovec *vec;
     abi_ulong target_vec;
+    void *name = NULL, *control = NULL;
 
     if (msgp->msg_name) {
         msg.msg_namelen = tswap32(msgp->msg_namelen);
-        msg.msg_name = alloca(msg.msg_namelen+1);
+        msg.msg_name = name = scratch_try_alloc(msg.msg_namelen + 1);
+        if (!name) {
+            ret = -TARGET_ENOMEM;
+            goto out2;
+        }
         ret = target_to_host_sockaddr(fd, msg.msg_name,
                                       tswapal(msgp->msg_name),
                                       msg.msg_namelen);
@@ -3264,8 +3352,11 @@ static abi_long do_sendrecvmsg_locked(int fd, struct target_msghdr *msgp,
         msg.msg_namelen = 0;
     }
     msg.msg_controllen = 2 * tswapal(msgp->msg_controllen);
-    msg.msg_control = alloca(msg.msg_controllen);
-    memset(msg.msg_control, 0, msg.msg_controllen);
+    msg.msg_control = control = scratch_try_alloc0(msg.msg_controllen);
+    if (!control && msg.msg_controllen) {
+        ret = -TARGET_ENOMEM;
+        goto out2;
+    }
 
     msg.msg_flags = tswap32(msgp->msg_flags);
 
@@ -3296,15 +3387,27 @@ static abi_long do_sendrecvmsg_locked(int fd, struct target_msghdr *msgp,
         if (fd_trans_target_to_host_data(fd)) {
             void *host_msg;
 
-            host_msg = g_malloc(msg.msg_iov->iov_len);
+            host_msg = scratch_try_alloc(msg.msg_iov->iov_len);
+            if (!host_msg) {
+                ret = -TARGET_ENOMEM;
+                goto out;
+            }
             memcpy(host_msg, msg.msg_iov->iov_base, msg.msg_iov->iov_len);
             ret = fd_trans_target_to_host_data(fd)(host_msg,
                                                    msg.msg_iov->iov_len);
             if (ret >= 0) {
-                msg.msg_iov->iov_base = host_msg;
-                ret = get_errno(safe_sendmsg(fd, &msg, flags));
+                /* vec may be the guest's own array: do not modify it. */
+                msg.msg_iov = scratch_try_alloc(count * sizeof(*vec));
+                if (msg.msg_iov) {
+                    memcpy(msg.msg_iov, vec, count * sizeof(*vec));
+                    msg.msg_iov->iov_base = host_msg;
+                    ret = get_errno(safe_sendmsg(fd, &msg, flags));
+                    scratch_free(msg.msg_iov);
+                } else {
+                    ret = -TARGET_ENOMEM;
+                }
             }
-            g_free(host_msg);
+            scratch_free(host_msg);
         } else {
             ret = target_to_host_cmsg(&msg, msgp);
             if (ret == 0) {
@@ -3343,6 +3446,9 @@ out:
         unlock_iovec(vec, target_vec, count, !send);
     }
 out2:
+    /* In reverse order, so that sendmmsg reuses the same scratch space. */
+    scratch_free(control);
+    scratch_free(name);
     return ret;
 }
 
@@ -3451,7 +3557,10 @@ static abi_long do_accept4(int fd, abi_ulong target_addr,
         return -TARGET_EFAULT;
     }
 
-    addr = alloca(addrlen);
+    addr = scratch_try_alloc(addrlen);
+    if (!addr && addrlen) {
+        return -TARGET_ENOMEM;
+    }
 
     ret_addrlen = addrlen;
 #ifdef QEMU_FIBERS
@@ -3487,7 +3596,10 @@ static abi_long do_getpeername(int fd, abi_ulong target_addr,
         return -TARGET_EFAULT;
     }
 
-    addr = alloca(addrlen);
+    addr = scratch_try_alloc(addrlen);
+    if (!addr && addrlen) {
+        return -TARGET_ENOMEM;
+    }
 
     ret_addrlen = addrlen;
     ret = get_errno(getpeername(fd, addr, &ret_addrlen));
@@ -3519,7 +3631,10 @@ static abi_long do_getsockname(int fd, abi_ulong target_addr,
         return -TARGET_EFAULT;
     }
 
-    addr = alloca(addrlen);
+    addr = scratch_try_alloc(addrlen);
+    if (!addr && addrlen) {
+        return -TARGET_ENOMEM;
+    }
 
     ret_addrlen = addrlen;
     ret = get_errno(getsockname(fd, addr, &ret_addrlen));
@@ -3568,7 +3683,11 @@ static abi_long do_sendto(int fd, abi_ulong msg, size_t len, int flags,
         return -TARGET_EFAULT;
     if (fd_trans_target_to_host_data(fd)) {
         copy_msg = host_msg;
-        host_msg = g_malloc(len);
+        host_msg = scratch_try_alloc(len);
+        if (!host_msg) {
+            ret = -TARGET_ENOMEM;
+            goto fail;
+        }
         memcpy(host_msg, copy_msg, len);
         ret = fd_trans_target_to_host_data(fd)(host_msg, len);
         if (ret < 0) {
@@ -3576,7 +3695,11 @@ static abi_long do_sendto(int fd, abi_ulong msg, size_t len, int flags,
         }
     }
     if (target_addr) {
-        addr = alloca(addrlen+1);
+        addr = scratch_try_alloc(addrlen + 1);
+        if (!addr) {
+            ret = -TARGET_ENOMEM;
+            goto fail;
+        }
         ret = target_to_host_sockaddr(fd, addr, target_addr, addrlen);
         if (ret) {
             goto fail;
@@ -3596,7 +3719,7 @@ static abi_long do_sendto(int fd, abi_ulong msg, size_t len, int flags,
     }
 fail:
     if (copy_msg) {
-        g_free(host_msg);
+        scratch_free(host_msg);
         host_msg = copy_msg;
     }
     unlock_user(host_msg, msg, 0);
@@ -3630,7 +3753,11 @@ static abi_long do_recvfrom(int fd, abi_ulong msg, size_t len, int flags,
             ret = -TARGET_EINVAL;
             goto fail;
         }
-        addr = alloca(addrlen);
+        addr = scratch_try_alloc(addrlen);
+        if (!addr && addrlen) {
+            ret = -TARGET_ENOMEM;
+            goto fail;
+        }
         ret_addrlen = addrlen;
 #ifdef QEMU_FIBERS
         ret = get_errno(fiber_syscall_recvfrom(fd, host_msg, len, flags,
@@ -3938,14 +4065,14 @@ static inline abi_long target_to_host_semarray(int semid, unsigned short **host_
 
     nsems = semid_ds.sem_nsems;
 
-    *host_array = g_try_new(unsigned short, nsems);
+    *host_array = scratch_try_alloc(nsems * sizeof(unsigned short));
     if (!*host_array) {
         return -TARGET_ENOMEM;
     }
     array = lock_user(VERIFY_READ, target_addr,
                       nsems*sizeof(unsigned short), 1);
     if (!array) {
-        g_free(*host_array);
+        scratch_free(*host_array);
         return -TARGET_EFAULT;
     }
 
@@ -3982,7 +4109,7 @@ static inline abi_long host_to_target_semarray(int semid, abi_ulong target_addr,
     for(i=0; i<nsems; i++) {
         __put_user((*host_array)[i], &array[i]);
     }
-    g_free(*host_array);
+    scratch_free(*host_array);
     unlock_user(array, target_addr, 1);
 
     return 0;
@@ -4128,10 +4255,13 @@ static inline abi_long do_semtimedop(int semid,
         return -TARGET_E2BIG;
     }
 
-    sops = g_new(struct sembuf, nsops);
+    sops = scratch_try_alloc(nsops * sizeof(struct sembuf));
+    if (!sops && nsops) {
+        return -TARGET_ENOMEM;
+    }
 
     if (target_to_host_sembuf(sops, ptr, nsops)) {
-        g_free(sops);
+        scratch_free(sops);
         return -TARGET_EFAULT;
     }
 
@@ -4145,7 +4275,7 @@ static inline abi_long do_semtimedop(int semid,
                                  SEMTIMEDOP_IPC_ARGS(nsops, sops, (long)pts)));
     }
 #endif
-    g_free(sops);
+    scratch_free(sops);
     return ret;
 }
 #endif
@@ -4295,7 +4425,7 @@ static inline abi_long do_msgsnd(int msqid, abi_long msgp,
 
     if (!lock_user_struct(VERIFY_READ, target_mb, msgp, 0))
         return -TARGET_EFAULT;
-    host_mb = g_try_malloc(msgsz + sizeof(long));
+    host_mb = scratch_try_alloc(msgsz + sizeof(long));
     if (!host_mb) {
         unlock_user_struct(target_mb, msgp, 0);
         return -TARGET_ENOMEM;
@@ -4317,7 +4447,7 @@ static inline abi_long do_msgsnd(int msqid, abi_long msgp,
 #endif
     }
 #endif
-    g_free(host_mb);
+    scratch_free(host_mb);
     unlock_user_struct(target_mb, msgp, 0);
 
     return ret;
@@ -4353,7 +4483,7 @@ static inline abi_long do_msgrcv(int msqid, abi_long msgp,
     if (!lock_user_struct(VERIFY_WRITE, target_mb, msgp, 0))
         return -TARGET_EFAULT;
 
-    host_mb = g_try_malloc(msgsz + sizeof(long));
+    host_mb = scratch_try_alloc(msgsz + sizeof(long));
     if (!host_mb) {
         ret = -TARGET_ENOMEM;
         goto end;
@@ -4385,7 +4515,7 @@ static inline abi_long do_msgrcv(int msqid, abi_long msgp,
 end:
     if (target_mb)
         unlock_user_struct(target_mb, msgp, 1);
-    g_free(host_mb);
+    scratch_free(host_mb);
     return ret;
 }
 
@@ -4704,7 +4834,7 @@ static abi_long do_ioctl_fs_ioc_fiemap(const IOCTLEntry *ie, uint8_t *buf_temp,
         /* We can't fit all the extents into the fixed size buffer.
          * Allocate one that is large enough and use it instead.
          */
-        fm = g_try_malloc(outbufsz);
+        fm = scratch_try_alloc(outbufsz);
         if (!fm) {
             return -TARGET_ENOMEM;
         }
@@ -4739,7 +4869,7 @@ static abi_long do_ioctl_fs_ioc_fiemap(const IOCTLEntry *ie, uint8_t *buf_temp,
         }
     }
     if (free_fm) {
-        g_free(fm);
+        scratch_free(fm);
     }
     return ret;
 }
@@ -4792,7 +4922,7 @@ static abi_long do_ioctl_ifconf(const IOCTLEntry *ie, uint8_t *buf_temp,
              * We can't fit all the extents into the fixed size buffer.
              * Allocate one that is large enough and use it instead.
              */
-            host_ifconf = g_try_malloc(outbufsz);
+            host_ifconf = scratch_try_alloc(outbufsz);
             if (!host_ifconf) {
                 return -TARGET_ENOMEM;
             }
@@ -4840,7 +4970,7 @@ static abi_long do_ioctl_ifconf(const IOCTLEntry *ie, uint8_t *buf_temp,
     }
 
     if (free_buf) {
-        g_free(host_ifconf);
+        scratch_free(host_ifconf);
     }
 
     return ret;
@@ -5000,7 +5130,7 @@ do_ioctl_usbdevfs_submiturb(const IOCTLEntry *ie, uint8_t *buf_temp,
     /* buffer space used depends on endpoint type so lock the entire buffer */
     /* control type urbs should check the buffer contents for true direction */
     rw_dir = lurb->host_urb.endpoint & USB_DIR_IN ? VERIFY_WRITE : VERIFY_READ;
-    lurb->target_buf_ptr = lock_user(rw_dir, lurb->target_buf_adr,
+    lurb->target_buf_ptr = lock_user_persistent(rw_dir, lurb->target_buf_adr,
         lurb->host_urb.buffer_length, 1);
     if (lurb->target_buf_ptr == NULL) {
         g_free(lurb);
@@ -5046,7 +5176,11 @@ static abi_long do_ioctl_dm(const IOCTLEntry *ie, uint8_t *buf_temp, int fd,
     unlock_user(argptr, arg, 0);
 
     /* buf_temp is too small, so fetch things into a bigger buffer */
-    big_buf = g_malloc0(((struct dm_ioctl*)buf_temp)->data_size * 2);
+    big_buf = scratch_try_alloc0(((struct dm_ioctl *)buf_temp)->data_size * 2);
+    if (!big_buf) {
+        ret = -TARGET_ENOMEM;
+        goto out;
+    }
     memcpy(big_buf, buf_temp, target_size);
     buf_temp = big_buf;
     host_dm = big_buf;
@@ -5248,7 +5382,7 @@ static abi_long do_ioctl_dm(const IOCTLEntry *ie, uint8_t *buf_temp, int fd,
         unlock_user(argptr, arg, target_size);
     }
 out:
-    g_free(big_buf);
+    scratch_free(big_buf);
     return ret;
 }
 
@@ -5656,6 +5790,20 @@ static abi_long do_ioctl(int fd, int cmd, abi_long arg)
     case TYPE_PTR:
         arg_type++;
         target_size = thunk_type_size(arg_type, 0);
+        if (ie->access == IOC_W && thunk_type_is_identity(arg_type)) {
+            /*
+             * Same layout on both sides: let the host read guest memory.
+             * Anything the host writes goes through buf_temp, so that the
+             * guest only sees it if the ioctl succeeds.
+             */
+            argptr = lock_user(VERIFY_READ, arg, target_size, 1);
+            if (!argptr) {
+                return -TARGET_EFAULT;
+            }
+            ret = get_errno(safe_ioctl(fd, ie->host_cmd, argptr));
+            unlock_user(argptr, arg, 0);
+            break;
+        }
         switch(ie->access) {
         case IOC_R:
             ret = get_errno(safe_ioctl(fd, ie->host_cmd, buf_temp));
@@ -6588,6 +6736,7 @@ static void *clone_func(void *arg)
         put_user_u32(info->tid, info->parent_tidptr);
     qemu_guest_random_seed_thread_part2(cpu->random_seed);
 #ifdef QEMU_FIBERS
+    profile_thread_start();
     pth_sigmask(SIG_SETMASK, &info->sigmask, NULL);
     /* Signal to the parent that we're ready.  */
     pth_mutex_acquire(&info->mutex, FALSE, NULL);
@@ -6600,6 +6749,7 @@ static void *clone_func(void *arg)
 
     FIBERS_LOG_DEBUG("starting thread: 0x%d\n", info->tid);
 #else
+    profile_thread_start();
     /* Enable signals.  */
     sigprocmask(SIG_SETMASK, &info->sigmask, NULL);
     /* Signal to the parent that we're ready.  */
@@ -7980,7 +8130,12 @@ static abi_long do_name_to_handle_at(abi_long dirfd, abi_long pathname,
         return -TARGET_EFAULT;
     }
 
-    fh = g_malloc0(total_size);
+    fh = scratch_try_alloc0(total_size);
+    if (!fh) {
+        unlock_user(target_fh, handle, 0);
+        unlock_user(name, pathname, 0);
+        return -TARGET_ENOMEM;
+    }
     fh->handle_bytes = size;
 
     ret = get_errno(name_to_handle_at(dirfd, path(name), fh, &mid, flags));
@@ -7994,7 +8149,7 @@ static abi_long do_name_to_handle_at(abi_long dirfd, abi_long pathname,
     memcpy(target_fh, fh, total_size);
     target_fh->handle_bytes = tswap32(fh->handle_bytes);
     target_fh->handle_type = tswap32(fh->handle_type);
-    g_free(fh);
+    scratch_free(fh);
     unlock_user(target_fh, handle, total_size);
 
     if (put_user_s32(mid, mount_id)) {
@@ -8025,14 +8180,19 @@ static abi_long do_open_by_handle_at(abi_long mount_fd, abi_long handle,
         return -TARGET_EFAULT;
     }
 
-    fh = g_memdup(target_fh, total_size);
+    fh = scratch_try_alloc(total_size);
+    if (!fh) {
+        unlock_user(target_fh, handle, 0);
+        return -TARGET_ENOMEM;
+    }
+    memcpy(fh, target_fh, total_size);
     fh->handle_bytes = size;
     fh->handle_type = tswap32(target_fh->handle_type);
 
     ret = get_errno(open_by_handle_at(mount_fd, fh,
                     target_to_host_bitmask(flags, fcntl_flags_tbl)));
 
-    g_free(fh);
+    scratch_free(fh);
 
     unlock_user(target_fh, handle, total_size);
 
@@ -8105,7 +8265,7 @@ static int open_self_cmdline(CPUArchState *cpu_env, int fd)
 struct open_self_maps_data {
     TaskState *ts;
     IntervalTreeRoot *host_maps;
-    int fd;
+    GString *buf;
     bool smaps;
 };
 
@@ -8127,7 +8287,8 @@ static void open_self_maps_4(const struct open_self_maps_data *d,
     const struct image_info *info = d->ts->info;
     const char *path = mi->path;
     uint64_t offset;
-    int fd = d->fd;
+    GString *buf = d->buf;
+    gsize line = buf->len;
     int count;
 
     if (test_stack(start, end, info->stack_limit)) {
@@ -8149,19 +8310,20 @@ static void open_self_maps_4(const struct open_self_maps_data *d,
         offset += hstart - mi->itree.start;
     }
 
-    count = dprintf(fd, TARGET_ABI_FMT_ptr "-" TARGET_ABI_FMT_ptr
-                    " %c%c%c%c %08" PRIx64 " %02x:%02x %"PRId64,
-                    start, end,
-                    (flags & PAGE_READ) ? 'r' : '-',
-                    (flags & PAGE_WRITE_ORG) ? 'w' : '-',
-                    (flags & PAGE_EXEC) ? 'x' : '-',
-                    mi->is_priv ? 'p' : 's',
-                    offset, major(mi->dev), minor(mi->dev),
-                    (uint64_t)mi->inode);
+    g_string_append_printf(buf, TARGET_ABI_FMT_ptr "-" TARGET_ABI_FMT_ptr
+                           " %c%c%c%c %08" PRIx64 " %02x:%02x %"PRId64,
+                           start, end,
+                           (flags & PAGE_READ) ? 'r' : '-',
+                           (flags & PAGE_WRITE_ORG) ? 'w' : '-',
+                           (flags & PAGE_EXEC) ? 'x' : '-',
+                           mi->is_priv ? 'p' : 's',
+                           offset, major(mi->dev), minor(mi->dev),
+                           (uint64_t)mi->inode);
+    count = buf->len - line;
     if (path) {
-        dprintf(fd, "%*s%s\n", 73 - count, "", path);
+        g_string_append_printf(buf, "%*s%s\n", 73 - count, "", path);
     } else {
-        dprintf(fd, "\n");
+        g_string_append_c(buf, '\n');
     }
 
     if (d->smaps) {
@@ -8169,39 +8331,40 @@ static void open_self_maps_4(const struct open_self_maps_data *d,
         unsigned long page_size_kb = TARGET_PAGE_SIZE >> 10;
         unsigned long size_kb = size >> 10;
 
-        dprintf(fd, "Size:                  %lu kB\n"
-                "KernelPageSize:        %lu kB\n"
-                "MMUPageSize:           %lu kB\n"
-                "Rss:                   0 kB\n"
-                "Pss:                   0 kB\n"
-                "Pss_Dirty:             0 kB\n"
-                "Shared_Clean:          0 kB\n"
-                "Shared_Dirty:          0 kB\n"
-                "Private_Clean:         0 kB\n"
-                "Private_Dirty:         0 kB\n"
-                "Referenced:            0 kB\n"
-                "Anonymous:             %lu kB\n"
-                "LazyFree:              0 kB\n"
-                "AnonHugePages:         0 kB\n"
-                "ShmemPmdMapped:        0 kB\n"
-                "FilePmdMapped:         0 kB\n"
-                "Shared_Hugetlb:        0 kB\n"
-                "Private_Hugetlb:       0 kB\n"
-                "Swap:                  0 kB\n"
-                "SwapPss:               0 kB\n"
-                "Locked:                0 kB\n"
-                "THPeligible:    0\n"
-                "VmFlags:%s%s%s%s%s%s%s%s\n",
-                size_kb, page_size_kb, page_size_kb,
-                (flags & PAGE_ANON ? size_kb : 0),
-                (flags & PAGE_READ) ? " rd" : "",
-                (flags & PAGE_WRITE_ORG) ? " wr" : "",
-                (flags & PAGE_EXEC) ? " ex" : "",
-                mi->is_priv ? "" : " sh",
-                (flags & PAGE_READ) ? " mr" : "",
-                (flags & PAGE_WRITE_ORG) ? " mw" : "",
-                (flags & PAGE_EXEC) ? " me" : "",
-                mi->is_priv ? "" : " ms");
+        g_string_append_printf(buf,
+                               "Size:                  %lu kB\n"
+                               "KernelPageSize:        %lu kB\n"
+                               "MMUPageSize:           %lu kB\n"
+                               "Rss:                   0 kB\n"
+                               "Pss:                   0 kB\n"
+                               "Pss_Dirty:             0 kB\n"
+                               "Shared_Clean:          0 kB\n"
+                               "Shared_Dirty:          0 kB\n"
+                               "Private_Clean:         0 kB\n"
+                               "Private_Dirty:         0 kB\n"
+                               "Referenced:            0 kB\n"
+                               "Anonymous:             %lu kB\n"
+                               "LazyFree:              0 kB\n"
+                               "AnonHugePages:         0 kB\n"
+                               "ShmemPmdMapped:        0 kB\n"
+                               "FilePmdMapped:         0 kB\n"
+                               "Shared_Hugetlb:        0 kB\n"
+                               "Private_Hugetlb:       0 kB\n"
+                               "Swap:                  0 kB\n"
+                               "SwapPss:               0 kB\n"
+                               "Locked:                0 kB\n"
+                               "THPeligible:    0\n"
+                               "VmFlags:%s%s%s%s%s%s%s%s\n",
+                               size_kb, page_size_kb, page_size_kb,
+                               (flags & PAGE_ANON ? size_kb : 0),
+                               (flags & PAGE_READ) ? " rd" : "",
+                               (flags & PAGE_WRITE_ORG) ? " wr" : "",
+                               (flags & PAGE_EXEC) ? " ex" : "",
+                               mi->is_priv ? "" : " sh",
+                               (flags & PAGE_READ) ? " mr" : "",
+                               (flags & PAGE_WRITE_ORG) ? " mw" : "",
+                               (flags & PAGE_EXEC) ? " me" : "",
+                               mi->is_priv ? "" : " ms");
     }
 }
 
@@ -8257,22 +8420,51 @@ static int open_self_maps_2(void *opaque, target_ulong guest_start,
     }
 }
 
+/*
+ * The last text produced for maps and smaps, and the page flags
+ * generation it was produced from.  Programs that poll their own
+ * mappings (garbage collectors, sanitizers, profilers) read these
+ * files far more often than the mappings change; walking the page
+ * flags and reading and intersecting the host maps each time is
+ * pure waste.  Protected by mmap_lock.
+ */
+static struct {
+    GString *text;
+    uint64_t generation;
+} self_maps_cache[2];
+
 static int open_self_maps_1(CPUArchState *env, int fd, bool smaps)
 {
     struct open_self_maps_data d = {
         .ts = get_task_state(env_cpu(env)),
-        .host_maps = read_self_maps(),
-        .fd = fd,
         .smaps = smaps
     };
-
-    if (d.host_maps) {
-        walk_memory_regions(&d, open_self_maps_2);
-        free_self_maps(d.host_maps);
-    } else {
-        walk_memory_regions(&d, open_self_maps_3);
+    int ret = 0;
+
+    mmap_lock();
+    if (!self_maps_cache[smaps].text ||
+        self_maps_cache[smaps].generation != page_flags_generation()) {
+        d.buf = self_maps_cache[smaps].text;
+        if (d.buf) {
+            g_string_truncate(d.buf, 0);
+        } else {
+            d.buf = self_maps_cache[smaps].text = g_string_new(NULL);
+        }
+        d.host_maps = read_self_maps();
+        if (d.host_maps) {
+            walk_memory_regions(&d, open_self_maps_2);
+            free_self_maps(d.host_maps);
+        } else {
+            walk_memory_regions(&d, open_self_maps_3);
+        }
+        self_maps_cache[smaps].generation = page_flags_generation();
     }
-    return 0;
+    d.buf = self_maps_cache[smaps].text;
+    if (qemu_write_full(fd, d.buf->str, d.buf->len) != d.buf->len) {
+        ret = -1;
+    }
+    mmap_unlock();
+    return ret;
 }
 
 static int open_self_maps(CPUArchState *cpu_env, int fd)
@@ -8801,13 +8993,12 @@ static int host_to_target_cpu_mask(const unsigned long *host_mask,
 #ifdef TARGET_NR_getdents
 static int do_getdents(abi_long dirfd, abi_long arg2, abi_long count)
 {
-    g_autofree void *hdirp = NULL;
-    void *tdirp;
+    void *hdirp, *tdirp;
     int hlen, hoff, toff;
     int hreclen, treclen;
     off64_t prev_diroff = 0;
 
-    hdirp = g_try_malloc(count);
+    hdirp = scratch_try_alloc(count);
     if (!hdirp) {
         return -TARGET_ENOMEM;
     }
@@ -8888,13 +9079,12 @@ static int do_getdents(abi_long dirfd, abi_long arg2, abi_long count)
 #if defined(TARGET_NR_getdents64) && defined(__NR_getdents64)
 static int do_getdents64(abi_long dirfd, abi_long arg2, abi_long count)
 {
-    g_autofree void *hdirp = NULL;
-    void *tdirp;
+    void *hdirp, *tdirp;
     int hlen, hoff, toff;
     int hreclen, treclen;
     off64_t prev_diroff = 0;
 
-    hdirp = g_try_malloc(count);
+    hdirp = scratch_try_alloc(count);
     if (!hdirp) {
         return -TARGET_ENOMEM;
     }
@@ -9146,7 +9336,10 @@ static int cpu_set_valid(abi_long arg3, abi_long arg4)
     host_mask_size = (target_mask_size + (sizeof(*host_mask) - 1)) &
                      ~(sizeof(*host_mask) - 1);
 
-    host_mask = alloca(host_mask_size);
+    host_mask = scratch_try_alloc(host_mask_size);
+    if (!host_mask && host_mask_size) {
+        return -TARGET_ENOMEM;
+    }
 
     ret = target_to_host_cpu_mask(host_mask, host_mask_size,
                                   arg4, target_mask_size);
@@ -9285,11 +9478,14 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
 #endif
 
             thread_cpu = NULL;
+            scratch_destroy(ts);
             g_free(ts);
 #ifdef QEMU_FIBERS
+            profile_thread_exit();
             fiber_unregister(pth_self());
             pth_exit(NULL);
 #else
+            profile_thread_exit();
             rcu_unregister_thread();
             pthread_exit(NULL);
 #endif
@@ -9341,7 +9537,12 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
             if (!(p = lock_user(VERIFY_READ, arg2, arg3, 1)))
                 return -TARGET_EFAULT;
             if (fd_trans_target_to_host_data(arg1)) {
-                void *copy = g_malloc(arg3);
+                void *copy = scratch_try_alloc(arg3);
+
+                if (!copy) {
+                    unlock_user(p, arg2, 0);
+                    return -TARGET_ENOMEM;
+                }
                 memcpy(copy, p, arg3);
                 ret = fd_trans_target_to_host_data(arg1)(copy, arg3);
                 if (ret >= 0) {
@@ -9351,7 +9552,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
                     ret = get_errno(safe_write(arg1, copy, ret));
 #endif
                 }
-                g_free(copy);
+                scratch_free(copy);
             } else {
 #ifdef QEMU_FIBERS
                 ret = get_errno(fiber_syscall_write(arg1, p, arg3));
@@ -11468,8 +11669,10 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
             }
             mask_size = (arg2 + (sizeof(*mask) - 1)) & ~(sizeof(*mask) - 1);
 
-            mask = alloca(mask_size);
-            memset(mask, 0, mask_size);
+            mask = scratch_try_alloc0(mask_size);
+            if (!mask && mask_size) {
+                return -TARGET_ENOMEM;
+            }
             ret = get_errno(sys_sched_getaffinity(arg1, mask_size, mask));
 
             if (!is_error(ret)) {
@@ -11507,7 +11710,10 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
                 return -TARGET_EINVAL;
             }
             mask_size = (arg2 + (sizeof(*mask) - 1)) & ~(sizeof(*mask) - 1);
-            mask = alloca(mask_size);
+            mask = scratch_try_alloc(mask_size);
+            if (!mask && mask_size) {
+                return -TARGET_ENOMEM;
+            }
 
             ret = target_to_host_cpu_mask(mask, mask_size, arg3, arg2);
             if (ret) {
@@ -12062,14 +12268,14 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
         { /* the same code as for TARGET_NR_getgroups32 */
             int gidsetsize = arg1;
             target_id *target_grouplist;
-            g_autofree gid_t *grouplist = NULL;
+            gid_t *grouplist = NULL;
             int i;
 
             if (gidsetsize > NGROUPS_MAX || gidsetsize < 0) {
                 return -TARGET_EINVAL;
             }
             if (gidsetsize > 0) {
-                grouplist = g_try_new(gid_t, gidsetsize);
+                grouplist = scratch_try_alloc(gidsetsize * sizeof(gid_t));
                 if (!grouplist) {
                     return -TARGET_ENOMEM;
                 }
@@ -12093,14 +12299,14 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
         { /* the same code as for TARGET_NR_setgroups32 */
             int gidsetsize = arg1;
             target_id *target_grouplist;
-            g_autofree gid_t *grouplist = NULL;
+            gid_t *grouplist = NULL;
             int i;
 
             if (gidsetsize > NGROUPS_MAX || gidsetsize < 0) {
                 return -TARGET_EINVAL;
             }
             if (gidsetsize > 0) {
-                grouplist = g_try_new(gid_t, gidsetsize);
+                grouplist = scratch_try_alloc(gidsetsize * sizeof(gid_t));
                 if (!grouplist) {
                     return -TARGET_ENOMEM;
                 }
@@ -12398,14 +12604,14 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
         { /* the same code as for TARGET_NR_getgroups */
             int gidsetsize = arg1;
             uint32_t *target_grouplist;
-            g_autofree gid_t *grouplist = NULL;
+            gid_t *grouplist = NULL;
             int i;
 
             if (gidsetsize > NGROUPS_MAX || gidsetsize < 0) {
                 return -TARGET_EINVAL;
             }
             if (gidsetsize > 0) {
-                grouplist = g_try_new(gid_t, gidsetsize);
+                grouplist = scratch_try_alloc(gidsetsize * sizeof(gid_t));
                 if (!grouplist) {
                     return -TARGET_ENOMEM;
                 }
@@ -12430,14 +12636,14 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
         { /* the same code as for TARGET_NR_setgroups */
             int gidsetsize = arg1;
             uint32_t *target_grouplist;
-            g_autofree gid_t *grouplist = NULL;
+            gid_t *grouplist = NULL;
             int i;
 
             if (gidsetsize > NGROUPS_MAX || gidsetsize < 0) {
                 return -TARGET_EINVAL;
             }
             if (gidsetsize > 0) {
-                grouplist = g_try_new(gid_t, gidsetsize);
+                grouplist = scratch_try_alloc(gidsetsize * sizeof(gid_t));
                 if (!grouplist) {
                     return -TARGET_ENOMEM;
                 }
@@ -13503,10 +13709,16 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
             return -TARGET_EFAULT;
         }
 
-        ep = g_try_new(struct epoll_event, maxevents);
-        if (!ep) {
-            unlock_user(target_ep, arg2, 0);
-            return -TARGET_ENOMEM;
+        if (SAME_LAYOUT2(struct target_epoll_event, struct epoll_event,
+                         events, data)) {
+            /* Let the host fill in the guest buffer directly. */
+            ep = (struct epoll_event *)target_ep;
+        } else {
+            ep = scratch_try_alloc(maxevents * sizeof(*ep));
+            if (!ep) {
+                unlock_user(target_ep, arg2, 0);
+                return -TARGET_ENOMEM;
+            }
         }
 
         switch (num) {
@@ -13542,7 +13754,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
         }
         if (!is_error(ret)) {
             int i;
-            for (i = 0; i < ret; i++) {
+            for (i = 0; ep != (void *)target_ep && i < ret; i++) {
                 target_ep[i].events = tswap32(ep[i].events);
                 target_ep[i].data.u64 = tswap64(ep[i].data.u64);
             }
@@ -13551,7 +13763,9 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
         } else {
             unlock_user(target_ep, arg2, 0);
         }
-        g_free(ep);
+        if (ep != (void *)target_ep) {
+            scratch_free(ep);
+        }
         return ret;
     }
 #endif
@@ -14023,6 +14237,7 @@ abi_long do_syscall(CPUArchState *cpu_env, int num, abi_long arg1,
 
     ret = do_syscall1(cpu_env, num, arg1, arg2, arg3, arg4,
                       arg5, arg6, arg7, arg8);
+    scratch_reset(get_task_state(cpu));
 
     if (unlikely(qemu_loglevel_mask(LOG_STRACE))) {
         print_syscall_ret(cpu_env, num, ret, arg1, arg2,
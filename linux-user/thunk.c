@@ -61,6 +61,214 @@ static const argtype *thunk_type_next_ptr(const argtype *type_ptr)
     return thunk_type_next(type_ptr);
 }
 
+/*
+ * Each struct is also compiled, once per direction, into a flat list of
+ * operations at fixed offsets, so that converting it does not walk the
+ * type descriptors again.  Fields with the same representation on both
+ * sides become plain copies and neighbouring copies are merged; a struct
+ * that ends up as a single copy has an identity layout.
+ *
+ * Define THUNK_INTERPRET to always walk the descriptors, for debugging.
+ */
+//#define THUNK_INTERPRET
+
+/* Beyond this, the straight-line form is no better than the descriptors. */
+#define THUNK_MAX_OPS 256
+
+enum {
+    THUNK_OP_COPY,
+    THUNK_OP_SWAP16,
+    THUNK_OP_SWAP32,
+    THUNK_OP_SWAP64,
+    THUNK_OP_CONVERT,   /* size change or special struct: thunk_convert */
+};
+
+struct ThunkOp {
+    int kind;
+    int len;
+    int dst;
+    int src;
+    const argtype *type;
+};
+
+static void thunk_add_op(GArray *ops, int kind, int len, int dst, int src,
+                         const argtype *type)
+{
+    ThunkOp op = { kind, len, dst, src, type };
+
+    if (kind == THUNK_OP_COPY && ops->len) {
+        ThunkOp *last = &g_array_index(ops, ThunkOp, ops->len - 1);
+
+        /*
+         * Ops are generated in field order, so whatever lies between two
+         * consecutive copies with the same displacement is padding.
+         */
+        if (last->kind == THUNK_OP_COPY &&
+            dst - last->dst == src - last->src &&
+            dst >= last->dst + last->len) {
+            last->len = dst + len - last->dst;
+            return;
+        }
+    }
+    g_array_append_val(ops, op);
+}
+
+static bool thunk_compile_fields(GArray *ops, const StructEntry *se,
+                                 int dst, int src, int to_host);
+
+static bool thunk_compile_type(GArray *ops, const argtype *type_ptr,
+                               int dst, int src, int to_host)
+{
+    int dst_size = thunk_type_size(type_ptr, to_host);
+    int src_size = thunk_type_size(type_ptr, 1 - to_host);
+    const StructEntry *se;
+    int i;
+
+    if (ops->len > THUNK_MAX_OPS) {
+        return false;
+    }
+    switch (*type_ptr) {
+    case TYPE_CHAR:
+    case TYPE_SHORT:
+    case TYPE_INT:
+    case TYPE_LONGLONG:
+    case TYPE_ULONGLONG:
+    case TYPE_LONG:
+    case TYPE_ULONG:
+    case TYPE_PTRVOID:
+    case TYPE_OLDDEVT:
+        if (dst_size != src_size) {
+            thunk_add_op(ops, THUNK_OP_CONVERT, dst_size, dst, src, type_ptr);
+        } else if (dst_size == 1 || HOST_BIG_ENDIAN == TARGET_BIG_ENDIAN) {
+            thunk_add_op(ops, THUNK_OP_COPY, dst_size, dst, src, type_ptr);
+        } else {
+            thunk_add_op(ops, dst_size == 2 ? THUNK_OP_SWAP16 :
+                              dst_size == 4 ? THUNK_OP_SWAP32 :
+                              THUNK_OP_SWAP64, dst_size, dst, src, type_ptr);
+        }
+        return true;
+    case TYPE_ARRAY:
+        dst_size = thunk_type_size(type_ptr + 2, to_host);
+        src_size = thunk_type_size(type_ptr + 2, 1 - to_host);
+        for (i = 0; i < type_ptr[1]; i++) {
+            if (!thunk_compile_type(ops, type_ptr + 2, dst + i * dst_size,
+                                    src + i * src_size, to_host)) {
+                return false;
+            }
+        }
+        return true;
+    case TYPE_STRUCT:
+        se = struct_entries + type_ptr[1];
+        if (se->convert[0] != NULL) {
+            thunk_add_op(ops, THUNK_OP_CONVERT, dst_size, dst, src, type_ptr);
+            return true;
+        }
+        return thunk_compile_fields(ops, se, dst, src, to_host);
+    default:
+        return false;
+    }
+}
+
+static bool thunk_compile_fields(GArray *ops, const StructEntry *se,
+                                 int dst, int src, int to_host)
+{
+    const argtype *type_ptr = se->field_types;
+    int i;
+
+    for (i = 0; i < se->nb_fields; i++) {
+        if (!thunk_compile_type(ops, type_ptr,
+                                dst + se->field_offsets[to_host][i],
+                                src + se->field_offsets[1 - to_host][i],
+                                to_host)) {
+            return false;
+        }
+        type_ptr = thunk_type_next(type_ptr);
+    }
+    return true;
+}
+
+static void thunk_compile_struct(StructEntry *se)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(se->ops); i++) {
+        GArray *ops = g_array_new(false, false, sizeof(ThunkOp));
+
+        if (!thunk_compile_fields(ops, se, 0, 0, i) ||
+            ops->len > THUNK_MAX_OPS) {
+            g_array_free(ops, true);
+            return;
+        }
+        se->nb_ops[i] = ops->len;
+        se->ops[i] = (ThunkOp *)g_array_free(ops, false);
+    }
+
+    if (se->size[0] == se->size[1] &&
+        se->nb_ops[0] == 1 && se->ops[0]->kind == THUNK_OP_COPY &&
+        se->ops[0]->dst == 0 && se->ops[0]->src == 0) {
+        se->identity = true;
+    }
+#ifdef DEBUG
+    printf("%s: %d/%d ops%s\n", se->name, se->nb_ops[0], se->nb_ops[1],
+           se->identity ? ", identity" : "");
+#endif
+}
+
+static void thunk_run(void *dst, const void *src, const ThunkOp *op,
+                      int nb_ops, int to_host)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    for (; nb_ops > 0; nb_ops--, op++) {
+        switch (op->kind) {
+        case THUNK_OP_COPY:
+            memcpy(d + op->dst, s + op->src, op->len);
+            break;
+        case THUNK_OP_SWAP16:
+            *(uint16_t *)(d + op->dst) = bswap16(*(uint16_t *)(s + op->src));
+            break;
+        case THUNK_OP_SWAP32:
+            *(uint32_t *)(d + op->dst) = bswap32(*(uint32_t *)(s + op->src));
+            break;
+        case THUNK_OP_SWAP64:
+            *(uint64_t *)(d + op->dst) = bswap64(*(uint64_t *)(s + op->src));
+            break;
+        default:
+            thunk_convert(d + op->dst, s + op->src, op->type, to_host);
+            break;
+        }
+    }
+}
+
+bool thunk_type_is_identity(const argtype *type_ptr)
+{
+#ifdef THUNK_INTERPRET
+    return false;
+#else
+    switch (*type_ptr) {
+    case TYPE_CHAR:
+        return true;
+    case TYPE_SHORT:
+    case TYPE_INT:
+    case TYPE_LONGLONG:
+    case TYPE_ULONGLONG:
+    case TYPE_LONG:
+    case TYPE_ULONG:
+    case TYPE_PTRVOID:
+    case TYPE_OLDDEVT:
+        return HOST_BIG_ENDIAN == TARGET_BIG_ENDIAN &&
+               thunk_type_size(type_ptr, 0) == thunk_type_size(type_ptr, 1);
+    case TYPE_ARRAY:
+        return thunk_type_is_identity(type_ptr + 2);
+    case TYPE_STRUCT:
+        return struct_entries[type_ptr[1]].identity;
+    default:
+        return false;
+    }
+#endif
+}
+
 void thunk_register_struct(int id, const char *name, const argtype *types)
 {
     const argtype *type_ptr;
@@ -110,6 +318,9 @@ void thunk_register_struct(int id, const char *name, const argtype *types)
                i == THUNK_HOST ? "host" : "target", offset, max_align);
 #endif
     }
+#ifndef THUNK_INTERPRET
+    thunk_compile_struct(se);
+#endif
 }
 
 void thunk_register_struct_direct(int id, const char *name,
@@ -250,6 +461,11 @@ const argtype *thunk_convert(void *dst, const void *src,
             if (se->convert[0] != NULL) {
                 /* specific conversion is needed */
                 (*se->convert[to_host])(dst, src);
+            } else if (se->identity) {
+                memcpy(dst, src, se->size[to_host]);
+            } else if (se->ops[to_host]) {
+                thunk_run(dst, src, se->ops[to_host], se->nb_ops[to_host],
+                          to_host);
             } else {
                 /* standard struct conversion */
                 field_types = se->field_types;
@@ -1,11 +1,13 @@
 /* User memory access */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 
 #include "qemu.h"
 #include "user-internals.h"
 
-void *lock_user(int type, abi_ulong guest_addr, ssize_t len, bool copy)
+static void *lock_user_common(int type, abi_ulong guest_addr, ssize_t len,
+                              bool copy, bool persistent)
 {
     void *host_addr;
 
@@ -15,15 +17,30 @@ void *lock_user(int type, abi_ulong guest_addr, ssize_t len, bool copy)
     }
     host_addr = g2h_untagged(guest_addr);
 #ifdef CONFIG_DEBUG_REMAP
-    if (copy) {
-        host_addr = g_memdup(host_addr, len);
-    } else {
-        host_addr = g_malloc0(len);
+    {
+        void *buf = persistent ? g_malloc(len) : scratch_alloc(len);
+
+        if (copy) {
+            host_addr = memcpy(buf, host_addr, len);
+        } else {
+            host_addr = memset(buf, 0, len);
+        }
     }
 #endif
     return host_addr;
 }
 
+void *lock_user(int type, abi_ulong guest_addr, ssize_t len, bool copy)
+{
+    return lock_user_common(type, guest_addr, len, copy, false);
+}
+
+void *lock_user_persistent(int type, abi_ulong guest_addr, ssize_t len,
+                           bool copy)
+{
+    return lock_user_common(type, guest_addr, len, copy, true);
+}
+
 #ifdef CONFIG_DEBUG_REMAP
 void unlock_user(void *host_ptr, abi_ulong guest_addr, ssize_t len)
 {
@@ -39,10 +56,118 @@ void unlock_user(void *host_ptr, abi_ulong guest_addr, ssize_t len)
     if (len > 0) {
         memcpy(host_ptr_conv, host_ptr, len);
     }
-    g_free(host_ptr);
+    scratch_free(host_ptr);
 }
 #endif
 
+/*
+ * Each arena block is preceded by the arena state from before it was
+ * allocated, so that freeing the most recent block rolls the arena
+ * back.  Blocks freed out of order stay put until the arena is reset.
+ */
+#define SCRATCH_SIZE    (64 * KiB)
+#define SCRATCH_ALIGN   16
+
+typedef struct ScratchHeader {
+    size_t prev_used;
+    size_t prev_top;
+} ScratchHeader;
+
+#define SCRATCH_HDR     ROUND_UP(sizeof(ScratchHeader), SCRATCH_ALIGN)
+
+static ScratchArena *scratch_arena(void)
+{
+    return thread_cpu ? &get_task_state(thread_cpu)->scratch : NULL;
+}
+
+void *scratch_try_alloc(size_t size)
+{
+    ScratchArena *a = scratch_arena();
+    ScratchHeader *h;
+    void *p;
+
+    if (!a) {
+        /* No thread yet: the caller must scratch_free() the buffer. */
+        return g_try_malloc(size);
+    }
+    if (size <= SCRATCH_SIZE - SCRATCH_HDR) {
+        if (!a->base) {
+            a->base = g_try_malloc(SCRATCH_SIZE);
+        }
+        if (a->base && SCRATCH_SIZE - a->used >= SCRATCH_HDR + size) {
+            h = (ScratchHeader *)(a->base + a->used);
+            h->prev_used = a->used;
+            h->prev_top = a->top;
+            a->top = a->used + SCRATCH_HDR;
+            a->used = ROUND_UP(a->top + size, SCRATCH_ALIGN);
+            return a->base + a->top;
+        }
+    }
+    p = g_try_malloc(size);
+    if (p) {
+        a->large = g_slist_prepend(a->large, p);
+    }
+    return p;
+}
+
+void *scratch_alloc(size_t size)
+{
+    void *p = scratch_try_alloc(size);
+
+    if (!p && size) {
+        g_error("%s: failed to allocate %zu bytes", __func__, size);
+    }
+    return p;
+}
+
+void *scratch_try_alloc0(size_t size)
+{
+    void *p = scratch_try_alloc(size);
+
+    return p ? memset(p, 0, size) : NULL;
+}
+
+void scratch_free(void *ptr)
+{
+    ScratchArena *a = scratch_arena();
+    char *p = ptr;
+
+    if (!p) {
+        return;
+    }
+    /* A zero sized block may sit right at the end of the arena. */
+    if (a && a->base && p >= a->base && p <= a->base + SCRATCH_SIZE) {
+        if (p == a->base + a->top) {
+            ScratchHeader *h = (ScratchHeader *)(p - SCRATCH_HDR);
+
+            a->used = h->prev_used;
+            a->top = h->prev_top;
+        }
+        return;
+    }
+    if (a) {
+        a->large = g_slist_remove(a->large, p);
+    }
+    g_free(p);
+}
+
+void scratch_reset(TaskState *ts)
+{
+    ScratchArena *a = &ts->scratch;
+
+    a->used = 0;
+    a->top = 0;
+    g_slist_free_full(a->large, g_free);
+    a->large = NULL;
+}
+
+void scratch_destroy(TaskState *ts)
+{
+    scratch_reset(ts);
+    g_free(ts->scratch.base);
+    ts->scratch.base = NULL;
+}
+
 void *lock_user_string(abi_ulong guest_addr)
 {
     ssize_t len = target_strlen(guest_addr);
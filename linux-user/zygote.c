@@ -0,0 +1,563 @@
+/*
+ * Fork server ("zygote") for linux-user
+ *
+ * A QEMU started with "-zygote PATH" and no guest program goes through
+ * the program independent part of startup once (QOM, accelerator and
+ * CPU initialization, code buffer allocation) and then listens on the
+ * unix socket PATH.  A QEMU started with the same option and a guest
+ * program, typically through binfmt_misc with QEMU_ZYGOTE set in the
+ * environment, connects to it and sends its options, working directory,
+ * guest argument vector and environment, passing over its standard file
+ * descriptors and the one for the executable.  The server forks a
+ * helper, which starts a new session, forks the guest process and
+ * reports back first the pid of the guest, then its wait status.  The
+ * client forwards the usual termination and job signals to the guest
+ * and finally exits with the same status.
+ *
+ * The socket is only accessible to, and only serves, the user running
+ * the server.  The request also carries the process state that a real
+ * execve() would have preserved: the umask, resource limits, ignored
+ * and blocked signals.  The guest gets them instead of the server's.
+ *
+ * Only the initialization of the emulator is shared: every program is
+ * loaded and translated from scratch, including its dynamic loader and
+ * C library.
+ *
+ * When no server is listening, or it declines the request because the
+ * binary wants another CPU model, or the client's options (other than
+ * those that only set the guest's argv[0] and environment) or
+ * credentials differ from the server's, the client runs the program
+ * itself.  So does a client whose standard input is a terminal: the
+ * guest has no controlling terminal, hence no job control.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qemu/osdep.h"
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/units.h"
+#include "qemu.h"
+#include "loader.h"
+#include "target_elf.h"
+#include "zygote.h"
+
+#define ZYGOTE_MAGIC    0x7a79676f
+#define ZYGOTE_NR_FDS   4       /* stdin, stdout, stderr, executable */
+#define ZYGOTE_MAX_LEN  (16 * MiB)
+
+typedef struct ZygoteHeader {
+    uint32_t magic;
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t ngroups;
+    uint32_t optlen;
+    /*
+     * length of the supplementary group ids, the options, then the cwd,
+     * exec_path, argv and envp strings that follow
+     */
+    uint32_t len;
+    uint32_t umask;
+    sigset_t ignored;
+    sigset_t blocked;
+    struct rlimit rlim[RLIM_NLIMITS];
+} ZygoteHeader;
+
+enum {
+    ZYGOTE_PID,
+    ZYGOTE_EXIT,
+    ZYGOTE_DECLINE,
+};
+
+typedef struct ZygoteReply {
+    int32_t kind;
+    int32_t value;
+} ZygoteReply;
+
+static const char *zygote_path;
+static pid_t zygote_guest;
+
+void zygote_enable(const char *path)
+{
+    zygote_path = path;
+}
+
+bool zygote_enabled(void)
+{
+    return zygote_path != NULL;
+}
+
+static int zygote_socket(struct sockaddr_un *sa)
+{
+    if (strlen(zygote_path) >= sizeof(sa->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(sa, 0, sizeof(*sa));
+    sa->sun_family = AF_UNIX;
+    pstrcpy(sa->sun_path, sizeof(sa->sun_path), zygote_path);
+    return socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+}
+
+static bool zygote_read(int fd, void *buf, size_t len)
+{
+    while (len) {
+        ssize_t r = read(fd, buf, len);
+
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return false;
+        }
+        buf += r;
+        len -= r;
+    }
+    return true;
+}
+
+static bool zygote_reply(int fd, int kind, int value)
+{
+    ZygoteReply reply = { kind, value };
+
+    return qemu_write_full(fd, &reply, sizeof(reply)) == sizeof(reply);
+}
+
+/* Client side */
+
+static void zygote_forward_signal(int sig)
+{
+    int saved_errno = errno;
+
+    kill(zygote_guest, sig);
+    if (sig == SIGTSTP) {
+        /* Stop along with the guest, so that the shell sees the job stop. */
+        struct sigaction act = { .sa_handler = SIG_DFL }, oact;
+        sigset_t set;
+
+        sigemptyset(&set);
+        sigaddset(&set, SIGTSTP);
+        sigaction(SIGTSTP, &act, &oact);
+        sigprocmask(SIG_UNBLOCK, &set, NULL);
+        raise(SIGTSTP);
+        /* Continued; SIGCONT itself is forwarded by its own handler. */
+        sigaction(SIGTSTP, &oact, NULL);
+    }
+    errno = saved_errno;
+}
+
+/* Record the state that the guest would inherit across execve(). */
+static void zygote_save_state(ZygoteHeader *hdr)
+{
+    struct sigaction oact;
+    int i;
+
+    hdr->umask = umask(0);
+    umask(hdr->umask);
+    sigemptyset(&hdr->ignored);
+    for (i = 1; i < NSIG; i++) {
+        if (sigaction(i, NULL, &oact) == 0 && oact.sa_handler == SIG_IGN) {
+            sigaddset(&hdr->ignored, i);
+        }
+    }
+    sigprocmask(SIG_BLOCK, NULL, &hdr->blocked);
+    for (i = 0; i < RLIM_NLIMITS; i++) {
+        getrlimit(i, &hdr->rlim[i]);
+    }
+}
+
+static bool zygote_send(int sock, const ZygoteHeader *hdr, const int *fds)
+{
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * ZYGOTE_NR_FDS)];
+        struct cmsghdr align;
+    } u = { };
+    struct iovec iov = { (void *)hdr, sizeof(*hdr) };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = u.buf,
+        .msg_controllen = sizeof(u.buf),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * ZYGOTE_NR_FDS);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * ZYGOTE_NR_FDS);
+
+    return sendmsg(sock, &msg, 0) == sizeof(*hdr);
+}
+
+void zygote_run(const char *exec_path, int execfd, char **argv,
+                char **envp, const GString *options)
+{
+    static const int forward[] = {
+        SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGUSR1, SIGUSR2, SIGWINCH,
+        SIGTSTP, SIGCONT,
+    };
+    const int fds[ZYGOTE_NR_FDS] = { 0, 1, 2, execfd };
+    g_autoptr(GString) buf = g_string_new(NULL);
+    g_autofree char *cwd = g_get_current_dir();
+    g_autofree gid_t *groups = NULL;
+    ZygoteHeader hdr = { .magic = ZYGOTE_MAGIC };
+    struct sigaction act = { };
+    struct sockaddr_un sa;
+    ZygoteReply reply;
+    char **p;
+    int sock, i, ngroups;
+
+    if (isatty(STDIN_FILENO)) {
+        return;
+    }
+
+    sock = zygote_socket(&sa);
+    if (sock < 0) {
+        return;
+    }
+    if (connect(sock, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        close(sock);
+        return;
+    }
+
+    ngroups = getgroups(0, NULL);
+    if (ngroups < 0) {
+        close(sock);
+        return;
+    }
+    groups = g_new(gid_t, ngroups);
+    ngroups = getgroups(ngroups, groups);
+    if (ngroups < 0) {
+        close(sock);
+        return;
+    }
+    hdr.ngroups = ngroups;
+    g_string_append_len(buf, (char *)groups, ngroups * sizeof(gid_t));
+    hdr.optlen = options->len;
+    g_string_append_len(buf, options->str, options->len);
+
+    g_string_append_len(buf, cwd, strlen(cwd) + 1);
+    g_string_append_len(buf, exec_path, strlen(exec_path) + 1);
+    for (p = argv; *p; p++, hdr.argc++) {
+        g_string_append_len(buf, *p, strlen(*p) + 1);
+    }
+    for (p = envp; *p; p++, hdr.envc++) {
+        g_string_append_len(buf, *p, strlen(*p) + 1);
+    }
+    hdr.len = buf->len;
+    zygote_save_state(&hdr);
+
+    if (hdr.len > ZYGOTE_MAX_LEN ||
+        !zygote_send(sock, &hdr, fds) ||
+        qemu_write_full(sock, buf->str, buf->len) != buf->len ||
+        !zygote_read(sock, &reply, sizeof(reply)) ||
+        reply.kind != ZYGOTE_PID) {
+        /* Nothing has run yet: do it ourselves. */
+        close(sock);
+        return;
+    }
+
+    zygote_guest = reply.value;
+    act.sa_handler = zygote_forward_signal;
+    act.sa_flags = SA_RESTART;
+    for (i = 0; i < ARRAY_SIZE(forward); i++) {
+        sigaction(forward[i], &act, NULL);
+    }
+
+    if (!zygote_read(sock, &reply, sizeof(reply)) ||
+        reply.kind != ZYGOTE_EXIT) {
+        error_report("zygote: lost connection to %s", zygote_path);
+        exit(EXIT_FAILURE);
+    }
+    if (WIFSIGNALED(reply.value)) {
+        signal(WTERMSIG(reply.value), SIG_DFL);
+        raise(WTERMSIG(reply.value));
+        exit(128 + WTERMSIG(reply.value));
+    }
+    exit(WEXITSTATUS(reply.value));
+}
+
+/* Server side */
+
+static bool zygote_recv(int sock, ZygoteHeader *hdr, int *fds)
+{
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * ZYGOTE_NR_FDS)];
+        struct cmsghdr align;
+    } u;
+    struct iovec iov = { hdr, sizeof(*hdr) };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = u.buf,
+        .msg_controllen = sizeof(u.buf),
+    };
+    struct cmsghdr *cmsg;
+
+    if (recvmsg(sock, &msg, 0) != sizeof(*hdr) ||
+        (msg.msg_flags & MSG_CTRUNC)) {
+        return false;
+    }
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(int) * ZYGOTE_NR_FDS)) {
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * ZYGOTE_NR_FDS);
+    return hdr->magic == ZYGOTE_MAGIC && hdr->len <= ZYGOTE_MAX_LEN &&
+           hdr->argc < hdr->len && hdr->envc < hdr->len &&
+           hdr->ngroups <= hdr->len / sizeof(gid_t) &&
+           hdr->optlen <= hdr->len - hdr->ngroups * sizeof(gid_t);
+}
+
+static int zygote_gid_cmp(const void *a, const void *b)
+{
+    gid_t x = *(const gid_t *)a, y = *(const gid_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Give the helper the client's umask and resource limits.  Fail if
+ * the guest would run with groups other than the client's, or the
+ * limits cannot be applied, e.g. because the client's hard limits are
+ * higher than the server's.
+ */
+static bool zygote_restore_state(const ZygoteHeader *hdr, gid_t *groups,
+                                 gid_t gid)
+{
+    g_autofree gid_t *own = NULL;
+    int n, i;
+
+    n = getgroups(0, NULL);
+    if (gid != getegid() || n != hdr->ngroups) {
+        return false;
+    }
+    own = g_new(gid_t, n);
+    if (getgroups(n, own) != n) {
+        return false;
+    }
+    qsort(own, n, sizeof(gid_t), zygote_gid_cmp);
+    qsort(groups, n, sizeof(gid_t), zygote_gid_cmp);
+    if (memcmp(own, groups, n * sizeof(gid_t))) {
+        return false;
+    }
+
+    for (i = 0; i < RLIM_NLIMITS; i++) {
+        if (setrlimit(i, &hdr->rlim[i]) < 0) {
+            return false;
+        }
+    }
+    umask(hdr->umask);
+    return true;
+}
+
+/* Reset signal handling in the guest process to the client's. */
+static void zygote_restore_signals(const ZygoteHeader *hdr)
+{
+    struct sigaction act = { };
+    int i;
+
+    for (i = 1; i < NSIG; i++) {
+        if (i == SIGKILL || i == SIGSTOP) {
+            continue;
+        }
+        act.sa_handler = sigismember(&hdr->ignored, i) ? SIG_IGN : SIG_DFL;
+        sigaction(i, &act, NULL);
+    }
+    sigprocmask(SIG_SETMASK, &hdr->blocked, NULL);
+}
+
+/* Split @n strings off the request buffer, or return NULL. */
+static char **zygote_strings(char **p, char *end, uint32_t n)
+{
+    char **v = g_new0(char *, n + 1);
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        char *s = *p;
+        char *nul = memchr(s, 0, end - s);
+
+        if (!nul) {
+            g_strfreev(v);
+            return NULL;
+        }
+        v[i] = g_strdup(s);
+        *p = nul + 1;
+    }
+    return v;
+}
+
+/* In the per-request helper: return only in the guest process. */
+static void zygote_handle(int conn, gid_t gid, const char *model,
+                          const GString *options, ZygoteRequest *req)
+{
+    g_autofree char *buf = NULL;
+    g_auto(GStrv) head = NULL;
+    int fds[ZYGOTE_NR_FDS];
+    ZygoteHeader hdr;
+    char *p, *end;
+    int status, i;
+    pid_t pid;
+
+    /*
+     * Keep a guest's kill(0, sig) from reaching the server.  Leave the
+     * server's session as well, so that the guest is never a background
+     * job on its terminal that would be stopped by SIGTTIN or SIGTTOU.
+     */
+    setsid();
+
+    if (!zygote_recv(conn, &hdr, fds)) {
+        _exit(EXIT_FAILURE);
+    }
+    buf = g_malloc(hdr.len);
+    if (!zygote_read(conn, buf, hdr.len)) {
+        _exit(EXIT_FAILURE);
+    }
+    p = buf + hdr.ngroups * sizeof(gid_t);
+    if (hdr.optlen != options->len || memcmp(p, options->str, hdr.optlen)) {
+        zygote_reply(conn, ZYGOTE_DECLINE, 0);
+        _exit(EXIT_SUCCESS);
+    }
+    p += hdr.optlen;
+    end = buf + hdr.len;
+    head = zygote_strings(&p, end, 2);
+    req->argv = head ? zygote_strings(&p, end, hdr.argc) : NULL;
+    req->envp = req->argv ? zygote_strings(&p, end, hdr.envc) : NULL;
+    if (!req->envp || chdir(head[0]) < 0 ||
+        !zygote_restore_state(&hdr, (gid_t *)buf, gid)) {
+        zygote_reply(conn, ZYGOTE_DECLINE, 0);
+        _exit(EXIT_FAILURE);
+    }
+    if (model && strcmp(cpu_get_model(get_elf_eflags(fds[3])), model)) {
+        zygote_reply(conn, ZYGOTE_DECLINE, 0);
+        _exit(EXIT_SUCCESS);
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        /*
+         * With the helper in another process group of the session, the
+         * guest's group is not orphaned and job control stops still work.
+         */
+        setpgid(0, 0);
+        close(conn);
+        zygote_restore_signals(&hdr);
+        for (i = 0; i < 3; i++) {
+            dup2(fds[i], i);
+        }
+        for (i = 0; i < 3; i++) {
+            if (fds[i] > 2) {
+                close(fds[i]);
+            }
+        }
+        req->exec_path = g_strdup(head[1]);
+        req->execfd = fds[3];
+        return;
+    }
+    if (pid < 0) {
+        zygote_reply(conn, ZYGOTE_DECLINE, 0);
+        _exit(EXIT_FAILURE);
+    }
+
+    /* Do not hold the client's pipes open once the guest is gone. */
+    for (i = 0; i < ZYGOTE_NR_FDS; i++) {
+        close(fds[i]);
+    }
+    zygote_reply(conn, ZYGOTE_PID, pid);
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            _exit(EXIT_FAILURE);
+        }
+    }
+    zygote_reply(conn, ZYGOTE_EXIT, status);
+    _exit(EXIT_SUCCESS);
+}
+
+/* Reap the helpers of the requests that have completed. */
+static void zygote_reap(int sig)
+{
+    int saved_errno = errno;
+
+    while (waitpid(-1, NULL, WNOHANG) > 0) {
+        continue;
+    }
+    errno = saved_errno;
+}
+
+void zygote_serve(const char *model, const GString *options,
+                  ZygoteRequest *req)
+{
+    struct sigaction act = {
+        .sa_handler = zygote_reap,
+        .sa_flags = SA_RESTART | SA_NOCLDSTOP,
+    };
+    struct sockaddr_un sa;
+    int sock = zygote_socket(&sa);
+    mode_t old_umask;
+    int ret = -1;
+
+    unlink(zygote_path);
+    if (sock >= 0) {
+        /* Create the socket with mode 0600. */
+        old_umask = umask(0177);
+        ret = bind(sock, (struct sockaddr *)&sa, sizeof(sa));
+        umask(old_umask);
+    }
+    if (ret < 0 || listen(sock, SOMAXCONN) < 0) {
+        error_report("zygote: cannot listen on %s: %s",
+                     zygote_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    sigaction(SIGCHLD, &act, NULL);
+
+    for (;;) {
+        int conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+        pid_t pid;
+
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            error_report("zygote: accept: %s", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 ||
+            cred.uid != geteuid()) {
+            /* The client sees the connection closed and runs the guest. */
+            close(conn);
+            continue;
+        }
+
+        pid = fork();
+        if (pid == 0) {
+            /* The helper waits for its guest itself. */
+            act.sa_handler = SIG_DFL;
+            sigaction(SIGCHLD, &act, NULL);
+            close(sock);
+            zygote_handle(conn, cred.gid, model, options, req);
+            return;
+        }
+        if (pid < 0) {
+            warn_report("zygote: fork: %s", strerror(errno));
+        }
+        close(conn);
+    }
+}
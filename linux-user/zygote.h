@@ -0,0 +1,76 @@
+/*
+ * Fork server ("zygote") for linux-user
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LINUX_USER_ZYGOTE_H
+#define LINUX_USER_ZYGOTE_H
+
+typedef struct ZygoteRequest {
+    char *exec_path;
+    int execfd;
+    char **argv;
+    char **envp;
+} ZygoteRequest;
+
+/**
+ * zygote_enable:
+ * @path: unix socket of the fork server
+ *
+ * Serve guest programs on @path if no program is given on the command
+ * line, otherwise try to have them run by the server listening there.
+ */
+void zygote_enable(const char *path);
+
+/**
+ * zygote_enabled:
+ *
+ * Return true if zygote_enable() has been called.
+ */
+bool zygote_enabled(void);
+
+/**
+ * zygote_run:
+ * @exec_path: full path of the guest program
+ * @execfd: open file descriptor for @exec_path
+ * @argv: the guest argument vector
+ * @envp: the guest environment
+ * @options: the options that the server must have been started with
+ *
+ * Hand the guest program over to the fork server, wait for it to
+ * finish and exit with its status.  Return only if no server is
+ * listening, it declined the request or standard input is a terminal,
+ * in which case the caller runs the program itself.
+ */
+void zygote_run(const char *exec_path, int execfd, char **argv,
+                char **envp, const GString *options);
+
+/**
+ * zygote_serve:
+ * @model: CPU model of the server, or NULL if chosen with -cpu
+ * @options: the options of the server, as passed to zygote_run()
+ * @req: filled in with the program to run
+ *
+ * Listen for requests and fork a process for each of them.  Return
+ * only in such a process, with the client's working directory and
+ * standard file descriptors installed and @req describing the guest
+ * program.  Requests from clients with other @options than the
+ * server's, or for binaries that would select a CPU model other than
+ * @model, are declined and run by the client.
+ */
+void zygote_serve(const char *model, const GString *options,
+                  ZygoteRequest *req);
+
+#endif /* LINUX_USER_ZYGOTE_H */
@@ -272,6 +272,35 @@ void nbd_client_connection_release(NBDClientConnection *conn)
     }
 }
 
+/*
+ * Return true if a connection attempt has succeeded in the background, so
+ * that nbd_co_establish_connection() returns its result without waiting.
+ */
+bool nbd_client_connection_ready(NBDClientConnection *conn)
+{
+    QEMU_LOCK_GUARD(&conn->mutex);
+    return !conn->running && conn->sioc;
+}
+
+/*
+ * Start a connection attempt in the background, unless one is running
+ * already or has succeeded and not been picked up yet.  Its result is
+ * collected later by nbd_co_establish_connection().
+ */
+void nbd_client_connection_start(NBDClientConnection *conn)
+{
+    QemuThread thread;
+
+    QEMU_LOCK_GUARD(&conn->mutex);
+    if (conn->running || conn->sioc) {
+        return;
+    }
+
+    conn->running = true;
+    qemu_thread_create(&thread, "nbd-connect",
+                       connect_thread_func, conn, QEMU_THREAD_DETACHED);
+}
+
 /*
  * Get a new connection in context of @conn:
  *   if the thread is running, wait for completion
@@ -42,6 +42,15 @@
  */
 #define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * MiB / 8)
 
+/*
+ * With zero-copy enabled, read payloads of at least NBD_ZERO_COPY_MIN
+ * bytes are sent with MSG_ZEROCOPY.  Their buffers are kept until the
+ * kernel reports completion; while NBD_ZERO_COPY_MAX_HELD bytes are
+ * waiting for it on a connection, reads are sent as copies.
+ */
+#define NBD_ZERO_COPY_MIN (64 * KiB)
+#define NBD_ZERO_COPY_MAX_HELD (64 * MiB)
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -99,6 +108,7 @@ struct NBDExport {
     Notifier eject_notifier;
 
     bool allocation_depth;
+    bool zero_copy;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
 };
@@ -140,6 +150,11 @@ struct NBDClient {
     CoMutex send_lock;
     Coroutine *send_coroutine;
 
+    /* Read buffers queued with MSG_ZEROCOPY, protected by send_lock */
+    GSList *zero_copy_bufs;
+    uint64_t zero_copy_held;
+    bool zero_copy_disabled;
+
     bool read_yielding; /* protected by lock */
     bool quiescing; /* protected by lock */
 
@@ -1552,6 +1567,34 @@ void nbd_client_get(NBDClient *client)
     qatomic_inc(&client->refcount);
 }
 
+/*
+ * Free the read buffers still queued with MSG_ZEROCOPY.  Shutting down
+ * the socket does not stop the kernel from transmitting from them, so
+ * first wait for the completions of everything that was queued; this is
+ * done while the socket is still open, because closing it throws the
+ * notifications away.  If they cannot be collected, the kernel may still
+ * read the buffers and they are leaked rather than reused.
+ */
+static void nbd_client_zero_copy_drain(NBDClient *client)
+{
+    Error *local_err = NULL;
+
+    if (!client->zero_copy_bufs) {
+        return;
+    }
+
+    if (qio_channel_flush(QIO_CHANNEL(client->sioc), &local_err) < 0) {
+        trace_nbd_client_zero_copy_leak(g_slist_length(client->zero_copy_bufs),
+                                        error_get_pretty(local_err));
+        error_free(local_err);
+        g_slist_free(client->zero_copy_bufs);
+    } else {
+        g_slist_free_full(client->zero_copy_bufs, qemu_vfree);
+    }
+    client->zero_copy_bufs = NULL;
+    client->zero_copy_held = 0;
+}
+
 void nbd_client_put(NBDClient *client)
 {
     assert(qemu_in_main_thread());
@@ -1562,6 +1605,7 @@ void nbd_client_put(NBDClient *client)
          */
         assert(client->closing);
 
+        nbd_client_zero_copy_drain(client);
         object_unref(OBJECT(client->sioc));
         object_unref(OBJECT(client->ioc));
         if (client->tlscreds) {
@@ -1923,6 +1967,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->zero_copy;
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -2040,6 +2085,141 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+/*
+ * Like nbd_co_send_iov(), but the payload in the last element of @iov is
+ * sent with MSG_ZEROCOPY; the caller must keep it alive and unmodified
+ * until nbd_co_zero_copy_hold() takes it over.  The headers live on the
+ * caller's stack and are always copied.
+ *
+ * If the process cannot lock the payload's pages (RLIMIT_MEMLOCK), the
+ * rest of it is sent as a copy and the client gets copies from now on.
+ */
+static int coroutine_fn nbd_co_send_iov_zero_copy(NBDClient *client,
+                                                  struct iovec *iov,
+                                                  unsigned niov, Error **errp)
+{
+    int flags = QIO_CHANNEL_WRITE_FLAG_ZERO_COPY;
+    struct iovec payload = iov[niov - 1];
+    Error *local_err = NULL;
+    ssize_t len;
+    int ret;
+
+    g_assert(qemu_in_coroutine());
+    assert(niov > 1);
+    trace_nbd_co_zero_copy_send(client->exp->name, payload.iov_len);
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    ret = qio_channel_writev_all(client->ioc, iov, niov - 1, errp);
+    while (ret == 0 && payload.iov_len) {
+        len = qio_channel_writev_full(client->ioc, &payload, 1, NULL, 0,
+                                      flags, &local_err);
+        if (len == QIO_CHANNEL_ERR_BLOCK) {
+            qio_channel_yield(client->ioc, G_IO_OUT);
+            continue;
+        }
+        /* error_setg_errno() preserves the errno of the failed sendmsg() */
+        if (len < 0 && flags && errno == ENOBUFS) {
+            trace_nbd_co_zero_copy_nobufs(client->exp->name);
+            error_free(local_err);
+            local_err = NULL;
+            client->zero_copy_disabled = true;
+            flags = 0;
+            continue;
+        }
+        if (len < 0) {
+            error_propagate(errp, local_err);
+            ret = -1;
+            break;
+        }
+        payload.iov_base = (uint8_t *)payload.iov_base + len;
+        payload.iov_len -= len;
+    }
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret < 0 ? -EIO : 0;
+}
+
+/*
+ * Whether a read reply of @len bytes should be sent with MSG_ZEROCOPY.
+ * This needs a plain TCP socket: TLS encrypts into its own buffers and
+ * Unix sockets do not support it, so those clients always get copies.
+ */
+static bool nbd_client_use_zero_copy(NBDClient *client, uint64_t len)
+{
+    return client->exp->zero_copy && !client->zero_copy_disabled &&
+           client->zero_copy_held < NBD_ZERO_COPY_MAX_HELD &&
+           client->mode >= NBD_MODE_STRUCTURED && len >= NBD_ZERO_COPY_MIN &&
+           qio_channel_has_feature(client->ioc,
+                                   QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+}
+
+/*
+ * Take over the data buffer of @req, which has been sent with
+ * MSG_ZEROCOPY, and free the held buffers once the kernel has reported
+ * that it is done with all of them.
+ *
+ * This does not wait for the kernel: the completions that have arrived
+ * are collected here and whenever the request coroutine finds no data to
+ * read.  Until they are in, nbd_client_use_zero_copy() sends copies
+ * once NBD_ZERO_COPY_MAX_HELD bytes are held.
+ *
+ * If @send_failed, part of the buffer may still have been queued before
+ * the error, so it is held all the same; the client then falls back to
+ * copies and the buffers are only freed by nbd_client_zero_copy_drain().
+ */
+static int coroutine_fn nbd_co_zero_copy_hold(NBDClient *client,
+                                              NBDRequestData *req,
+                                              uint64_t len, bool send_failed,
+                                              Error **errp)
+{
+    bool copied;
+    int ret = 0;
+
+    qemu_co_mutex_lock(&client->send_lock);
+    client->zero_copy_bufs = g_slist_prepend(client->zero_copy_bufs,
+                                             req->data);
+    client->zero_copy_held += len;
+    req->data = NULL;
+
+    if (send_failed) {
+        client->zero_copy_disabled = true;
+        goto out;
+    }
+
+    ret = qio_channel_socket_zero_copy_poll(client->sioc, &copied, errp);
+    if (ret < 0) {
+        /*
+         * Completions are missing, so the kernel may still read from
+         * the buffers: keep them until the client is freed and copy
+         * from now on.
+         */
+        client->zero_copy_disabled = true;
+        ret = -EIO;
+        goto out;
+    }
+    if (ret == 1) {
+        if (copied && !client->zero_copy_disabled) {
+            /*
+             * The kernel copied everything anyway, e.g. on loopback;
+             * pinning pages and collecting completions is only overhead.
+             */
+            trace_nbd_co_zero_copy_disabled(client->exp->name);
+            client->zero_copy_disabled = true;
+        }
+        g_slist_free_full(client->zero_copy_bufs, qemu_vfree);
+        client->zero_copy_bufs = NULL;
+        client->zero_copy_held = 0;
+        ret = 0;
+    }
+
+out:
+    qemu_co_mutex_unlock(&client->send_lock);
+    return ret;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t cookie)
 {
@@ -2136,6 +2316,7 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                                                void *data,
                                                uint64_t size,
                                                bool final,
+                                               bool zero_copy,
                                                Error **errp)
 {
     NBDReply hdr;
@@ -2152,6 +2333,9 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                  NBD_REPLY_TYPE_OFFSET_DATA, request);
     stq_be_p(&chunk.offset, offset);
 
+    if (zero_copy) {
+        return nbd_co_send_iov_zero_copy(client, iov, 3, errp);
+    }
     return nbd_co_send_iov(client, iov, 3, errp);
 }
 
@@ -2190,6 +2374,7 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
                                                 uint64_t offset,
                                                 uint8_t *data,
                                                 uint64_t size,
+                                                bool zero_copy,
                                                 Error **errp)
 {
     int ret = 0;
@@ -2239,7 +2424,9 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
                 break;
             }
             ret = nbd_co_send_chunk_read(client, request, offset + progress,
-                                         data + progress, pnum, final, errp);
+                                         data + progress, pnum, final,
+                                         zero_copy &&
+                                         pnum >= NBD_ZERO_COPY_MIN, errp);
         }
 
         if (ret < 0) {
@@ -2834,10 +3021,12 @@ static coroutine_fn int nbd_send_generic_reply(NBDClient *client,
  * Return -errno if sending fails. Other errors are reported directly to the
  * client as an error reply. */
 static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
-                                        uint8_t *data, Error **errp)
+                                        NBDRequestData *req, Error **errp)
 {
     int ret;
     NBDExport *exp = client->exp;
+    uint8_t *data = req->data;
+    bool zero_copy = nbd_client_use_zero_copy(client, request->len);
 
     assert(request->type == NBD_CMD_READ);
     assert(request->len <= NBD_MAX_BUFFER_SIZE);
@@ -2854,8 +3043,9 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
     if (client->mode >= NBD_MODE_STRUCTURED &&
         !(request->flags & NBD_CMD_FLAG_DF) && request->len)
     {
-        return nbd_co_send_sparse_read(client, request, request->from,
-                                       data, request->len, errp);
+        ret = nbd_co_send_sparse_read(client, request, request->from,
+                                      data, request->len, zero_copy, errp);
+        goto out;
     }
 
     ret = blk_co_pread(exp->common.blk, request->from, request->len, data, 0);
@@ -2864,17 +3054,25 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
                                       "reading from file failed", errp);
     }
 
-    if (client->mode >= NBD_MODE_STRUCTURED) {
-        if (request->len) {
-            return nbd_co_send_chunk_read(client, request, request->from, data,
-                                          request->len, true, errp);
-        } else {
-            return nbd_co_send_chunk_done(client, request, errp);
-        }
-    } else {
+    if (client->mode < NBD_MODE_STRUCTURED) {
         return nbd_co_send_simple_reply(client, request, 0,
                                         data, request->len, errp);
+    } else if (!request->len) {
+        return nbd_co_send_chunk_done(client, request, errp);
+    }
+    ret = nbd_co_send_chunk_read(client, request, request->from, data,
+                                 request->len, true, zero_copy, errp);
+
+out:
+    if (zero_copy) {
+        if (ret < 0) {
+            nbd_co_zero_copy_hold(client, req, request->len, true, NULL);
+        } else {
+            ret = nbd_co_zero_copy_hold(client, req, request->len, false,
+                                        errp);
+        }
     }
+    return ret;
 }
 
 /*
@@ -2905,11 +3103,12 @@ static coroutine_fn int nbd_do_cmd_cache(NBDClient *client, NBDRequest *request,
  * client as an error reply. */
 static coroutine_fn int nbd_handle_request(NBDClient *client,
                                            NBDRequest *request,
-                                           uint8_t *data, Error **errp)
+                                           NBDRequestData *req, Error **errp)
 {
     int ret;
     int flags;
     NBDExport *exp = client->exp;
+    uint8_t *data = req->data;
     char *msg;
     size_t i;
 
@@ -2918,7 +3117,7 @@ static coroutine_fn int nbd_handle_request(NBDClient *client,
         return nbd_do_cmd_cache(client, request, errp);
 
     case NBD_CMD_READ:
-        return nbd_do_cmd_read(client, request, data, errp);
+        return nbd_do_cmd_read(client, request, req, errp);
 
     case NBD_CMD_WRITE:
         flags = 0;
@@ -3120,7 +3319,7 @@ static coroutine_fn void nbd_trip(void *opaque)
                                      error_get_pretty(export_err), &local_err);
         error_free(export_err);
     } else {
-        ret = nbd_handle_request(client, &request, req->data, &local_err);
+        ret = nbd_handle_request(client, &request, req, &local_err);
     }
     if (request.contexts && request.contexts != &client->contexts) {
         assert(request.type == NBD_CMD_BLOCK_STATUS);
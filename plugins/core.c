@@ -212,34 +212,53 @@ CPUPluginState *qemu_plugin_create_vcpu_state(void)
     return g_new0(CPUPluginState, 1);
 }
 
+static void plugin_scoreboard_alloc_chunks(struct qemu_plugin_scoreboard *score,
+                                           size_t from, size_t to)
+{
+    for (size_t i = from; i < to; i++) {
+        qatomic_set(&score->chunks[i],
+                    g_malloc0(score->element_size * PLUGIN_SCOREBOARD_CHUNK));
+    }
+}
+
 static void plugin_grow_scoreboards__locked(CPUState *cpu)
 {
-    size_t scoreboard_size = plugin.scoreboard_alloc_size;
-    bool need_realloc = false;
+    size_t chunks = (cpu->cpu_index >> PLUGIN_SCOREBOARD_CHUNK_BITS) + 1;
+    size_t table_size = plugin.scoreboard_table_size;
+    struct qemu_plugin_scoreboard *score;
 
-    if (cpu->cpu_index < scoreboard_size) {
+    if (chunks <= plugin.scoreboard_chunks) {
         return;
     }
 
-    while (cpu->cpu_index >= scoreboard_size) {
-        scoreboard_size *= 2;
-        need_realloc = true;
+    if (chunks <= table_size) {
+        /*
+         * The new chunks are only used by vCPUs that have not run any
+         * code yet, other vCPUs can keep running while we add them.
+         */
+        QLIST_FOREACH(score, &plugin.scoreboards, entry) {
+            plugin_scoreboard_alloc_chunks(score, plugin.scoreboard_chunks,
+                                           chunks);
+        }
+        plugin.scoreboard_chunks = chunks;
+        return;
     }
 
-    if (!need_realloc) {
-        return;
+    while (chunks > table_size) {
+        table_size *= 2;
     }
 
     if (QLIST_EMPTY(&plugin.scoreboards)) {
         /* just update size for future scoreboards */
-        plugin.scoreboard_alloc_size = scoreboard_size;
+        plugin.scoreboard_chunks = chunks;
+        plugin.scoreboard_table_size = table_size;
         return;
     }
 
     /*
      * A scoreboard creation/deletion might be in progress. If a new vcpu is
      * initialized at the same time, we are safe, as the new
-     * plugin.scoreboard_alloc_size was not yet written.
+     * plugin.scoreboard_table_size was not yet written.
      */
     qemu_rec_mutex_unlock(&plugin.lock);
 
@@ -248,15 +267,24 @@ static void plugin_grow_scoreboards__locked(CPUState *cpu)
     /* re-acquire lock */
     qemu_rec_mutex_lock(&plugin.lock);
     /* in case another vcpu is created between unlock and exclusive section. */
-    if (scoreboard_size > plugin.scoreboard_alloc_size) {
-        struct qemu_plugin_scoreboard *score;
+    if (table_size > plugin.scoreboard_table_size) {
         QLIST_FOREACH(score, &plugin.scoreboards, entry) {
-            g_array_set_size(score->data, scoreboard_size);
+            score->chunks = g_renew(char *, score->chunks, table_size);
+            memset(score->chunks + plugin.scoreboard_table_size, 0,
+                   (table_size - plugin.scoreboard_table_size) *
+                   sizeof(char *));
         }
-        plugin.scoreboard_alloc_size = scoreboard_size;
+        plugin.scoreboard_table_size = table_size;
         /* force all tb to be flushed, as scoreboard pointers were changed. */
         tb_flush(cpu);
     }
+    if (chunks > plugin.scoreboard_chunks) {
+        QLIST_FOREACH(score, &plugin.scoreboards, entry) {
+            plugin_scoreboard_alloc_chunks(score, plugin.scoreboard_chunks,
+                                           chunks);
+        }
+        plugin.scoreboard_chunks = chunks;
+    }
     end_exclusive();
 }
 
@@ -266,12 +294,13 @@ static void qemu_plugin_vcpu_init__async(CPUState *cpu, run_on_cpu_data unused)
 
     assert(cpu->cpu_index != UNASSIGNED_CPU_INDEX);
     qemu_rec_mutex_lock(&plugin.lock);
+    /* Entries must exist before other vCPUs can iterate over them. */
+    plugin_grow_scoreboards__locked(cpu);
     plugin.num_vcpus = MAX(plugin.num_vcpus, cpu->cpu_index + 1);
     plugin_cpu_update__locked(&cpu->cpu_index, NULL, NULL);
     success = g_hash_table_insert(plugin.cpu_ht, &cpu->cpu_index,
                                   &cpu->cpu_index);
     g_assert(success);
-    plugin_grow_scoreboards__locked(cpu);
     qemu_rec_mutex_unlock(&plugin.lock);
 
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_INIT);
@@ -283,10 +312,13 @@ void qemu_plugin_vcpu_init_hook(CPUState *cpu)
     async_run_on_cpu(cpu, qemu_plugin_vcpu_init__async, RUN_ON_CPU_NULL);
 }
 
+static void plugin_mem_buffers_flush_vcpu(unsigned int vcpu_index);
+
 void qemu_plugin_vcpu_exit_hook(CPUState *cpu)
 {
     bool success;
 
+    plugin_mem_buffers_flush_vcpu(cpu->cpu_index);
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_EXIT);
 
     assert(cpu->cpu_index != UNASSIGNED_CPU_INDEX);
@@ -465,6 +497,91 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
     dyn_cb->regular = regular_cb;
 }
 
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+static void plugin_mem_buffer_flush(struct qemu_plugin_mem_buffer *buf,
+                                    unsigned int vcpu_index)
+{
+    struct qemu_plugin_mem_buffer_entry *e =
+        qemu_plugin_scoreboard_find(buf->score, vcpu_index);
+    /* An instruction with more accesses than the slack overwrote the last. */
+    size_t n = MIN(e->count, buf->capacity);
+
+    e->count = 0;
+    if (n) {
+        buf->cb(vcpu_index, e->records, n, buf->userdata);
+    }
+}
+
+/* Called from translated code once the buffer reaches its threshold. */
+static void plugin_mem_buffer_flush_cb(unsigned int vcpu_index, void *udata)
+{
+    plugin_mem_buffer_flush(udata, vcpu_index);
+}
+
+static void plugin_mem_buffers_flush_vcpu(unsigned int vcpu_index)
+{
+    struct qemu_plugin_mem_buffer *buf;
+
+    if (QLIST_EMPTY(&plugin.mem_buffers) ||
+        vcpu_index >= plugin.num_vcpus) {
+        return;
+    }
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_FOREACH(buf, &plugin.mem_buffers, entry) {
+        plugin_mem_buffer_flush(buf, vcpu_index);
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+}
+
+static void plugin_mem_buffer_record(struct qemu_plugin_mem_buffer *buf,
+                                     unsigned int vcpu_index, uint64_t vaddr,
+                                     uint64_t pc, qemu_plugin_meminfo_t info)
+{
+    struct qemu_plugin_mem_buffer_entry *e =
+        qemu_plugin_scoreboard_find(buf->score, vcpu_index);
+    struct qemu_plugin_mem_record *rec =
+        &e->records[MIN(e->count, buf->capacity - 1)];
+
+    rec->vaddr = vaddr;
+    rec->pc = pc;
+    rec->info = info;
+    if (++e->count >= buf->n_records) {
+        plugin_mem_buffer_flush(buf, vcpu_index);
+    }
+}
+
+void plugin_register_mem_buffer(GArray **insn_cbs, GArray **arr,
+                                enum qemu_plugin_mem_rw rw,
+                                struct qemu_plugin_mem_buffer *buf,
+                                uint64_t pc)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+    struct qemu_plugin_buffer_cb buffer_cb = { .buf = buf,
+                                               .pc = pc,
+                                               .rw = rw };
+
+    /*
+     * Flush before the instruction if the buffer is full. This cannot
+     * be done right after an access, where the translator may still
+     * have temporaries live across it.
+     */
+    plugin_register_dyn_cond_cb__udata(insn_cbs, plugin_mem_buffer_flush_cb,
+                                       QEMU_PLUGIN_CB_NO_REGS,
+                                       QEMU_PLUGIN_COND_GE,
+                                       qemu_plugin_scoreboard_u64(buf->score),
+                                       buf->n_records, buf);
+    if (arr) {
+        dyn_cb = plugin_get_dyn_cb(arr);
+        dyn_cb->type = PLUGIN_CB_MEM_BUFFER;
+        dyn_cb->buffer = buffer_cb;
+    }
+}
+
 /*
  * Disable CFI checks.
  * The callback function has been loaded from an external library so we do not
@@ -499,6 +616,9 @@ qemu_plugin_vcpu_syscall(CPUState *cpu, int64_t num, uint64_t a1, uint64_t a2,
     struct qemu_plugin_cb *cb, *next;
     enum qemu_plugin_event ev = QEMU_PLUGIN_EV_VCPU_SYSCALL;
 
+    /* Let the plugin see the accesses before the effects of the syscall. */
+    plugin_mem_buffers_flush_vcpu(cpu->cpu_index);
+
     if (!test_bit(ev, cpu->plugin_state->event_mask)) {
         return;
     }
@@ -536,6 +656,7 @@ void qemu_plugin_vcpu_idle_cb(CPUState *cpu)
 {
     /* idle and resume cb may be called before init, ignore in this case */
     if (cpu->cpu_index < plugin.num_vcpus) {
+        plugin_mem_buffers_flush_vcpu(cpu->cpu_index);
         plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_IDLE);
     }
 }
@@ -583,11 +704,8 @@ void exec_inline_op(enum plugin_dyn_cb_type type,
                     struct qemu_plugin_inline_cb *cb,
                     int cpu_index)
 {
-    char *ptr = cb->entry.score->data->data;
-    size_t elem_size = g_array_get_element_size(
-        cb->entry.score->data);
-    size_t offset = cb->entry.offset;
-    uint64_t *val = (uint64_t *)(ptr + offset + cpu_index * elem_size);
+    char *ptr = plugin_scoreboard_entry(cb->entry.score, cpu_index);
+    uint64_t *val = (uint64_t *)(ptr + cb->entry.offset);
 
     switch (type) {
     case PLUGIN_CB_INLINE_ADD_U64:
@@ -628,6 +746,13 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                 exec_inline_op(cb->type, &cb->inline_insn, cpu->cpu_index);
             }
             break;
+        case PLUGIN_CB_MEM_BUFFER:
+            if (rw & cb->buffer.rw) {
+                plugin_mem_buffer_record(cb->buffer.buf, cpu->cpu_index, vaddr,
+                                         cb->buffer.pc,
+                                         make_plugin_meminfo(oi, rw));
+            }
+            break;
         default:
             g_assert_not_reached();
         }
@@ -636,6 +761,9 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
 
 void qemu_plugin_atexit_cb(void)
 {
+    for (int i = 0; i < plugin.num_vcpus; i++) {
+        plugin_mem_buffers_flush_vcpu(i);
+    }
     plugin_cb__udata(QEMU_PLUGIN_EV_ATEXIT);
 }
 
@@ -727,7 +855,9 @@ static void __attribute__((__constructor__)) plugin_init(void)
     plugin.id_ht = g_hash_table_new(g_int64_hash, g_int64_equal);
     plugin.cpu_ht = g_hash_table_new(g_int_hash, g_int_equal);
     QLIST_INIT(&plugin.scoreboards);
-    plugin.scoreboard_alloc_size = 16; /* avoid frequent reallocation */
+    QLIST_INIT(&plugin.mem_buffers);
+    plugin.scoreboard_chunks = 1;
+    plugin.scoreboard_table_size = 64; /* avoid frequent reallocation */
     QTAILQ_INIT(&plugin.ctxs);
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
              QHT_MODE_AUTO_RESIZE);
@@ -743,10 +873,11 @@ struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size)
 {
     struct qemu_plugin_scoreboard *score =
         g_malloc0(sizeof(struct qemu_plugin_scoreboard));
-    score->data = g_array_new(FALSE, TRUE, element_size);
-    g_array_set_size(score->data, plugin.scoreboard_alloc_size);
+    score->element_size = element_size;
 
     qemu_rec_mutex_lock(&plugin.lock);
+    score->chunks = g_new0(char *, plugin.scoreboard_table_size);
+    plugin_scoreboard_alloc_chunks(score, 0, plugin.scoreboard_chunks);
     QLIST_INSERT_HEAD(&plugin.scoreboards, score, entry);
     qemu_rec_mutex_unlock(&plugin.lock);
 
@@ -757,8 +888,50 @@ void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
 {
     qemu_rec_mutex_lock(&plugin.lock);
     QLIST_REMOVE(score, entry);
+    for (size_t i = 0; i < plugin.scoreboard_chunks; i++) {
+        g_free(score->chunks[i]);
+    }
     qemu_rec_mutex_unlock(&plugin.lock);
 
-    g_array_free(score->data, TRUE);
+    g_free(score->chunks);
     g_free(score);
 }
+
+/*
+ * Slack past the flush threshold: enough for the accesses of any one
+ * instruction that is not emulated with helpers, the latter flush as
+ * soon as the threshold is reached.
+ */
+#define PLUGIN_MEM_BUFFER_SLACK 256
+
+struct qemu_plugin_mem_buffer *
+plugin_mem_buffer_new(size_t n_records, qemu_plugin_vcpu_mem_buffer_cb_t cb,
+                      void *userdata)
+{
+    struct qemu_plugin_mem_buffer *buf = g_new0(struct qemu_plugin_mem_buffer,
+                                                1);
+
+    buf->n_records = MAX(n_records, 1);
+    buf->capacity = buf->n_records + PLUGIN_MEM_BUFFER_SLACK;
+    buf->cb = cb;
+    buf->userdata = userdata;
+    buf->score = plugin_scoreboard_new(
+        sizeof(struct qemu_plugin_mem_buffer_entry) +
+        buf->capacity * sizeof(struct qemu_plugin_mem_record));
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_INSERT_HEAD(&plugin.mem_buffers, buf, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    return buf;
+}
+
+void plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buf)
+{
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_REMOVE(buf, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    plugin_scoreboard_free(buf->score);
+    g_free(buf);
+}
@@ -50,6 +50,7 @@
 #include "block/blockjob.h"
 #include "block/dirty-bitmap.h"
 #include "block/qapi.h"
+#include "block/thread-pool.h"
 #include "crypto/init.h"
 #include "trace/control.h"
 #include "qemu/throttle.h"
@@ -86,6 +87,7 @@ enum {
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
+    OPTION_STATS = 278,
 };
 
 typedef enum OutputFormat {
@@ -205,8 +207,9 @@ void help(void)
            "Parameters to convert subcommand:\n"
            "  '--bitmaps' copies all top-level persistent bitmaps to destination\n"
            "  '-m' specifies how many coroutines work in parallel during the convert\n"
-           "       process (defaults to 8)\n"
+           "       process (defaults to 8, at most 64)\n"
            "  '-W' allow to write to the target out of order rather than sequential\n"
+           "  '--stats' prints the throughput of each stage of the convert process\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
            "  'snapshot' is the name of the snapshot to create, apply or delete\n"
@@ -1348,6 +1351,38 @@ static int check_empty_sectors(BlockBackend *blk, int64_t offset,
     return 0;
 }
 
+/*
+ * The last extent whose block status was queried for an image.  Callers
+ * that walk an image in chunks smaller than its extents use it to query
+ * each extent only once instead of once per chunk.
+ */
+typedef struct BlockStatusCache {
+    int64_t offset;
+    int64_t bytes;
+    int status;
+} BlockStatusCache;
+
+static int block_status_cached(BlockStatusCache *c, BlockDriverState *bs,
+                               int64_t offset, int64_t bytes, int64_t *pnum)
+{
+    int ret;
+
+    if (offset >= c->offset && offset < c->offset + c->bytes) {
+        *pnum = MIN(bytes, c->offset + c->bytes - offset);
+        return c->status;
+    }
+
+    ret = bdrv_block_status_above(bs, NULL, offset, bytes, pnum, NULL, NULL);
+    if (ret >= 0) {
+        *c = (BlockStatusCache) {
+            .offset = offset,
+            .bytes  = *pnum,
+            .status = ret,
+        };
+    }
+    return ret;
+}
+
 /*
  * Compares two images. Exit codes:
  *
@@ -1363,6 +1398,7 @@ static int img_compare(int argc, char **argv)
     int64_t total_size1, total_size2;
     uint8_t *buf1 = NULL, *buf2 = NULL;
     int64_t pnum1, pnum2;
+    BlockStatusCache bsc1 = {}, bsc2 = {};
     int allocated1, allocated2;
     int ret = 0; /* return value - 0 Ident, 1 Different, >1 Error */
     bool progress = false, quiet = false, strict = false;
@@ -1511,9 +1547,8 @@ static int img_compare(int argc, char **argv)
     while (offset < total_size) {
         int status1, status2;
 
-        status1 = bdrv_block_status_above(bs1, NULL, offset,
-                                          total_size1 - offset, &pnum1, NULL,
-                                          NULL);
+        status1 = block_status_cached(&bsc1, bs1, offset,
+                                      total_size1 - offset, &pnum1);
         if (status1 < 0) {
             ret = 3;
             error_report("Sector allocation test failed for %s", filename1);
@@ -1521,9 +1556,8 @@ static int img_compare(int argc, char **argv)
         }
         allocated1 = status1 & BDRV_BLOCK_ALLOCATED;
 
-        status2 = bdrv_block_status_above(bs2, NULL, offset,
-                                          total_size2 - offset, &pnum2, NULL,
-                                          NULL);
+        status2 = block_status_cached(&bsc2, bs2, offset,
+                                      total_size2 - offset, &pnum2);
         if (status2 < 0) {
             ret = 3;
             error_report("Sector allocation test failed for %s", filename2);
@@ -1592,21 +1626,23 @@ static int img_compare(int argc, char **argv)
 
     if (total_size1 != total_size2) {
         BlockBackend *blk_over;
+        BlockStatusCache *bsc_over;
         const char *filename_over;
 
         qprintf(quiet, "Warning: Image size mismatch!\n");
         if (total_size1 > total_size2) {
             blk_over = blk1;
+            bsc_over = &bsc1;
             filename_over = filename1;
         } else {
             blk_over = blk2;
+            bsc_over = &bsc2;
             filename_over = filename2;
         }
 
         while (offset < progress_base) {
-            ret = bdrv_block_status_above(blk_bs(blk_over), NULL, offset,
-                                          progress_base - offset, &chunk,
-                                          NULL, NULL);
+            ret = block_status_cached(bsc_over, blk_bs(blk_over), offset,
+                                      progress_base - offset, &chunk);
             if (ret < 0) {
                 ret = 3;
                 error_report("Sector allocation test failed for %s",
@@ -1664,9 +1700,46 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
-#define MAX_COROUTINES 16
+#define MAX_COROUTINES 64
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+/*
+ * Zero detection of buffers at least this large that start with a zero
+ * sector runs in the thread pool; data is usually told apart from zeroes
+ * within the first few bytes, so other buffers are checked inline.
+ */
+#define CONVERT_ZERO_OFFLOAD_SECTORS (256 * KiB / BDRV_SECTOR_SIZE)
+
+enum ImgConvertStage {
+    CONVERT_STAGE_READ,
+    CONVERT_STAGE_ZERO_DETECT,
+    CONVERT_STAGE_WRITE,
+    CONVERT_STAGE__MAX,
+};
+
+static const char *const convert_stage_names[CONVERT_STAGE__MAX] = {
+    [CONVERT_STAGE_READ]        = "read",
+    [CONVERT_STAGE_ZERO_DETECT] = "zero detection",
+    [CONVERT_STAGE_WRITE]       = "write",
+};
+
+typedef struct ImgConvertStageStats {
+    int64_t bytes;
+    int64_t busy_ns;    /* summed over all coroutines */
+} ImgConvertStageStats;
+
+/*
+ * Upper bound on the extents remembered by the counting pass of convert;
+ * block status for the rest of the image is queried again while copying.
+ */
+#define CONVERT_MAX_CACHED_EXTENTS (1 << 20)
+
+typedef struct ImgConvertExtent {
+    int64_t sector_num;
+    int64_t end;
+    enum ImgConvertBlockStatus status;
+} ImgConvertExtent;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1679,6 +1752,9 @@ typedef struct ImgConvertState {
     int64_t wr_offs;
     enum ImgConvertBlockStatus status;
     int64_t sector_next_status;
+    GArray *extents;            /* of ImgConvertExtent, sorted */
+    bool record_extents;
+    guint extent_idx;
     BlockBackend *target;
     bool has_zero_init;
     bool compressed;
@@ -1699,8 +1775,43 @@ typedef struct ImgConvertState {
     int64_t wait_sector_num[MAX_COROUTINES];
     CoMutex lock;
     int ret;
+    ImgConvertStageStats stats[CONVERT_STAGE__MAX];
 } ImgConvertState;
 
+static void convert_stage_done(ImgConvertState *s, enum ImgConvertStage stage,
+                               int64_t start_ns, int64_t bytes)
+{
+    s->stats[stage].bytes += bytes;
+    s->stats[stage].busy_ns += get_clock() - start_ns;
+}
+
+static void convert_print_stats_line(const char *name, int64_t bytes,
+                                     int64_t ns, const char *what)
+{
+    double mib = (double)bytes / MiB;
+    double secs = (double)ns / NANOSECONDS_PER_SECOND;
+
+    printf("%-15s %12.1f MiB in %9.3f s %-5s (%.1f MiB/s)\n",
+           name, mib, secs, what, secs ? mib / secs : 0);
+}
+
+/*
+ * Stage times add up the time spent by every coroutine, so the rate of a
+ * stage is what a single worker achieves; compare it with the overall
+ * rate to see which stage the conversion is waiting for.
+ */
+static void convert_print_stats(ImgConvertState *s, int64_t elapsed_ns)
+{
+    int i;
+
+    for (i = 0; i < CONVERT_STAGE__MAX; i++) {
+        convert_print_stats_line(convert_stage_names[i], s->stats[i].bytes,
+                                 s->stats[i].busy_ns, "busy");
+    }
+    convert_print_stats_line("total", s->total_sectors * BDRV_SECTOR_SIZE,
+                             elapsed_ns, "");
+}
+
 static void convert_select_part(ImgConvertState *s, int64_t sector_num,
                                 int *src_cur, int64_t *src_cur_offset)
 {
@@ -1713,6 +1824,46 @@ static void convert_select_part(ImgConvertState *s, int64_t sector_num,
     }
 }
 
+static void convert_record_extent(ImgConvertState *s, int64_t sector_num)
+{
+    ImgConvertExtent e = {
+        .sector_num = sector_num,
+        .end        = s->sector_next_status,
+        .status     = s->status,
+    };
+
+    if (s->record_extents && s->extents->len < CONVERT_MAX_CACHED_EXTENTS) {
+        g_array_append_val(s->extents, e);
+    }
+}
+
+/*
+ * Look up the block status of @sector_num among the extents found by the
+ * counting pass.  Requests only move forward, so the search resumes where
+ * the last one ended.
+ */
+static bool convert_lookup_extent(ImgConvertState *s, int64_t sector_num)
+{
+    ImgConvertExtent *e;
+
+    if (!s->extents || s->record_extents) {
+        return false;
+    }
+    while (s->extent_idx < s->extents->len) {
+        e = &g_array_index(s->extents, ImgConvertExtent, s->extent_idx);
+        if (e->end > sector_num) {
+            if (e->sector_num > sector_num) {
+                return false;
+            }
+            s->status = e->status;
+            s->sector_next_status = e->end;
+            return true;
+        }
+        s->extent_idx++;
+    }
+    return false;
+}
+
 static int coroutine_mixed_fn GRAPH_RDLOCK
 convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
 {
@@ -1735,7 +1886,8 @@ convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
     }
 
-    if (s->sector_next_status <= sector_num) {
+    if (s->sector_next_status <= sector_num &&
+        !convert_lookup_extent(s, sector_num)) {
         uint64_t offset = (sector_num - src_cur_offset) * BDRV_SECTOR_SIZE;
         int64_t count;
         int tail;
@@ -1798,6 +1950,7 @@ convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
 
         s->sector_next_status = sector_num + n;
+        convert_record_extent(s, sector_num);
     }
 
     n = MIN(n, s->sector_next_status - sector_num);
@@ -1874,6 +2027,60 @@ static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
 }
 
 
+typedef struct ConvertZeroCheck {
+    ImgConvertState *s;
+    const uint8_t *buf;
+    int64_t sector_num;
+    int n;
+    bool allocated;
+} ConvertZeroCheck;
+
+static int convert_zero_check_fn(void *opaque)
+{
+    ConvertZeroCheck *zc = opaque;
+    ImgConvertState *s = zc->s;
+
+    if (s->compressed) {
+        zc->allocated = !buffer_is_zero(zc->buf, zc->n * BDRV_SECTOR_SIZE);
+    } else {
+        zc->allocated = is_allocated_sectors_min(zc->buf, zc->n, &zc->n,
+                                                 s->min_sparse, zc->sector_num,
+                                                 s->alignment);
+    }
+    return 0;
+}
+
+/*
+ * Return true if the first *pnum sectors of @buf must be written as data.
+ * Compressed clusters need to be written as a whole, so in that case the
+ * write can only be saved if the buffer is completely zeroed; otherwise
+ * *pnum is updated to the length of the run that was checked.
+ */
+static bool coroutine_fn convert_co_is_allocated(ImgConvertState *s,
+                                                 int64_t sector_num,
+                                                 const uint8_t *buf, int *pnum)
+{
+    ConvertZeroCheck zc = {
+        .s          = s,
+        .buf        = buf,
+        .sector_num = sector_num,
+        .n          = *pnum,
+    };
+    int64_t start = get_clock();
+
+    if (zc.n >= CONVERT_ZERO_OFFLOAD_SECTORS &&
+        buffer_is_zero(buf, BDRV_SECTOR_SIZE)) {
+        thread_pool_submit_co(convert_zero_check_fn, &zc);
+    } else {
+        convert_zero_check_fn(&zc);
+    }
+    convert_stage_done(s, CONVERT_STAGE_ZERO_DETECT, start,
+                       (int64_t)zc.n * BDRV_SECTOR_SIZE);
+
+    *pnum = zc.n;
+    return zc.allocated;
+}
+
 static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                                          int nb_sectors, uint8_t *buf,
                                          enum ImgConvertBlockStatus status)
@@ -1883,6 +2090,7 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
     while (nb_sectors > 0) {
         int n = nb_sectors;
         BdrvRequestFlags flags = s->compressed ? BDRV_REQ_WRITE_COMPRESSED : 0;
+        int64_t start;
 
         switch (status) {
         case BLK_BACKING_FILE:
@@ -1895,19 +2103,15 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
         case BLK_DATA:
             /* If we're told to keep the target fully allocated (-S 0) or there
              * is real non-zero data, we must write it. Otherwise we can treat
-             * it as zero sectors.
-             * Compressed clusters need to be written as a whole, so in that
-             * case we can only save the write if the buffer is completely
-             * zeroed. */
+             * it as zero sectors. */
             if (!s->min_sparse ||
-                (!s->compressed &&
-                 is_allocated_sectors_min(buf, n, &n, s->min_sparse,
-                                          sector_num, s->alignment)) ||
-                (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
+                convert_co_is_allocated(s, sector_num, buf, &n))
             {
+                start = get_clock();
                 ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
                                     n << BDRV_SECTOR_BITS, buf, flags);
+                convert_stage_done(s, CONVERT_STAGE_WRITE, start,
+                                   (int64_t)n << BDRV_SECTOR_BITS);
                 if (ret < 0) {
                     return ret;
                 }
@@ -1920,10 +2124,13 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                 assert(!s->target_has_backing);
                 break;
             }
+            start = get_clock();
             ret = blk_co_pwrite_zeroes(s->target,
                                        sector_num << BDRV_SECTOR_BITS,
                                        n << BDRV_SECTOR_BITS,
                                        BDRV_REQ_MAY_UNMAP);
+            convert_stage_done(s, CONVERT_STAGE_WRITE, start,
+                               (int64_t)n << BDRV_SECTOR_BITS);
             if (ret < 0) {
                 return ret;
             }
@@ -2026,7 +2233,11 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
 retry:
         copy_range = s->copy_range && s->status == BLK_DATA;
         if (status == BLK_DATA && !copy_range) {
+            int64_t start = get_clock();
+
             ret = convert_co_read(s, sector_num, n, buf);
+            convert_stage_done(s, CONVERT_STAGE_READ, start,
+                               (int64_t)n * BDRV_SECTOR_SIZE);
             if (ret < 0) {
                 error_report("error while reading at byte %lld: %s",
                              sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
@@ -2048,9 +2259,13 @@ retry:
 
         if (s->ret == -EINPROGRESS) {
             if (copy_range) {
+                int64_t start = get_clock();
+
                 WITH_GRAPH_RDLOCK_GUARD() {
                     ret = convert_co_copy_range(s, sector_num, n);
                 }
+                convert_stage_done(s, CONVERT_STAGE_WRITE, start,
+                                   ret ? 0 : (int64_t)n * BDRV_SECTOR_SIZE);
                 if (ret) {
                     s->copy_range = false;
                     goto retry;
@@ -2115,6 +2330,13 @@ static int convert_do_copy(ImgConvertState *s)
         s->buf_sectors = s->cluster_sectors;
     }
 
+    /*
+     * Remember the block status found while counting allocated sectors,
+     * so that the copy does not have to walk backing chains or ask an
+     * NBD server about the same extents a second time.
+     */
+    s->extents = g_array_new(false, false, sizeof(ImgConvertExtent));
+    s->record_extents = true;
     while (sector_num < s->total_sectors) {
         bdrv_graph_rdlock_main_loop();
         n = convert_iteration_sectors(s, sector_num);
@@ -2130,6 +2352,7 @@ static int convert_do_copy(ImgConvertState *s)
     }
 
     /* Do the copy */
+    s->record_extents = false;
     s->sector_next_status = 0;
     s->ret = -EINPROGRESS;
 
@@ -2253,7 +2476,9 @@ static int img_convert(int argc, char **argv)
     bool explict_min_sparse = false;
     bool bitmaps = false;
     bool skip_broken = false;
+    bool print_stats = false;
     int64_t rate_limit = 0;
+    int64_t copy_ns = -1;
 
     ImgConvertState s = (ImgConvertState) {
         /* Need at least 4k of zeros for sparse detection */
@@ -2275,6 +2500,7 @@ static int img_convert(int argc, char **argv)
             {"target-is-zero", no_argument, 0, OPTION_TARGET_IS_ZERO},
             {"bitmaps", no_argument, 0, OPTION_BITMAPS},
             {"skip-broken-bitmaps", no_argument, 0, OPTION_SKIP_BROKEN},
+            {"stats", no_argument, 0, OPTION_STATS},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hf:O:B:CcF:o:l:S:pt:T:qnm:WUr:",
@@ -2409,6 +2635,9 @@ static int img_convert(int argc, char **argv)
         case OPTION_SKIP_BROKEN:
             skip_broken = true;
             break;
+        case OPTION_STATS:
+            print_stats = true;
+            break;
         }
     }
 
@@ -2783,7 +3012,9 @@ static int img_convert(int argc, char **argv)
         set_rate_limit(s.target, rate_limit);
     }
 
+    copy_ns = get_clock();
     ret = convert_do_copy(&s);
+    copy_ns = get_clock() - copy_ns;
 
     /* Now copy the bitmaps */
     if (bitmaps && ret == 0) {
@@ -2795,6 +3026,9 @@ out:
         qemu_progress_print(100, 0);
     }
     qemu_progress_end();
+    if (print_stats && !ret && copy_ns >= 0) {
+        convert_print_stats(&s, copy_ns);
+    }
     qemu_opts_del(opts);
     qemu_opts_free(create_opts);
     qobject_unref(open_opts);
@@ -2807,6 +3041,9 @@ out:
     }
     g_free(s.src_sectors);
     g_free(s.src_alignment);
+    if (s.extents) {
+        g_array_free(s.extents, true);
+    }
 fail_getopt:
     qemu_opts_del(sn_opts);
     g_free(options);
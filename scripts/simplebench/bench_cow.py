@@ -0,0 +1,203 @@
+#!/usr/bin/env python3
+#
+# Benchmark small writes into a fresh qcow2 overlay, which need
+# copy-on-write of the surrounding data from the backing image, for two
+# qemu-img binaries.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import subprocess
+import simplebench
+from results_to_text import results_to_text
+
+
+IMAGE_SIZE = 1024 * 1024 * 1024
+
+# Subcluster size with extended_l2 and 128K clusters
+SUBCLUSTER_SIZE = 4096
+
+# Misalign the writes within their subcluster, so that they need COW even
+# with extended_l2
+WRITE_OFFSET_IN_SUBCLUSTER = 512
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_cow(env['qemu_img'], env['image_name'], case['backing'],
+                     case['cluster_size'], case['extended_l2'])
+
+
+def qemu_img_pipe(*args):
+    '''Run qemu-img and return its output'''
+    subp = subprocess.Popen(list(args),
+                            stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT,
+                            universal_newlines=True)
+    exitcode = subp.wait()
+    if exitcode < 0:
+        sys.stderr.write('qemu-img received signal %i: %s\n'
+                         % (-exitcode, ' '.join(list(args))))
+    return subp.communicate()[0]
+
+
+def bench_cow(qemu_img, image_name, backing, cluster_size, extended_l2):
+    """Benchmark COW on the first write to overlay clusters
+
+    The function creates a raw backing image and a QCOW2 overlay on top of
+    it.  Then it runs 'qemu-img bench' with 4k writes into every other
+    cluster of the overlay, 16 requests in flight.  The writes start 512
+    bytes into the subcluster in the middle of the cluster, so that they
+    are not subcluster-aligned.  Every write allocates a cluster (or
+    subclusters with extended_l2) and copies the head and the tail around
+    it from the backing image.
+
+    With backing='data' the whole backing image contains data.  With
+    backing='head' only the clusters' first half and the subcluster that
+    the write starts in contain data, so the head has to be copied but the
+    tail reads as zeroes and can be written as such.
+
+    qemu_img     -- path to qemu_img executable file
+    image_name   -- QCOW2 image name to create
+    backing      -- 'data' or 'head'
+    cluster_size -- size of the overlay clusters
+    extended_l2  -- whether the overlay uses subclusters
+
+    Returns {'seconds': int} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    if not os.path.isfile(qemu_img):
+        print(f'File not found: {qemu_img}')
+        sys.exit(1)
+
+    image_dir = os.path.dirname(os.path.abspath(image_name))
+    if not os.path.isdir(image_dir):
+        print(f'Path not found: {image_name}')
+        sys.exit(1)
+
+    backing_name = image_name + '.base'
+    step = 2 * cluster_size
+    count = IMAGE_SIZE // step
+    write_offset = cluster_size // 2 + WRITE_OFFSET_IN_SUBCLUSTER
+
+    args_create_base = [qemu_img, 'create', '-f', 'raw', backing_name,
+                        str(IMAGE_SIZE)]
+    if backing == 'data':
+        args_fill_base = [qemu_img, 'bench', '-w', '-n', '-t', 'none',
+                          '-f', 'raw', '--pattern=90',
+                          '-c', str(IMAGE_SIZE // (1024 * 1024)),
+                          '-s', '1M', backing_name]
+    else:
+        args_fill_base = [qemu_img, 'bench', '-w', '-n', '-t', 'none',
+                          '-f', 'raw', '--pattern=90', '-c', str(count),
+                          '-s', str(cluster_size // 2 + SUBCLUSTER_SIZE),
+                          '-S', str(step), backing_name]
+    args_create = [qemu_img, 'create', '-f', 'qcow2', '-F', 'raw', '-b',
+                   os.path.abspath(backing_name), '-o',
+                   f'cluster_size={cluster_size},'
+                   f'extended_l2={"on" if extended_l2 else "off"}',
+                   image_name]
+    args_bench = [qemu_img, 'bench', '-w', '-n', '-t', 'none', '-d', '16',
+                  '-c', str(count), '-s', '4k', '-o', str(write_offset),
+                  '-S', str(step), '-f', 'qcow2', image_name]
+
+    def cleanup():
+        for name in (image_name, backing_name):
+            if os.path.exists(name):
+                os.remove(name)
+
+    try:
+        qemu_img_pipe(*args_create_base)
+        qemu_img_pipe(*args_fill_base)
+        qemu_img_pipe(*args_create)
+    except OSError as e:
+        cleanup()
+        return {'error': 'qemu_img create failed: ' + str(e)}
+
+    try:
+        ret = qemu_img_pipe(*args_bench)
+    except OSError as e:
+        cleanup()
+        return {'error': 'qemu_img bench failed: ' + str(e)}
+
+    cleanup()
+
+    if 'seconds' in ret:
+        ret_list = ret.split()
+        index = ret_list.index('seconds.')
+        return {'seconds': float(ret_list[index-1])}
+    else:
+        return {'error': 'qemu_img bench failed: ' + ret}
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 4:
+        program = os.path.basename(sys.argv[0])
+        print(f'USAGE: {program} <path to qemu-img binary file> '
+              '<path to another qemu-img to compare performance with> '
+              '<full or relative name for QCOW2 image to create>')
+        exit(1)
+
+    # Test-cases are "rows" in benchmark resulting table, 'id' is a caption
+    # for the row, other fields are handled by bench_func.
+    test_cases = [
+        {
+            'id': '<data backing, 64K>',
+            'backing': 'data',
+            'cluster_size': 65536,
+            'extended_l2': False
+        },
+        {
+            'id': '<head backed, 64K>',
+            'backing': 'head',
+            'cluster_size': 65536,
+            'extended_l2': False
+        },
+        {
+            'id': '<data backing, 128K extended_l2>',
+            'backing': 'data',
+            'cluster_size': 131072,
+            'extended_l2': True
+        },
+        {
+            'id': '<head backed, 128K extended_l2>',
+            'backing': 'head',
+            'cluster_size': 131072,
+            'extended_l2': True
+        },
+    ]
+
+    # Test-envs are "columns" in benchmark resulting table, 'id is a caption
+    # for the column, other fields are handled by bench_func.
+    test_envs = [
+        {
+            'id': '<qemu-img binary 1>',
+            'qemu_img': f'{sys.argv[1]}',
+            'image_name': f'{sys.argv[3]}'
+        },
+        {
+            'id': '<qemu-img binary 2>',
+            'qemu_img': f'{sys.argv[2]}',
+            'image_name': f'{sys.argv[3]}'
+        },
+    ]
+
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3,
+                               initial_run=False)
+    print(results_to_text(result))
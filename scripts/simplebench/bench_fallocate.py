@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+#
+# Benchmark discard and write-zeroes requests on a raw image for the
+# threads and io_uring AIO backends of file-posix.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import subprocess
+import time
+import simplebench
+from results_to_text import results_to_text
+
+
+IMAGE_SIZE = 1024 * 1024 * 1024
+REQUEST_SIZE = 64 * 1024
+REQUEST_COUNT = 4096
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_fallocate(env['qemu_io'], env['image_name'], env['aio'],
+                           case['request'])
+
+
+def request_cmd(request, offset):
+    if request == 'discard':
+        return f'discard -q {offset} {REQUEST_SIZE}'
+    unmap = '-u ' if request == 'unmap' else ''
+    return f'aio_write -q -z {unmap}{offset} {REQUEST_SIZE}'
+
+
+def bench_fallocate(qemu_io, image_name, aio, request):
+    """Benchmark requests that file-posix turns into fallocate()
+
+    The function creates a raw image with all of its blocks allocated.
+    Then it runs qemu-io with REQUEST_COUNT requests of REQUEST_SIZE bytes
+    into every other REQUEST_SIZE block:
+
+    'zeroes'  -- 'aio_write -z', all in flight at once; FALLOC_FL_ZERO_RANGE
+    'unmap'   -- 'aio_write -z -u', all in flight at once;
+                 FALLOC_FL_PUNCH_HOLE
+    'discard' -- 'discard', one at a time; FALLOC_FL_PUNCH_HOLE
+
+    qemu_io    -- path to qemu-io executable file
+    image_name -- raw image name to create
+    aio        -- 'threads' or 'io_uring'
+    request    -- 'zeroes', 'unmap' or 'discard'
+
+    Returns {'seconds': int} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    if not os.path.isfile(qemu_io):
+        print(f'File not found: {qemu_io}')
+        sys.exit(1)
+
+    image_dir = os.path.dirname(os.path.abspath(image_name))
+    if not os.path.isdir(image_dir):
+        print(f'Path not found: {image_name}')
+        sys.exit(1)
+
+    args = [qemu_io, '-f', 'raw', '-n', '-i', aio, '-d', 'unmap']
+    for i in range(REQUEST_COUNT):
+        args += ['-c', request_cmd(request, 2 * i * REQUEST_SIZE)]
+    args += ['-c', 'aio_flush', image_name]
+
+    try:
+        fd = os.open(image_name, os.O_RDWR | os.O_CREAT | os.O_TRUNC, 0o644)
+        try:
+            os.posix_fallocate(fd, 0, IMAGE_SIZE)
+        finally:
+            os.close(fd)
+    except OSError as e:
+        return {'error': 'creating the image failed: ' + str(e)}
+
+    start = time.monotonic()
+    subp = subprocess.run(args, stdout=subprocess.PIPE,
+                          stderr=subprocess.STDOUT, universal_newlines=True)
+    seconds = time.monotonic() - start
+
+    os.remove(image_name)
+
+    if subp.returncode != 0 or subp.stdout:
+        return {'error': 'qemu-io failed: ' + subp.stdout}
+    return {'seconds': seconds}
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 3:
+        program = os.path.basename(sys.argv[0])
+        print(f'USAGE: {program} <path to qemu-io binary file> '
+              '<full or relative name for the raw image to create>')
+        exit(1)
+
+    # Test-cases are "rows" in benchmark resulting table, 'id' is a caption
+    # for the row, other fields are handled by bench_func.
+    test_cases = [
+        {
+            'id': '<write-zeroes>',
+            'request': 'zeroes'
+        },
+        {
+            'id': '<write-zeroes, unmap>',
+            'request': 'unmap'
+        },
+        {
+            'id': '<discard>',
+            'request': 'discard'
+        },
+    ]
+
+    # Test-envs are "columns" in benchmark resulting table, 'id is a caption
+    # for the column, other fields are handled by bench_func.
+    test_envs = [
+        {
+            'id': '<aio=threads>',
+            'qemu_io': f'{sys.argv[1]}',
+            'image_name': f'{sys.argv[2]}',
+            'aio': 'threads'
+        },
+        {
+            'id': '<aio=io_uring>',
+            'qemu_io': f'{sys.argv[1]}',
+            'image_name': f'{sys.argv[2]}',
+            'aio': 'io_uring'
+        },
+    ]
+
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3,
+                               initial_run=False)
+    print(results_to_text(result))
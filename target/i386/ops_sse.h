@@ -482,11 +482,43 @@ void glue(helper_pshufhw, SUFFIX)(Reg *d, Reg *s, int order)
         }                                                               \
     }
 
+/* Packed add/sub/mul/div go through softfloat's vectorized helpers. */
+#define SSE_HELPER_P_PACKED(name)                                       \
+    void glue(helper_ ## name ## ps, SUFFIX)(CPUX86State *env,          \
+            Reg *d, Reg *v, Reg *s)                                     \
+    {                                                                   \
+        float32 a[2 << SHIFT], b[2 << SHIFT];                           \
+        int i;                                                          \
+        for (i = 0; i < 2 << SHIFT; i++) {                              \
+            a[i] = v->ZMM_S(i);                                         \
+            b[i] = s->ZMM_S(i);                                         \
+        }                                                               \
+        float32_ ## name ## _packed(a, a, b, 2 << SHIFT,                \
+                                    &env->sse_status);                  \
+        for (i = 0; i < 2 << SHIFT; i++) {                              \
+            d->ZMM_S(i) = a[i];                                         \
+        }                                                               \
+    }                                                                   \
+                                                                        \
+    void glue(helper_ ## name ## pd, SUFFIX)(CPUX86State *env,          \
+            Reg *d, Reg *v, Reg *s)                                     \
+    {                                                                   \
+        float64 a[1 << SHIFT], b[1 << SHIFT];                           \
+        int i;                                                          \
+        for (i = 0; i < 1 << SHIFT; i++) {                              \
+            a[i] = v->ZMM_D(i);                                         \
+            b[i] = s->ZMM_D(i);                                         \
+        }                                                               \
+        float64_ ## name ## _packed(a, a, b, 1 << SHIFT,                \
+                                    &env->sse_status);                  \
+        for (i = 0; i < 1 << SHIFT; i++) {                              \
+            d->ZMM_D(i) = a[i];                                         \
+        }                                                               \
+    }
+
 #if SHIFT == 1
 
-#define SSE_HELPER_S(name, F)                                           \
-    SSE_HELPER_P(name, F)                                               \
-                                                                        \
+#define SSE_HELPER_SS(name, F)                                          \
     void helper_ ## name ## ss(CPUX86State *env, Reg *d, Reg *v, Reg *s)\
     {                                                                   \
         int i;                                                          \
@@ -507,10 +539,14 @@ void glue(helper_pshufhw, SUFFIX)(Reg *d, Reg *s, int order)
 
 #else
 
-#define SSE_HELPER_S(name, F) SSE_HELPER_P(name, F)
+#define SSE_HELPER_SS(name, F)
 
 #endif
 
+#define SSE_HELPER_S(name, F) SSE_HELPER_P(name, F) SSE_HELPER_SS(name, F)
+#define SSE_HELPER_S_PACKED(name, F)                                    \
+    SSE_HELPER_P_PACKED(name) SSE_HELPER_SS(name, F)
+
 #define FPU_ADD(size, a, b) float ## size ## _add(a, b, &env->sse_status)
 #define FPU_SUB(size, a, b) float ## size ## _sub(a, b, &env->sse_status)
 #define FPU_MUL(size, a, b) float ## size ## _mul(a, b, &env->sse_status)
@@ -525,10 +561,10 @@ void glue(helper_pshufhw, SUFFIX)(Reg *d, Reg *s, int order)
 #define FPU_MAX(size, a, b)                                     \
     (float ## size ## _lt(b, a, &env->sse_status) ? (a) : (b))
 
-SSE_HELPER_S(add, FPU_ADD)
-SSE_HELPER_S(sub, FPU_SUB)
-SSE_HELPER_S(mul, FPU_MUL)
-SSE_HELPER_S(div, FPU_DIV)
+SSE_HELPER_S_PACKED(add, FPU_ADD)
+SSE_HELPER_S_PACKED(sub, FPU_SUB)
+SSE_HELPER_S_PACKED(mul, FPU_MUL)
+SSE_HELPER_S_PACKED(div, FPU_DIV)
 SSE_HELPER_S(min, FPU_MIN)
 SSE_HELPER_S(max, FPU_MAX)
 
@@ -2664,6 +2700,8 @@ void helper_sha256msg2(Reg *d, Reg *a, Reg *b)
 #endif
 
 #undef SSE_HELPER_S
+#undef SSE_HELPER_SS
+#undef SSE_HELPER_S_PACKED
 
 #undef LANE_WIDTH
 #undef SHIFT
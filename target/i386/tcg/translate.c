@@ -174,6 +174,12 @@ typedef struct DisasContext {
  */
 #define DISAS_EOB_RECHECK_TF   DISAS_TARGET_4
 
+/*
+ * EIP has already been updated by a near jump, call or return.
+ * Like DISAS_JUMP, but CS and hflags are known to be unchanged.
+ */
+#define DISAS_JUMP_NEAR        DISAS_TARGET_5
+
 /* The environment in which user-only runs is constrained. */
 #ifdef CONFIG_USER_ONLY
 #define PE(S)     true
@@ -2143,6 +2149,19 @@ static void gen_bnd_jmp(DisasContext *s)
     }
 }
 
+/* Jump to the TB for the new EIP, which is in the same code segment.  */
+static void gen_lookup_and_goto_ptr_near(DisasContext *s)
+{
+    TCGv_i64 dest = tcg_temp_new_i64();
+
+    tcg_gen_extu_tl_i64(dest, cpu_eip);
+    if (!CODE64(s)) {
+        tcg_gen_addi_i64(dest, dest, s->cs_base);
+        tcg_gen_ext32u_i64(dest, dest);
+    }
+    translator_lookup_and_goto_ptr(&s->base, dest);
+}
+
 /*
  * Generate an end of block, including common tasks such as generating
  * single step traps, resetting the RF flag, and handling the interrupt
@@ -2172,10 +2191,20 @@ gen_eob(DisasContext *s, int mode)
         tcg_gen_exit_tb(NULL, 0);
     } else if ((s->flags & HF_TF_MASK) && mode != DISAS_EOB_INHIBIT_IRQ) {
         gen_helper_single_step(tcg_env);
-    } else if (mode == DISAS_JUMP &&
+    } else if ((mode == DISAS_JUMP || mode == DISAS_JUMP_NEAR) &&
                /* give irqs a chance to happen */
                !inhibit_reset) {
-        tcg_gen_lookup_and_goto_ptr();
+        /*
+         * Resetting RF changes the TB flags, and so may the MPX
+         * helper called by gen_bnd_jmp().
+         */
+        if (mode == DISAS_JUMP_NEAR &&
+            !(s->base.tb->flags & HF_RF_MASK) &&
+            !(s->flags & HF_MPX_EN_MASK)) {
+            gen_lookup_and_goto_ptr_near(s);
+        } else {
+            tcg_gen_lookup_and_goto_ptr();
+        }
     } else {
         tcg_gen_exit_tb(NULL, 0);
     }
@@ -2234,7 +2263,7 @@ static void gen_jmp_rel(DisasContext *s, MemOp ot, int diff, int tb_num)
             tcg_gen_movi_tl(cpu_eip, new_eip);
         }
         if (s->jmp_opt) {
-            gen_eob(s, DISAS_JUMP);   /* jump to another page */
+            gen_eob(s, DISAS_JUMP_NEAR);   /* jump to another page */
         } else {
             gen_eob(s, DISAS_EOB_ONLY);  /* exit to main loop */
         }
@@ -4069,6 +4098,7 @@ static void i386_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
     case DISAS_EOB_ONLY:
     case DISAS_EOB_RECHECK_TF:
     case DISAS_JUMP:
+    case DISAS_JUMP_NEAR:
         gen_eob(dc, dc->base.is_jmp);
         break;
     default:
@@ -26,6 +26,7 @@
 #include "qemu/osdep.h"
 #include "qemu/int128.h"
 #include "qemu/interval-tree.h"
+#include "qemu/log.h"
 #include "tcg/tcg-op-common.h"
 #include "tcg-internal.h"
 
@@ -43,6 +44,7 @@ typedef struct MemCopyInfo {
     QSIMPLEQ_ENTRY (MemCopyInfo) next;
     TCGTemp *ts;
     TCGType type;
+    TCGOpcode ld_opc;  /* load that reproduces ts, ld_{i32,i64,vec} if full */
 } MemCopyInfo;
 
 typedef struct TempOptInfo {
@@ -53,8 +55,36 @@ typedef struct TempOptInfo {
     uint64_t val;
     uint64_t z_mask;  /* mask bit is 0 if and only if value bit is 0 */
     uint64_t s_mask;  /* a left-aligned mask of clrsb(value) bits. */
+    uint32_t gen;     /* incremented whenever the temp is redefined */
 } TempOptInfo;
 
+/*
+ * Pure operations already computed in the current extended basic block,
+ * indexed by a hash of opcode and inputs.  Inputs are identified by temp
+ * and generation, so an entry goes stale as soon as an input or the
+ * output is redefined.  Collisions simply replace the older entry.
+ */
+#define CSE_MAX_ARGS     6
+#define CSE_TABLE_SIZE   128
+
+typedef struct CSEEntry {
+    uint32_t epoch;
+    TCGOpcode opc;
+    TCGArg args[CSE_MAX_ARGS];
+    uint32_t gens[CSE_MAX_ARGS];
+    TCGTemp *out;
+    uint32_t out_gen;
+} CSEEntry;
+
+/* Stores to env not yet known to be read, for dead store elimination. */
+#define MAX_PENDING_STORES 16
+
+typedef struct PendingStore {
+    TCGOp *op;
+    intptr_t start;
+    intptr_t last;
+} PendingStore;
+
 typedef struct OptContext {
     TCGContext *tcg;
     TCGOp *prev_mb;
@@ -63,6 +93,13 @@ typedef struct OptContext {
     IntervalTreeRoot mem_copy;
     QSIMPLEQ_HEAD(, MemCopyInfo) mem_free;
 
+    /* Redundancy elimination, unless disabled with -d nocse. */
+    bool cse;
+    uint32_t cse_epoch;
+    CSEEntry *cse_table;
+    int nb_pending_st;
+    PendingStore pending_st[MAX_PENDING_STORES];
+
     /* In flight values from optimization. */
     uint64_t a_mask;  /* mask bit is 0 iff value identical to first input */
     uint64_t z_mask;  /* mask bit is 0 iff value bit is 0 */
@@ -164,9 +201,11 @@ static void init_ts_info(OptContext *ctx, TCGTemp *ts)
     ti = ts->state_ptr;
     if (ti == NULL) {
         ti = tcg_malloc(sizeof(TempOptInfo));
+        ti->gen = 0;
         ts->state_ptr = ti;
     }
 
+    ti->gen++;
     ti->next_copy = ts;
     ti->prev_copy = ts;
     QSIMPLEQ_INIT(&ti->mem_copy);
@@ -266,6 +305,7 @@ static void reset_ts(OptContext *ctx, TCGTemp *ts)
     ti->is_const = false;
     ti->z_mask = -1;
     ti->s_mask = 0;
+    ti->gen++;
 
     if (!QSIMPLEQ_EMPTY(&ti->mem_copy)) {
         if (ts == nts) {
@@ -286,7 +326,7 @@ static void reset_temp(OptContext *ctx, TCGArg arg)
     reset_ts(ctx, arg_temp(arg));
 }
 
-static void record_mem_copy(OptContext *ctx, TCGType type,
+static void record_mem_copy(OptContext *ctx, TCGType type, TCGOpcode ld_opc,
                             TCGTemp *ts, intptr_t start, intptr_t last)
 {
     MemCopyInfo *mc;
@@ -303,6 +343,7 @@ static void record_mem_copy(OptContext *ctx, TCGType type,
     mc->itree.start = start;
     mc->itree.last = last;
     mc->type = type;
+    mc->ld_opc = ld_opc;
     interval_tree_insert(&mc->itree, &ctx->mem_copy);
 
     ts = find_better_copy(ts);
@@ -337,18 +378,72 @@ static bool args_are_copies(TCGArg arg1, TCGArg arg2)
     return ts_are_copies(arg_temp(arg1), arg_temp(arg2));
 }
 
-static TCGTemp *find_mem_copy_for(OptContext *ctx, TCGType type, intptr_t s)
+static TCGTemp *find_mem_copy_for(OptContext *ctx, TCGType type,
+                                  TCGOpcode ld_opc, intptr_t s)
 {
     MemCopyInfo *mc;
 
     for (mc = mem_copy_first(ctx, s, s); mc; mc = mem_copy_next(mc, s, s)) {
-        if (mc->itree.start == s && mc->type == type) {
+        if (mc->itree.start == s && mc->type == type &&
+            mc->ld_opc == ld_opc) {
             return find_better_copy(mc->ts);
         }
     }
     return NULL;
 }
 
+static void pending_st_reset(OptContext *ctx)
+{
+    ctx->nb_pending_st = 0;
+}
+
+/* Forget the pending stores that may be read by a load of [START, LAST]. */
+static void pending_st_read(OptContext *ctx, intptr_t start, intptr_t last)
+{
+    int i, j;
+
+    for (i = j = 0; i < ctx->nb_pending_st; i++) {
+        PendingStore *ps = &ctx->pending_st[i];
+        if (ps->last < start || ps->start > last) {
+            ctx->pending_st[j++] = *ps;
+        }
+    }
+    ctx->nb_pending_st = j;
+}
+
+/*
+ * Record the store OP to [START, LAST], removing any pending store
+ * that it completely overwrites.
+ */
+static void pending_st_write(OptContext *ctx, TCGOp *op,
+                             intptr_t start, intptr_t last)
+{
+    int i, j;
+
+    if (!ctx->cse) {
+        return;
+    }
+
+    for (i = j = 0; i < ctx->nb_pending_st; i++) {
+        PendingStore *ps = &ctx->pending_st[i];
+        if (ps->start >= start && ps->last <= last) {
+            tcg_op_remove(ctx->tcg, ps->op);
+        } else {
+            ctx->pending_st[j++] = *ps;
+        }
+    }
+
+    /* If full, give up on the oldest store. */
+    if (j == MAX_PENDING_STORES) {
+        memmove(&ctx->pending_st[0], &ctx->pending_st[1],
+                --j * sizeof(PendingStore));
+    }
+    ctx->pending_st[j].op = op;
+    ctx->pending_st[j].start = start;
+    ctx->pending_st[j].last = last;
+    ctx->nb_pending_st = j + 1;
+}
+
 static TCGArg arg_new_constant(OptContext *ctx, uint64_t val)
 {
     TCGType type = ctx->type;
@@ -978,6 +1073,7 @@ static void finish_folding(OptContext *ctx, TCGOp *op)
         if (!(def->flags & TCG_OPF_COND_BRANCH)) {
             memset(&ctx->temps_used, 0, sizeof(ctx->temps_used));
             remove_mem_copy_all(ctx);
+            ctx->cse_epoch++;
         }
         return;
     }
@@ -1530,6 +1626,9 @@ static bool fold_call(OptContext *ctx, TCGOp *op)
         remove_mem_copy_all(ctx);
     }
 
+    /* Any helper may read env, or raise an exception that does. */
+    pending_st_reset(ctx);
+
     /* Reset temp data for outputs. */
     for (i = 0; i < nb_oargs; i++) {
         reset_temp(ctx, op->args[i]);
@@ -2567,55 +2666,90 @@ static bool fold_sub2(OptContext *ctx, TCGOp *op)
 
 static bool fold_tcg_ld(OptContext *ctx, TCGOp *op)
 {
-    /* We can't do any folding with a load, but we can record bits. */
+    TCGTemp *dst, *src;
+    intptr_t ofs, lm1;
+
+    /* Record bits of the extended value. */
     switch (op->opc) {
     CASE_OP_32_64(ld8s):
         ctx->s_mask = MAKE_64BIT_MASK(8, 56);
+        lm1 = 0;
         break;
     CASE_OP_32_64(ld8u):
         ctx->z_mask = MAKE_64BIT_MASK(0, 8);
         ctx->s_mask = MAKE_64BIT_MASK(9, 55);
+        lm1 = 0;
         break;
     CASE_OP_32_64(ld16s):
         ctx->s_mask = MAKE_64BIT_MASK(16, 48);
+        lm1 = 1;
         break;
     CASE_OP_32_64(ld16u):
         ctx->z_mask = MAKE_64BIT_MASK(0, 16);
         ctx->s_mask = MAKE_64BIT_MASK(17, 47);
+        lm1 = 1;
         break;
     case INDEX_op_ld32s_i64:
         ctx->s_mask = MAKE_64BIT_MASK(32, 32);
+        lm1 = 3;
         break;
     case INDEX_op_ld32u_i64:
         ctx->z_mask = MAKE_64BIT_MASK(0, 32);
         ctx->s_mask = MAKE_64BIT_MASK(33, 31);
+        lm1 = 3;
         break;
     default:
         g_assert_not_reached();
     }
-    return false;
+
+    if (op->args[1] != tcgv_ptr_arg(tcg_env)) {
+        pending_st_reset(ctx);
+        return false;
+    }
+    if (!ctx->cse) {
+        return false;
+    }
+
+    /*
+     * A previous extending load of the same field, with no store in
+     * between, produced the same value.
+     */
+    ofs = op->args[2];
+    src = find_mem_copy_for(ctx, ctx->type, op->opc, ofs);
+    if (src && src->base_type == ctx->type) {
+        return tcg_opt_gen_mov(ctx, op, op->args[0], temp_arg(src));
+    }
+
+    pending_st_read(ctx, ofs, ofs + lm1);
+    finish_folding(ctx, op);
+    dst = arg_temp(op->args[0]);
+    record_mem_copy(ctx, ctx->type, op->opc, dst, ofs, ofs + lm1);
+    return true;
 }
 
 static bool fold_tcg_ld_memcopy(OptContext *ctx, TCGOp *op)
 {
     TCGTemp *dst, *src;
-    intptr_t ofs;
+    intptr_t ofs, last;
     TCGType type;
 
     if (op->args[1] != tcgv_ptr_arg(tcg_env)) {
+        pending_st_reset(ctx);
         return false;
     }
 
     type = ctx->type;
     ofs = op->args[2];
+    last = ofs + tcg_type_size(type) - 1;
     dst = arg_temp(op->args[0]);
-    src = find_mem_copy_for(ctx, type, ofs);
+    src = find_mem_copy_for(ctx, type, op->opc, ofs);
     if (src && src->base_type == type) {
         return tcg_opt_gen_mov(ctx, op, temp_arg(dst), temp_arg(src));
     }
 
+    pending_st_read(ctx, ofs, last);
     reset_ts(ctx, dst);
-    record_mem_copy(ctx, type, dst, ofs, ofs + tcg_type_size(type) - 1);
+    record_mem_copy(ctx, type, op->opc, dst, ofs, last);
     return true;
 }
 
@@ -2650,6 +2784,7 @@ static bool fold_tcg_st(OptContext *ctx, TCGOp *op)
         g_assert_not_reached();
     }
     remove_mem_copy_in(ctx, ofs, ofs + lm1);
+    pending_st_write(ctx, op, ofs, ofs + lm1);
     return false;
 }
 
@@ -2657,6 +2792,7 @@ static bool fold_tcg_st_memcopy(OptContext *ctx, TCGOp *op)
 {
     TCGTemp *src;
     intptr_t ofs, last;
+    TCGOpcode ld_opc;
     TCGType type;
 
     if (op->args[1] != tcgv_ptr_arg(tcg_env)) {
@@ -2668,12 +2804,26 @@ static bool fold_tcg_st_memcopy(OptContext *ctx, TCGOp *op)
     ofs = op->args[2];
     type = ctx->type;
 
+    switch (op->opc) {
+    case INDEX_op_st_i32:
+        ld_opc = INDEX_op_ld_i32;
+        break;
+    case INDEX_op_st_i64:
+        ld_opc = INDEX_op_ld_i64;
+        break;
+    case INDEX_op_st_vec:
+        ld_opc = INDEX_op_ld_vec;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
     /*
      * Eliminate duplicate stores of a constant.
      * This happens frequently when the target ISA zero-extends.
      */
     if (ts_is_const(src)) {
-        TCGTemp *prev = find_mem_copy_for(ctx, type, ofs);
+        TCGTemp *prev = find_mem_copy_for(ctx, type, ld_opc, ofs);
         if (src == prev) {
             tcg_op_remove(ctx->tcg, op);
             return true;
@@ -2682,7 +2832,8 @@ static bool fold_tcg_st_memcopy(OptContext *ctx, TCGOp *op)
 
     last = ofs + tcg_type_size(type) - 1;
     remove_mem_copy_in(ctx, ofs, last);
-    record_mem_copy(ctx, type, src, ofs, last);
+    record_mem_copy(ctx, type, ld_opc, src, ofs, last);
+    pending_st_write(ctx, op, ofs, last);
     return false;
 }
 
@@ -2702,12 +2853,110 @@ static bool fold_xor(OptContext *ctx, TCGOp *op)
     return fold_masks(ctx, op);
 }
 
+/*
+ * Fill in the key of a common subexpression for OP, i.e. its opcode,
+ * its inputs and the generation of each, and its constant arguments.
+ * Return false if OP is not a pure operation with a single output.
+ */
+static bool cse_key(TCGOp *op, CSEEntry *key)
+{
+    const TCGOpDef *def = &tcg_op_defs[op->opc];
+    int nb_oargs = def->nb_oargs;
+    int nb_iargs = def->nb_iargs;
+    int nb_args = nb_iargs + def->nb_cargs;
+
+    if (nb_oargs != 1 || nb_args > CSE_MAX_ARGS ||
+        (def->flags & (TCG_OPF_BB_END | TCG_OPF_SIDE_EFFECTS |
+                       TCG_OPF_CALL_CLOBBER | TCG_OPF_NOT_PRESENT |
+                       TCG_OPF_VECTOR))) {
+        return false;
+    }
+
+    switch (op->opc) {
+    CASE_OP_32_64(ld8s):
+    CASE_OP_32_64(ld8u):
+    CASE_OP_32_64(ld16s):
+    CASE_OP_32_64(ld16u):
+    case INDEX_op_ld32s_i64:
+    case INDEX_op_ld32u_i64:
+    CASE_OP_32_64(ld):
+    CASE_OP_32_64(mov):
+        return false;
+    default:
+        break;
+    }
+
+    memset(key, 0, sizeof(*key));
+    key->opc = op->opc;
+    for (int i = 0; i < nb_args; i++) {
+        TCGArg arg = op->args[nb_oargs + i];
+
+        key->args[i] = arg;
+        if (i < nb_iargs) {
+            key->gens[i] = arg_info(arg)->gen;
+        }
+    }
+    return true;
+}
+
+static unsigned cse_hash(const CSEEntry *key)
+{
+    uint64_t h = key->opc;
+
+    for (int i = 0; i < CSE_MAX_ARGS; i++) {
+        h = (h ^ key->args[i] ^ key->gens[i]) * 0x9e3779b97f4a7c15ull;
+    }
+    return (h >> 32) & (CSE_TABLE_SIZE - 1);
+}
+
+/*
+ * Replace OP with a copy of an identical operation computed earlier in
+ * the extended basic block, or remember it for later.  The latter must
+ * be done after the output has been reset by finish_folding, so that
+ * the recorded generation is the one of the new value.
+ */
+static bool fold_cse(OptContext *ctx, TCGOp *op)
+{
+    CSEEntry key, *e;
+    TCGTemp *out;
+
+    if (!ctx->cse || !cse_key(op, &key)) {
+        return false;
+    }
+
+    if (!ctx->cse_table) {
+        ctx->cse_table = tcg_malloc(CSE_TABLE_SIZE * sizeof(CSEEntry));
+        memset(ctx->cse_table, 0, CSE_TABLE_SIZE * sizeof(CSEEntry));
+    }
+
+    e = &ctx->cse_table[cse_hash(&key)];
+    if (e->epoch == ctx->cse_epoch &&
+        e->opc == key.opc &&
+        !memcmp(e->args, key.args, sizeof(key.args)) &&
+        !memcmp(e->gens, key.gens, sizeof(key.gens)) &&
+        ts_info(e->out)->gen == e->out_gen) {
+        return tcg_opt_gen_mov(ctx, op, op->args[0], temp_arg(e->out));
+    }
+
+    finish_folding(ctx, op);
+    out = arg_temp(op->args[0]);
+    *e = key;
+    e->epoch = ctx->cse_epoch;
+    e->out = out;
+    e->out_gen = ts_info(out)->gen;
+    return true;
+}
+
 /* Propagate constants and copies, fold constant expressions. */
 void tcg_optimize(TCGContext *s)
 {
     int nb_temps, i;
     TCGOp *op, *op_next;
-    OptContext ctx = { .tcg = s };
+    OptContext ctx = {
+        .tcg = s,
+        .cse = !qemu_loglevel_mask(CPU_LOG_TB_NOCSE),
+        .cse_epoch = 1,
+    };
 
     QSIMPLEQ_INIT(&ctx.mem_free);
 
@@ -2736,6 +2985,16 @@ void tcg_optimize(TCGContext *s)
         init_arguments(&ctx, op, def->nb_oargs + def->nb_iargs);
         copy_propagate(&ctx, op, def->nb_oargs, def->nb_iargs);
 
+        /*
+         * Stores to env must be complete before leaving the block, and
+         * before anything that may raise an exception.  dupm_vec may
+         * also load from env.
+         */
+        if ((def->flags & (TCG_OPF_BB_END | TCG_OPF_SIDE_EFFECTS)) ||
+            opc == INDEX_op_dupm_vec) {
+            pending_st_reset(&ctx);
+        }
+
         /* Pre-compute the type of the operation. */
         if (def->flags & TCG_OPF_VECTOR) {
             ctx.type = TCG_TYPE_V64 + TCGOP_VECL(op);
@@ -2942,6 +3201,9 @@ void tcg_optimize(TCGContext *s)
             break;
         }
 
+        if (!done) {
+            done = fold_cse(&ctx, op);
+        }
         if (!done) {
             finish_folding(&ctx, op);
         }
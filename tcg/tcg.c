@@ -6090,7 +6090,7 @@ static void tcg_out_st_helper_args(TCGContext *s, const TCGLabelQemuLdst *ldst,
 
 int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
 {
-    int i, start_words, num_insns;
+    int i, start_words, num_insns, nb_ops_unopt;
     TCGOp *op;
 
     if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP)
@@ -6121,6 +6121,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
     }
 #endif
 
+    nb_ops_unopt = s->nb_ops;
     tcg_optimize(s);
 
     reachable_code_pass(s);
@@ -6152,7 +6153,8 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
         if (logfile) {
             fprintf(logfile, "OP after optimization and liveness analysis:\n");
             tcg_dump_ops(s, logfile, true);
-            fprintf(logfile, "\n");
+            fprintf(logfile, " -- %d ops before optimization, %d after\n\n",
+                    nb_ops_unopt, s->nb_ops);
             qemu_log_unlock(logfile);
         }
     }
@@ -113,6 +113,7 @@ struct op_desc {
 };
 
 #define DEFAULT_DURATION_SECS 1
+#define MAX_VECTOR_LEN 64
 
 static uint64_t random_ops[MAX_OPERANDS] = {
     SEED_A, SEED_B, SEED_C,
@@ -126,6 +127,8 @@ static enum precision precision;
 static enum op operation;
 static enum tester tester;
 static uint64_t n_completed_ops;
+/* if non-zero, benchmark the packed operations on vectors of this length */
+static int vector_len;
 static unsigned int duration = DEFAULT_DURATION_SECS;
 static int64_t ns_elapsed;
 /* disable optimizations with volatile */
@@ -423,6 +426,89 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
     }
 }
 
+/* Benchmark the packed operations used by the targets' SIMD helpers. */
+static void bench_packed(enum precision prec, enum op op)
+{
+    int64_t tf = get_clock() + duration * 1000000000LL;
+
+    while (get_clock() < tf) {
+        union {
+            float32 f32[MAX_VECTOR_LEN];
+            float64 f64[MAX_VECTOR_LEN];
+        } a, b, d;
+        union fp ops[2];
+        int64_t t0;
+        int i, n_iter = OPS_PER_ITER / vector_len;
+
+        for (i = 0; i < vector_len; i++) {
+            update_random_ops(2, prec);
+            fill_random(ops, 2, prec, false);
+            if (prec == PREC_FLOAT32) {
+                a.f32[i] = ops[0].f32;
+                b.f32[i] = ops[1].f32;
+            } else {
+                a.f64[i] = ops[0].f64;
+                b.f64[i] = ops[1].f64;
+            }
+        }
+        t0 = get_clock();
+        for (i = 0; i < n_iter; i++) {
+            switch (prec) {
+            case PREC_FLOAT32:
+                switch (op) {
+                case OP_ADD:
+                    float32_add_packed(d.f32, a.f32, b.f32, vector_len,
+                                       &soft_status);
+                    break;
+                case OP_SUB:
+                    float32_sub_packed(d.f32, a.f32, b.f32, vector_len,
+                                       &soft_status);
+                    break;
+                case OP_MUL:
+                    float32_mul_packed(d.f32, a.f32, b.f32, vector_len,
+                                       &soft_status);
+                    break;
+                case OP_DIV:
+                    float32_div_packed(d.f32, a.f32, b.f32, vector_len,
+                                       &soft_status);
+                    break;
+                default:
+                    g_assert_not_reached();
+                }
+                res.f32 = d.f32[0];
+                break;
+            case PREC_FLOAT64:
+                switch (op) {
+                case OP_ADD:
+                    float64_add_packed(d.f64, a.f64, b.f64, vector_len,
+                                       &soft_status);
+                    break;
+                case OP_SUB:
+                    float64_sub_packed(d.f64, a.f64, b.f64, vector_len,
+                                       &soft_status);
+                    break;
+                case OP_MUL:
+                    float64_mul_packed(d.f64, a.f64, b.f64, vector_len,
+                                       &soft_status);
+                    break;
+                case OP_DIV:
+                    float64_div_packed(d.f64, a.f64, b.f64, vector_len,
+                                       &soft_status);
+                    break;
+                default:
+                    g_assert_not_reached();
+                }
+                res.f64 = d.f64[0];
+                break;
+            default:
+                g_assert_not_reached();
+            }
+        }
+        ns_elapsed += get_clock() - t0;
+        n_completed_ops += n_iter * vector_len;
+    }
+}
+
 #define GEN_BENCH(name, type, prec, op, n_ops)          \
     static void __attribute__((flatten)) name(void)     \
     {                                                   \
@@ -488,6 +574,10 @@ static void run_bench(void)
 {
     bench_func_t f;
 
+    if (vector_len) {
+        bench_packed(precision, operation);
+        return;
+    }
     f = bench_funcs[operation][precision];
     g_assert(f);
     f();
@@ -524,6 +614,9 @@ static void usage_complete(int argc, char *argv[])
             "Default: even\n");
     fprintf(stderr, " -t = tester (%s). Default: %s\n",
             tester_list, tester_names[0]);
+    fprintf(stderr, " -v = vector length, to benchmark packed operations "
+            "(soft tester, add/sub/mul/div and single/double only). "
+            "Default: 0 (scalar)\n");
     fprintf(stderr, " -z = flush inputs to zero (soft tester only). "
             "Default: disabled\n");
     fprintf(stderr, " -Z = flush output to zero (soft tester only). "
@@ -615,7 +708,7 @@ static void parse_args(int argc, char *argv[])
     int rounding = ROUND_EVEN;
 
     for (;;) {
-        c = getopt(argc, argv, "d:ho:p:r:t:zZ");
+        c = getopt(argc, argv, "d:ho:p:r:t:v:zZ");
         if (c < 0) {
             break;
         }
@@ -661,6 +754,14 @@ static void parse_args(int argc, char *argv[])
             }
             tester = val;
             break;
+        case 'v':
+            val = atoi(optarg);
+            if (val < 0 || val > MAX_VECTOR_LEN) {
+                fprintf(stderr, "Unsupported vector length '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            vector_len = val;
+            break;
         case 'z':
             soft_status.flush_inputs_to_zero = 1;
             break;
@@ -670,6 +771,14 @@ static void parse_args(int argc, char *argv[])
         }
     }
 
+    if (vector_len && (tester != TESTER_SOFT || operation > OP_DIV ||
+                       precision == PREC_QUAD)) {
+        fprintf(stderr, "fatal: packed operations are only available with "
+                "the soft tester, for add/sub/mul/div in single and double "
+                "precision\n");
+        exit(EXIT_FAILURE);
+    }
+
     /* set precision and rounding mode based on the tester */
     switch (tester) {
     case TESTER_HOST:
@@ -0,0 +1,151 @@
+/*
+ * Exercise ioctls whose arguments linux-user converts with the thunk
+ * struct descriptors: pointer-to-scalar and same-layout structs, which
+ * are passed in place, a struct with a special converter, and
+ * read-write structs.  Report the cost per call so that changes to the
+ * conversion paths can be measured.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ITERS   20000
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, double t0)
+{
+    printf("%-12s %8.0f ns/call\n", name, (now() - t0) * 1e9 / ITERS);
+}
+
+static void test_fionread(void)
+{
+    int fds[2];
+    int avail;
+    double t0;
+
+    assert(pipe(fds) == 0);
+    assert(write(fds[1], "0123456789", 10) == 10);
+
+    t0 = now();
+    for (int n = 0; n < ITERS; n++) {
+        avail = -1;
+        assert(ioctl(fds[0], FIONREAD, &avail) == 0);
+        assert(avail == 10);
+    }
+    report("FIONREAD", t0);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void test_pty(void)
+{
+    struct winsize ws = { .ws_row = 24, .ws_col = 80, .ws_xpixel = 640,
+                          .ws_ypixel = 480 };
+    struct winsize got;
+    struct termios tio, tio2;
+    int master, slave;
+    double t0;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) || unlockpt(master)) {
+        printf("SKIP: no pseudo-terminals\n");
+        return;
+    }
+    slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    assert(slave >= 0);
+
+    /* struct winsize has the same layout for every target */
+    assert(ioctl(slave, TIOCSWINSZ, &ws) == 0);
+    t0 = now();
+    for (int n = 0; n < ITERS; n++) {
+        memset(&got, 0, sizeof(got));
+        assert(ioctl(slave, TIOCGWINSZ, &got) == 0);
+        assert(got.ws_row == 24 && got.ws_col == 80);
+        assert(got.ws_xpixel == 640 && got.ws_ypixel == 480);
+    }
+    report("TIOCGWINSZ", t0);
+
+    /* struct termios goes through its special converter */
+    assert(tcgetattr(slave, &tio) == 0);
+    tio.c_lflag &= ~ECHO;
+    tio.c_cc[VMIN] = 3;
+    assert(tcsetattr(slave, TCSANOW, &tio) == 0);
+    t0 = now();
+    for (int n = 0; n < ITERS; n++) {
+        memset(&tio2, 0xff, sizeof(tio2));
+        assert(tcgetattr(slave, &tio2) == 0);
+        assert(!(tio2.c_lflag & ECHO));
+        assert(tio2.c_cc[VMIN] == 3);
+    }
+    report("TCGETS", t0);
+
+    close(slave);
+    close(master);
+}
+
+static void test_ifreq(void)
+{
+    struct ifreq ifr;
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    double t0;
+
+    if (sock < 0) {
+        printf("SKIP: no AF_INET sockets\n");
+        return;
+    }
+
+    /* Read-write structs are converted in both directions */
+    t0 = now();
+    for (int n = 0; n < ITERS; n++) {
+        memset(&ifr, 0, sizeof(ifr));
+        strcpy(ifr.ifr_name, "lo");
+        assert(ioctl(sock, SIOCGIFFLAGS, &ifr) == 0);
+        assert(ifr.ifr_flags & IFF_LOOPBACK);
+    }
+    report("SIOCGIFFLAGS", t0);
+
+    memset(&ifr, 0, sizeof(ifr));
+    strcpy(ifr.ifr_name, "lo");
+    assert(ioctl(sock, SIOCGIFINDEX, &ifr) == 0);
+    assert(ifr.ifr_ifindex > 0);
+
+    /* A failing ioctl must not write back to the guest */
+    memset(&ifr, 0, sizeof(ifr));
+    strcpy(ifr.ifr_name, "no-such-if");
+    ifr.ifr_flags = 0x1234;
+    errno = 0;
+    assert(ioctl(sock, SIOCGIFFLAGS, &ifr) == -1);
+    assert(errno == ENODEV);
+    assert(ifr.ifr_flags == 0x1234);
+    assert(strcmp(ifr.ifr_name, "no-such-if") == 0);
+
+    close(sock);
+}
+
+int main(void)
+{
+    test_fionread();
+    test_pty();
+    test_ifreq();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+/*
+ * Exercise syscalls whose arguments linux-user has to marshal: check
+ * the results, and report the cost per call so that changes to the
+ * conversion paths can be measured.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ITERS   20000
+#define NR_IOV  16
+#define NR_FDS  32
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, double t0)
+{
+    printf("%-12s %8.0f ns/call\n", name, (now() - t0) * 1e9 / ITERS);
+}
+
+static void test_iovec(void)
+{
+    char out[NR_IOV][8], in[NR_IOV][8];
+    struct iovec wiov[NR_IOV], riov[NR_IOV];
+    int fds[2];
+    double t0;
+
+    assert(pipe(fds) == 0);
+    for (int i = 0; i < NR_IOV; i++) {
+        memset(out[i], 'a' + i, sizeof(out[i]));
+        wiov[i].iov_base = out[i];
+        wiov[i].iov_len = sizeof(out[i]);
+        riov[i].iov_base = in[i];
+        riov[i].iov_len = sizeof(in[i]);
+    }
+
+    t0 = now();
+    for (int n = 0; n < ITERS; n++) {
+        memset(in, 0, sizeof(in));
+        assert(writev(fds[1], wiov, NR_IOV) == sizeof(out));
+        assert(readv(fds[0], riov, NR_IOV) == sizeof(in));
+        assert(memcmp(in, out, sizeof(in)) == 0);
+    }
+    report("writev+readv", t0);
+
+    /* A zero-length entry in the middle must be skipped. */
+    riov[1].iov_len = 0;
+    assert(writev(fds[1], wiov, 2) == 16);
+    assert(readv(fds[0], riov, 3) == 16);
+    assert(memcmp(in[0], out[0], 8) == 0 && memcmp(in[2], out[1], 8) == 0);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void test_epoll(void)
+{
+    struct epoll_event ev, events[NR_FDS];
+    int pipes[NR_FDS][2];
+    int epfd = epoll_create1(0);
+    double t0;
+
+    assert(epfd >= 0);
+    for (int i = 0; i < NR_FDS; i++) {
+        assert(pipe(pipes[i]) == 0);
+        assert(write(pipes[i][1], "x", 1) == 1);
+        ev.events = EPOLLIN;
+        ev.data.u64 = 0x1234567800000000ull | i;
+        assert(epoll_ctl(epfd, EPOLL_CTL_ADD, pipes[i][0], &ev) == 0);
+    }
+
+    t0 = now();
+    for (int n = 0; n < ITERS; n++) {
+        unsigned seen = 0;
+
+        assert(epoll_wait(epfd, events, NR_FDS, 0) == NR_FDS);
+        for (int i = 0; i < NR_FDS; i++) {
+            assert(events[i].events == EPOLLIN);
+            assert(events[i].data.u64 >> 32 == 0x12345678);
+            seen |= 1u << (events[i].data.u64 & 31);
+        }
+        assert(seen == 0xffffffffu);
+    }
+    report("epoll_wait", t0);
+
+    for (int i = 0; i < NR_FDS; i++) {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+    close(epfd);
+}
+
+int main(void)
+{
+    test_iovec();
+    test_epoll();
+    return EXIT_SUCCESS;
+}
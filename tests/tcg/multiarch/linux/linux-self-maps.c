@@ -0,0 +1,98 @@
+/*
+ * Read /proc/self/maps repeatedly: check that every change to the
+ * mappings shows up in the next read, and report the cost of a read
+ * when nothing changed in between.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ITERS   2000
+
+static char maps[1 << 20];
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void read_maps(const char *name)
+{
+    int fd = open(name, O_RDONLY);
+    size_t len = 0;
+    ssize_t n;
+
+    assert(fd >= 0);
+    while ((n = read(fd, maps + len, sizeof(maps) - 1 - len)) > 0) {
+        len += n;
+    }
+    assert(n == 0);
+    maps[len] = '\0';
+    close(fd);
+}
+
+/* Return the permissions of the line starting at @p, or NULL. */
+static const char *find_perms(void *p)
+{
+    const char *line;
+
+    for (line = maps; *line; line = strchr(line, '\n') + 1) {
+        if (strtoul(line, NULL, 16) == (unsigned long)p) {
+            return strchr(line, ' ') + 1;
+        }
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    size_t pagesize = getpagesize();
+    const char *perms;
+    double t0;
+    char *p;
+
+    p = mmap(NULL, 3 * pagesize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+             -1, 0);
+    assert(p != MAP_FAILED);
+
+    read_maps("/proc/self/maps");
+    perms = find_perms(p);
+    assert(perms && strncmp(perms, "r--p", 4) == 0);
+
+    /* Split the mapping: the middle page becomes a line of its own. */
+    assert(mprotect(p + pagesize, pagesize, PROT_READ | PROT_WRITE) == 0);
+    read_maps("/proc/self/maps");
+    perms = find_perms(p + pagesize);
+    assert(perms && strncmp(perms, "rw-p", 4) == 0);
+
+    assert(munmap(p + pagesize, pagesize) == 0);
+    read_maps("/proc/self/maps");
+    assert(find_perms(p + pagesize) == NULL);
+    assert(find_perms(p + 2 * pagesize) != NULL);
+
+    /* smaps must not be served from the maps text, nor vice versa. */
+    read_maps("/proc/self/smaps");
+    assert(strstr(maps, "KernelPageSize:") != NULL);
+    read_maps("/proc/self/maps");
+    assert(strstr(maps, "KernelPageSize:") == NULL);
+
+    t0 = now();
+    for (int i = 0; i < ITERS; i++) {
+        read_maps("/proc/self/maps");
+    }
+    printf("maps read %8.0f ns/call\n", (now() - t0) * 1e9 / ITERS);
+
+    munmap(p, pagesize);
+    munmap(p + 2 * pagesize, pagesize);
+    return EXIT_SUCCESS;
+}
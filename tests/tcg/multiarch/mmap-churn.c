@@ -0,0 +1,90 @@
+/*
+ * Churn through many small mappings, leaving the address space
+ * fragmented, and check that new mappings never land on live ones.
+ * This is also a benchmark for the guest vma allocator: with the
+ * holes too small for the new mappings, a linear search degrades
+ * quadratically.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NR_MAPS 8192
+
+static char *maps[NR_MAPS];
+static size_t sizes[NR_MAPS];
+
+static char *map_pages(size_t len, int prot)
+{
+    char *p = mmap(NULL, len, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    assert(p != MAP_FAILED);
+    return p;
+}
+
+static void check(int i)
+{
+    if ((i & 1) == 0) {
+        /* Even mappings are writable and tagged with their index. */
+        assert(*(int *)maps[i] == i);
+    }
+}
+
+static double elapsed(struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) * 1e-9;
+}
+
+int main(void)
+{
+    size_t pagesize = getpagesize();
+    struct timespec t0;
+    int i, round;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    /*
+     * Alternate protections so that neighbouring mappings cannot be
+     * merged into one vma.
+     */
+    for (i = 0; i < NR_MAPS; i++) {
+        sizes[i] = pagesize;
+        maps[i] = map_pages(pagesize, i & 1 ? PROT_READ
+                                            : PROT_READ | PROT_WRITE);
+        if ((i & 1) == 0) {
+            *(int *)maps[i] = i;
+        }
+    }
+
+    for (round = 0; round < 4; round++) {
+        /* Punch single page holes... */
+        for (i = 1; i < NR_MAPS; i += 2) {
+            assert(munmap(maps[i], sizes[i]) == 0);
+        }
+        /* ... which are too small for the replacements. */
+        for (i = 1; i < NR_MAPS; i += 2) {
+            sizes[i] = pagesize * (2 + round);
+            maps[i] = map_pages(sizes[i], PROT_READ);
+        }
+        for (i = 0; i < NR_MAPS; i++) {
+            check(i);
+        }
+    }
+
+    for (i = 0; i < NR_MAPS; i++) {
+        check(i);
+        assert(munmap(maps[i], sizes[i]) == 0);
+    }
+
+    printf("%d mappings, %d rounds: %.3fs\n", NR_MAPS, round, elapsed(&t0));
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,50 @@
+/*
+ * Thread Churn
+ *
+ * Create and exit many more threads than are ever alive at the same
+ * time.  Each thread gets a vCPU, whose index is reused once the
+ * thread has exited; run with plugins, this checks that per-vCPU
+ * plugin state stays consistent when indexes are handed out again.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WAVES       200
+#define PER_WAVE    8
+
+static void *thread_fn(void *arg)
+{
+    unsigned long *sum = arg;
+
+    for (unsigned long i = 0; i < 1000; i++) {
+        *sum += i;
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_t threads[PER_WAVE];
+    unsigned long sums[PER_WAVE];
+
+    for (int wave = 0; wave < WAVES; wave++) {
+        for (int i = 0; i < PER_WAVE; i++) {
+            sums[i] = 0;
+            assert(pthread_create(&threads[i], NULL, thread_fn,
+                                  &sums[i]) == 0);
+        }
+        for (int i = 0; i < PER_WAVE; i++) {
+            assert(pthread_join(threads[i], NULL) == 0);
+            assert(sums[i] == 999 * 1000 / 2);
+        }
+    }
+
+    printf("Created %d threads, at most %d at a time\n",
+           WAVES * PER_WAVE, PER_WAVE);
+    return EXIT_SUCCESS;
+}
@@ -54,6 +54,8 @@ static uint64_t global_count_tb;
 static uint64_t global_count_insn;
 static uint64_t global_count_mem;
 static unsigned int max_cpu_index;
+/* If set, the highest number of vcpus the guest may need */
+static unsigned int max_vcpus;
 static GMutex tb_lock;
 static GMutex insn_lock;
 static GMutex mem_lock;
@@ -127,6 +129,15 @@ static void plugin_exit(qemu_plugin_id_t id, void *udata)
     g_autoptr(GString) stats = g_string_new("");
     g_assert(num_cpus == max_cpu_index + 1);
 
+    /*
+     * vcpu indexes of exited threads are reused, so the number of vcpus
+     * (and the size of the scoreboards) only depends on how many threads
+     * were alive at the same time.
+     */
+    g_string_printf(stats, "vcpus: %u\n", num_cpus);
+    qemu_plugin_outs(stats->str);
+    g_assert(!max_vcpus || num_cpus <= max_vcpus);
+
     for (int i = 0; i < num_cpus ; ++i) {
         const uint64_t tb = qemu_plugin_u64_get(count_tb, i);
         const uint64_t tb_inline = qemu_plugin_u64_get(count_tb_inline, i);
@@ -277,6 +288,18 @@ QEMU_PLUGIN_EXPORT
 int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
                         int argc, char **argv)
 {
+    for (int i = 0; i < argc; i++) {
+        char *opt = argv[i];
+        g_auto(GStrv) tokens = g_strsplit(opt, "=", 2);
+
+        if (g_strcmp0(tokens[0], "max_vcpus") == 0 && tokens[1]) {
+            max_vcpus = g_ascii_strtoull(tokens[1], NULL, 10);
+        } else {
+            fprintf(stderr, "option parsing failed: %s\n", opt);
+            return -1;
+        }
+    }
+
     counts = qemu_plugin_scoreboard_new(sizeof(CPUCount));
     count_tb = qemu_plugin_scoreboard_u64_in_struct(
         counts, CPUCount, count_tb);
@@ -19,12 +19,15 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
 typedef struct {
     uint64_t mem_count;
     uint64_t io_count;
+    uint64_t buffer_count;
 } CPUCount;
 
 static struct qemu_plugin_scoreboard *counts;
 static qemu_plugin_u64 mem_count;
 static qemu_plugin_u64 io_count;
-static bool do_inline, do_callback;
+static qemu_plugin_u64 buffer_count;
+static struct qemu_plugin_mem_buffer *buffer;
+static bool do_inline, do_callback, do_buffer;
 static bool do_haddr;
 static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
 
@@ -40,8 +43,21 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
         g_string_append_printf(out, "io accesses: %" PRIu64 "\n",
                                qemu_plugin_u64_sum(io_count));
     }
+    if (do_buffer) {
+        g_string_append_printf(out, "buffered accesses: %" PRIu64 "\n",
+                               qemu_plugin_u64_sum(buffer_count));
+    }
     qemu_plugin_outs(out->str);
+    if (do_buffer && (do_inline || do_callback)) {
+        /* The buffers must see every access the other methods count. */
+        g_assert(qemu_plugin_u64_sum(buffer_count) ==
+                 qemu_plugin_u64_sum(mem_count) +
+                 qemu_plugin_u64_sum(io_count));
+    }
     qemu_plugin_scoreboard_free(counts);
+    if (buffer) {
+        qemu_plugin_mem_buffer_free(buffer);
+    }
 }
 
 static void vcpu_mem(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
@@ -60,6 +76,16 @@ static void vcpu_mem(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
     }
 }
 
+static void vcpu_mem_buffer(unsigned int cpu_index,
+                            const struct qemu_plugin_mem_record *records,
+                            size_t n, void *udata)
+{
+    for (size_t i = 0; i < n; i++) {
+        g_assert(records[i].info != 0);
+    }
+    qemu_plugin_u64_add(buffer_count, cpu_index, n);
+}
+
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 {
     size_t n = qemu_plugin_tb_n_insns(tb);
@@ -79,6 +105,9 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
                                              QEMU_PLUGIN_CB_NO_REGS,
                                              rw, NULL);
         }
+        if (do_buffer) {
+            qemu_plugin_register_vcpu_mem_buffer(insn, rw, buffer);
+        }
     }
 }
 
@@ -112,6 +141,11 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
                 fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
                 return -1;
             }
+        } else if (g_strcmp0(tokens[0], "buffer") == 0) {
+            if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &do_buffer)) {
+                fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
+                return -1;
+            }
         } else if (g_strcmp0(tokens[0], "callback") == 0) {
             if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &do_callback)) {
                 fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
@@ -133,6 +167,11 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
     mem_count = qemu_plugin_scoreboard_u64_in_struct(
         counts, CPUCount, mem_count);
     io_count = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, io_count);
+    buffer_count = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, buffer_count);
+    if (do_buffer) {
+        buffer = qemu_plugin_mem_buffer_new(1024, vcpu_mem_buffer, NULL);
+    }
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
     return 0;
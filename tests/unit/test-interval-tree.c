@@ -193,6 +193,114 @@ static void test_find_many_range(void)
     }
 }
 
+static IntervalGapNode gap_nodes[200];
+
+static void test_gap_fixed(void)
+{
+    /* Intervals [10,19], [30,39], [45,49]. */
+    gap_nodes[0].itree.start = 10;
+    gap_nodes[0].itree.last = 19;
+    gap_nodes[1].itree.start = 30;
+    gap_nodes[1].itree.last = 39;
+    gap_nodes[2].itree.start = 45;
+    gap_nodes[2].itree.last = 49;
+    for (int i = 0; i < 3; ++i) {
+        interval_gap_insert(&gap_nodes[i], &root);
+    }
+
+    g_assert_cmpuint(interval_gap_find_first(&root, 0, 99, 10, 1), ==, 0);
+    g_assert_cmpuint(interval_gap_find_first(&root, 1, 99, 10, 1), ==, 20);
+    g_assert_cmpuint(interval_gap_find_first(&root, 1, 99, 5, 1), ==, 1);
+    g_assert_cmpuint(interval_gap_find_first(&root, 10, 99, 5, 1), ==, 20);
+    g_assert_cmpuint(interval_gap_find_first(&root, 10, 99, 5, 4), ==, 20);
+    g_assert_cmpuint(interval_gap_find_first(&root, 21, 99, 5, 1), ==, 21);
+    g_assert_cmpuint(interval_gap_find_first(&root, 21, 99, 5, 4), ==, 24);
+    g_assert_cmpuint(interval_gap_find_first(&root, 21, 99, 10, 1), ==, 50);
+    g_assert_cmpuint(interval_gap_find_first(&root, 21, 54, 10, 1), ==, -1);
+    g_assert_cmpuint(interval_gap_find_first(&root, 21, 59, 10, 1), ==, 50);
+    g_assert_cmpuint(interval_gap_find_first(&root, 21, 59, 10, 4), ==, -1);
+    g_assert_cmpuint(interval_gap_find_first(&root, 10, 39, 1, 1), ==, 20);
+    g_assert_cmpuint(interval_gap_find_first(&root, 30, 39, 1, 1), ==, -1);
+    g_assert_cmpuint(interval_gap_find_first(&root, 50, UINT64_MAX,
+                                             UINT64_MAX - 49, 1), ==, 50);
+
+    /* The tree must also be searchable as a plain interval tree. */
+    g_assert(interval_tree_iter_first(&root, 35, 46) == &gap_nodes[1].itree);
+    g_assert(interval_tree_iter_next(&gap_nodes[1].itree, 35, 46)
+             == &gap_nodes[2].itree);
+
+    for (int i = 0; i < 3; ++i) {
+        interval_gap_remove(&gap_nodes[i], &root);
+    }
+    g_assert(root.rb_root.rb_node == NULL);
+}
+
+static uint64_t gap_find_slow(const uint8_t *used, uint64_t min, uint64_t max,
+                              uint64_t len, uint64_t align)
+{
+    for (uint64_t a = ROUND_UP(min, align);
+         a <= max && max - a >= len - 1; a += align) {
+        uint64_t i;
+
+        for (i = 0; i < len && !used[a + i]; ++i) {
+            continue;
+        }
+        if (i == len) {
+            return a;
+        }
+    }
+    return -1;
+}
+
+static void test_gap_random(void)
+{
+    enum { SPACE = 4000 };
+    g_autofree uint8_t *used = g_new0(uint8_t, SPACE);
+    bool inserted[ARRAY_SIZE(gap_nodes)] = { };
+
+    for (int iter = 0; iter < 20000; ++iter) {
+        int n = g_test_rand_int_range(0, ARRAY_SIZE(gap_nodes));
+        IntervalGapNode *g = &gap_nodes[n];
+
+        if (inserted[n]) {
+            interval_gap_remove(g, &root);
+            memset(used + g->itree.start, 0,
+                   g->itree.last - g->itree.start + 1);
+            inserted[n] = false;
+        } else {
+            uint64_t start = g_test_rand_int_range(0, SPACE - 32);
+            uint64_t len = g_test_rand_int_range(1, 32);
+
+            if (memchr(used + start, 1, len)) {
+                continue;
+            }
+            g->itree.start = start;
+            g->itree.last = start + len - 1;
+            interval_gap_insert(g, &root);
+            memset(used + start, 1, len);
+            inserted[n] = true;
+        }
+
+        if (iter % 16 == 0) {
+            uint64_t min = g_test_rand_int_range(0, SPACE);
+            uint64_t max = g_test_rand_int_range(min, SPACE);
+            uint64_t len = g_test_rand_int_range(1, 64);
+            uint64_t align = 1 << g_test_rand_int_range(0, 4);
+
+            g_assert_cmpuint(interval_gap_find_first(&root, min, max,
+                                                     len, align), ==,
+                             gap_find_slow(used, min, max, len, align));
+        }
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(gap_nodes); ++i) {
+        if (inserted[i]) {
+            interval_gap_remove(&gap_nodes[i], &root);
+        }
+    }
+    g_assert(root.rb_root.rb_node == NULL);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -204,6 +312,8 @@ int main(int argc, char **argv)
     g_test_add_func("/interval-tree/find-one-range-many",
                     test_find_one_range_many);
     g_test_add_func("/interval-tree/find-many-range", test_find_many_range);
+    g_test_add_func("/interval-tree/gap-fixed", test_gap_fixed);
+    g_test_add_func("/interval-tree/gap-random", test_gap_random);
 
     return g_test_run();
 }
@@ -870,6 +870,232 @@ IntervalTreeNode *interval_tree_iter_next(IntervalTreeNode *node,
     }
 }
 
+/*
+ * Gap trees.
+ *
+ * Similar in spirit to rb_subtree_gap of the Linux vm_area_struct tree,
+ * except that the holes are computed within each subtree only, so that
+ * the augmented values of a node never depend on nodes outside of it.
+ */
+
+#define rb_to_igap(N)  container_of(N, IntervalGapNode, itree.rb)
+
+/* The number of values strictly between @prev_last and @next_first. */
+static inline uint64_t interval_gap_hole(uint64_t prev_last,
+                                         uint64_t next_first)
+{
+    return next_first > prev_last ? next_first - prev_last - 1 : 0;
+}
+
+static bool interval_gap_compute(IntervalGapNode *node, bool exit)
+{
+    uint64_t first = node->itree.start;
+    uint64_t last = node->itree.last;
+    uint64_t gap = 0;
+    IntervalGapNode *child;
+
+    if (node->itree.rb.rb_left) {
+        child = rb_to_igap(node->itree.rb.rb_left);
+        first = child->subtree_first;
+        gap = MAX(child->subtree_gap,
+                  interval_gap_hole(child->itree.subtree_last,
+                                    node->itree.start));
+        last = MAX(last, child->itree.subtree_last);
+    }
+    if (node->itree.rb.rb_right) {
+        child = rb_to_igap(node->itree.rb.rb_right);
+        gap = MAX(gap, child->subtree_gap);
+        gap = MAX(gap, interval_gap_hole(last, child->subtree_first));
+        last = MAX(last, child->itree.subtree_last);
+    }
+    if (exit &&
+        node->itree.subtree_last == last &&
+        node->subtree_first == first &&
+        node->subtree_gap == gap) {
+        return true;
+    }
+    node->itree.subtree_last = last;
+    node->subtree_first = first;
+    node->subtree_gap = gap;
+    return false;
+}
+
+static void interval_gap_propagate(RBNode *rb, RBNode *stop)
+{
+    while (rb != stop) {
+        IntervalGapNode *node = rb_to_igap(rb);
+        if (interval_gap_compute(node, true)) {
+            break;
+        }
+        rb = rb_parent(&node->itree.rb);
+    }
+}
+
+static void interval_gap_copy(RBNode *rb_old, RBNode *rb_new)
+{
+    IntervalGapNode *old = rb_to_igap(rb_old);
+    IntervalGapNode *new = rb_to_igap(rb_new);
+
+    new->itree.subtree_last = old->itree.subtree_last;
+    new->subtree_first = old->subtree_first;
+    new->subtree_gap = old->subtree_gap;
+}
+
+static void interval_gap_rotate(RBNode *rb_old, RBNode *rb_new)
+{
+    interval_gap_copy(rb_old, rb_new);
+    interval_gap_compute(rb_to_igap(rb_old), false);
+}
+
+static const RBAugmentCallbacks interval_gap_augment = {
+    .propagate = interval_gap_propagate,
+    .copy = interval_gap_copy,
+    .rotate = interval_gap_rotate,
+};
+
+void interval_gap_insert(IntervalGapNode *node, IntervalTreeRoot *root)
+{
+    RBNode **link = &root->rb_root.rb_node, *prb = NULL;
+    uint64_t start = node->itree.start, last = node->itree.last;
+    IntervalGapNode *parent;
+    bool leftmost = true;
+
+    while (*link) {
+        prb = *link;
+        parent = rb_to_igap(prb);
+
+        /* As for interval_tree_insert, keep lockless lookups correct. */
+        if (parent->itree.subtree_last < last) {
+            parent->itree.subtree_last = last;
+        }
+        if (start < parent->itree.start) {
+            link = &parent->itree.rb.rb_left;
+        } else {
+            link = &parent->itree.rb.rb_right;
+            leftmost = false;
+        }
+    }
+
+    node->itree.subtree_last = last;
+    node->subtree_first = start;
+    node->subtree_gap = 0;
+    rb_link_node(&node->itree.rb, prb, link);
+
+    /*
+     * subtree_last was raised on the way down, so a parent that appears
+     * unchanged does not imply unchanged ancestors: recompute them all.
+     */
+    for (; prb; prb = rb_parent(prb)) {
+        interval_gap_compute(rb_to_igap(prb), false);
+    }
+    rb_insert_augmented_cached(&node->itree.rb, root, leftmost,
+                               &interval_gap_augment);
+}
+
+void interval_gap_remove(IntervalGapNode *node, IntervalTreeRoot *root)
+{
+    rb_erase_augmented_cached(&node->itree.rb, root, &interval_gap_augment);
+}
+
+typedef struct IntervalGapSearch {
+    uint64_t min, max, len, align_m1;
+    uint64_t next;      /* First value past the intervals visited so far */
+    bool done;          /* No hole left within [min, max] */
+    uint64_t ret;
+} IntervalGapSearch;
+
+/* Step over intervals ending at @last. */
+static void interval_gap_advance(IntervalGapSearch *s, uint64_t last)
+{
+    if (last >= s->max) {
+        s->done = true;
+    } else if (last >= s->next) {
+        s->next = last + 1;
+    }
+}
+
+/* Try to fit the search into the hole [s->next, @hole_last]. */
+static bool interval_gap_fit(IntervalGapSearch *s, uint64_t hole_last)
+{
+    uint64_t lo = MAX(s->next, s->min);
+    uint64_t hi = MIN(hole_last, s->max);
+    uint64_t aligned = (lo + s->align_m1) & ~s->align_m1;
+
+    if (aligned < lo || aligned > hi || hi - aligned < s->len - 1) {
+        return false;
+    }
+    s->ret = aligned;
+    return true;
+}
+
+static bool interval_gap_search(IntervalGapNode *node, IntervalGapSearch *s)
+{
+    RBNode *rb;
+
+    if (s->done) {
+        return false;
+    }
+
+    /* Everything in this subtree is below the search range. */
+    if (node->itree.subtree_last < s->min) {
+        interval_gap_advance(s, node->itree.subtree_last);
+        return false;
+    }
+
+    /*
+     * If no hole within the subtree is large enough, or the subtree
+     * is above the search range, only the hole before it can match.
+     */
+    if (node->subtree_gap < s->len || node->subtree_first > s->max) {
+        if (node->subtree_first != 0 &&
+            interval_gap_fit(s, node->subtree_first - 1)) {
+            return true;
+        }
+        interval_gap_advance(s, node->itree.subtree_last);
+        return false;
+    }
+
+    rb = node->itree.rb.rb_left;
+    if (rb && interval_gap_search(rb_to_igap(rb), s)) {
+        return true;
+    }
+    if (s->done) {
+        return false;
+    }
+    if (node->itree.start != 0 &&
+        interval_gap_fit(s, node->itree.start - 1)) {
+        return true;
+    }
+    interval_gap_advance(s, node->itree.last);
+
+    rb = node->itree.rb.rb_right;
+    return rb && interval_gap_search(rb_to_igap(rb), s);
+}
+
+uint64_t interval_gap_find_first(IntervalTreeRoot *root,
+                                 uint64_t min, uint64_t max,
+                                 uint64_t len, uint64_t align)
+{
+    IntervalGapSearch s = {
+        .min = min,
+        .max = max,
+        .len = len,
+        .align_m1 = align - 1,
+    };
+    RBNode *rb = root->rb_root.rb_node;
+
+    assert(len != 0);
+    assert(min <= max);
+
+    if (rb && interval_gap_search(rb_to_igap(rb), &s)) {
+        return s.ret;
+    }
+    if (!s.done && interval_gap_fit(&s, max)) {
+        return s.ret;
+    }
+    return -1;
+}
+
 /* Occasionally useful for calling from within the debugger. */
 #if 0
 static void debug_interval_tree_int(IntervalTreeNode *node,
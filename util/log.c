@@ -495,6 +495,9 @@ const QEMULogItem qemu_log_items[] = {
     { CPU_LOG_TB_NOCHAIN, "nochain",
       "do not chain compiled TBs so that \"exec\" and \"cpu\" show\n"
       "complete traces" },
+    { CPU_LOG_TB_NOCSE, "nocse",
+      "do not eliminate redundant ops and CPU state loads/stores\n"
+      "in the TCG optimizer" },
 #ifdef CONFIG_PLUGIN
     { CPU_LOG_PLUGIN, "plugin", "output from TCG plugins"},
 #endif